@@ -0,0 +1,215 @@
+/*
+ * bitsbench.c - Throughput of the batch primitives in bitsvec.c
+ *
+ * For each batch function and each kernel level the CPU supports (scalar,
+ * SSE2, AVX2), prints the cost per element of the best of -r passes over
+ * -n random inputs. The cost is in TSC cycles on x86 and in nanoseconds
+ * elsewhere. Before a level is timed, its output is compared with the
+ * bits.c function, starting one element in so that unaligned loads and a
+ * scalar tail are covered too. With -x, every vector kernel is first also
+ * checked against bits.c on all 2^32 inputs; most of the few minutes
+ * this takes go to the scalar float_i2f.
+ *
+ * Build here or in the unpacked datalab-handout directory:
+ *
+ *   gcc -O2 -fwrapv -o bitsbench bitsbench.c bitsvec.c bits.c
+ *
+ * Usage: bitsbench [-x] [-n <elements>] [-r <reps>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+#else
+#define UNIT "ns"
+#endif
+
+#define NLEVELS 3   /* scalar, SSE2, AVX2 */
+#define CHUNK (1 << 20)
+
+/* From bits.c */
+int bitParity(int x);
+int modThree(int x);
+int satMul2(int x);
+unsigned float_i2f(int x);
+unsigned float_half(unsigned uf);
+
+/* From bitsvec.c */
+int bits_batch_limit(int level);
+void bitParity_batch(int *dst, const int *src, size_t n);
+void modThree_batch(int *dst, const int *src, size_t n);
+void satMul2_batch(int *dst, const int *src, size_t n);
+void float_i2f_batch(unsigned *dst, const int *src, size_t n);
+void float_half_batch(unsigned *dst, const unsigned *src, size_t n);
+
+static const char *level_names[NLEVELS] = { "scalar", "sse2", "avx2" };
+
+/* Every primitive through one signature, on raw 32-bit words */
+struct prim {
+  const char *name;
+  unsigned (*scalar)(unsigned x);
+  void (*batch)(unsigned *dst, const unsigned *src, size_t n);
+};
+
+#define PRIM(name, dst_t, src_t)                                      \
+  static unsigned name##_word(unsigned x)                             \
+  {                                                                   \
+    return (unsigned)name((src_t)x);                                  \
+  }                                                                   \
+  static void name##_words(unsigned *dst, const unsigned *src, size_t n) \
+  {                                                                   \
+    name##_batch((dst_t *)dst, (const src_t *)src, n);                \
+  }
+
+PRIM(bitParity, int, int)
+PRIM(modThree, int, int)
+PRIM(satMul2, int, int)
+PRIM(float_i2f, unsigned, int)
+PRIM(float_half, unsigned, unsigned)
+
+static const struct prim prims[] = {
+  { "bitParity", bitParity_word, bitParity_words },
+  { "modThree", modThree_word, modThree_words },
+  { "satMul2", satMul2_word, satMul2_words },
+  { "float_i2f", float_i2f_word, float_i2f_words },
+  { "float_half", float_half_word, float_half_words },
+};
+#define NPRIMS (sizeof(prims) / sizeof(prims[0]))
+
+static unsigned long long now_ticks(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* check - Compare n outputs of p's batch form at the current level with bits.c */
+static void check(const struct prim *p, int level, unsigned *out,
+                  const unsigned *src, size_t n)
+{
+  size_t i;
+
+  p->batch(out, src, n);
+  for (i = 0; i < n; i++) {
+    if (out[i] != p->scalar(src[i])) {
+      printf("Error: %s (%s) gives 0x%08x for 0x%08x, bits.c gives 0x%08x\n",
+             p->name, level_names[level], out[i], src[i], p->scalar(src[i]));
+      exit(1);
+    }
+  }
+}
+
+/* exhaustive - Check every vector kernel on all 2^32 inputs */
+static void exhaustive(unsigned *src, unsigned *ref, unsigned *out)
+{
+  unsigned long long base;
+  size_t k, i;
+  int level, top = bits_batch_limit(NLEVELS - 1);
+
+  for (k = 0; k < NPRIMS; k++) {
+    for (base = 0; base < (1ULL << 32); base += CHUNK) {
+      for (i = 0; i < CHUNK; i++) {
+        src[i] = (unsigned)(base + i);
+        ref[i] = prims[k].scalar(src[i]);
+      }
+      for (level = 1; level <= top; level++) {
+        bits_batch_limit(level);
+        prims[k].batch(out, src, CHUNK);
+        if (memcmp(out, ref, CHUNK * sizeof(unsigned)) != 0)
+          check(&prims[k], level, out, src, CHUNK);
+      }
+    }
+    printf("%s: all 2^32 inputs match on %d vector levels\n", prims[k].name, top);
+  }
+}
+
+static void usage(void)
+{
+  printf("Usage: bitsbench [-x] [-n <elements>] [-r <reps>]\n");
+  printf("-x         First check each vector kernel on all 2^32 inputs.\n");
+  printf("-n <num>   Elements per pass (default 16384).\n");
+  printf("-r <num>   Timed passes per point (default 50).\n");
+}
+
+int main(int argc, char *argv[])
+{
+  size_t n = 16384, i, k;
+  int reps = 50, full = 0, opt, level, top, r;
+  unsigned *src, *out, *ref;
+  unsigned long long best, start, t;
+
+  while ((opt = getopt(argc, argv, "hxn:r:")) != -1) {
+    switch (opt) {
+    case 'x':
+      full = 1;
+      break;
+    case 'n':
+      n = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'h':
+      usage();
+      exit(0);
+    default:
+      usage();
+      exit(1);
+    }
+  }
+  if (n < 2 || reps < 1) {
+    usage();
+    exit(1);
+  }
+
+  src = malloc((n > CHUNK ? n : CHUNK) * sizeof(unsigned));
+  out = malloc((n > CHUNK ? n : CHUNK) * sizeof(unsigned));
+  ref = malloc(CHUNK * sizeof(unsigned));
+  if (src == NULL || out == NULL || ref == NULL) {
+    printf("Error: Cannot allocate buffers\n");
+    exit(1);
+  }
+  top = bits_batch_limit(NLEVELS - 1);
+  if (full)
+    exhaustive(src, ref, out);
+
+  srand(1);
+  for (i = 0; i < n; i++)
+    src[i] = ((unsigned)rand() << 16) ^ (unsigned)rand();
+
+  printf("%-12s", "function");
+  for (level = 0; level <= top; level++)
+    printf(" %8s", level_names[level]);
+  printf("  (%s/element)\n", UNIT);
+  for (k = 0; k < NPRIMS; k++) {
+    printf("%-12s", prims[k].name);
+    for (level = 0; level <= top; level++) {
+      bits_batch_limit(level);
+      check(&prims[k], level, out, src + 1, n - 1);
+      best = ~0ULL;
+      for (r = 0; r < reps; r++) {
+        start = now_ticks();
+        prims[k].batch(out, src, n);
+        t = now_ticks() - start;
+        if (t < best)
+          best = t;
+      }
+      printf(" %8.2f", (double)best / n);
+    }
+    printf("\n");
+  }
+  free(src);
+  free(out);
+  free(ref);
+  return 0;
+}
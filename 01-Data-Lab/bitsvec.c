@@ -0,0 +1,307 @@
+/*
+ * bitsvec.c - Batch forms of five bits.c primitives
+ *
+ * name_batch(dst, src, n) stores name(src[i]) in dst[i] for i < n; dst
+ * may be src. The vector kernels do each bits.c trick lane by lane, eight
+ * lanes with AVX2 or four with SSE2, and the best one the CPU has is picked
+ * at run time. Tails, and machines without them, call the bits.c function
+ * itself. float_i2f is the one kernel that is not a transcription: its
+ * normalising loop has no lane-wise form, and cvtdq2ps rounds to nearest
+ * even exactly as it does. bitsbench -x checks every kernel against bits.c
+ * on all 2^32 inputs.
+ *
+ * bits.c relies on wrapping shifts and adds, so build it with -fwrapv as
+ * the handout Makefile does.
+ */
+#include <stddef.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BITS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Kernel levels for bits_batch_limit() */
+#define BITS_SCALAR 0
+#define BITS_SSE2   1
+#define BITS_AVX2   2
+
+/* From bits.c */
+int bitParity(int x);
+int modThree(int x);
+int satMul2(int x);
+unsigned float_i2f(int x);
+unsigned float_half(unsigned uf);
+
+static int bits_limit = BITS_AVX2;
+
+/* bits_level - The highest kernel level allowed and supported */
+static int bits_level(void)
+{
+#ifdef BITS_X86
+  if (bits_limit >= BITS_AVX2 && __builtin_cpu_supports("avx2"))
+    return BITS_AVX2;
+  if (bits_limit >= BITS_SSE2)
+    return BITS_SSE2;
+#endif
+  return BITS_SCALAR;
+}
+
+/*
+ * bits_batch_limit - Use no kernel above level (0 scalar, 1 SSE2, 2 AVX2)
+ *   and return the level the batch functions will now run at.
+ */
+int bits_batch_limit(int level)
+{
+  bits_limit = level;
+  return bits_level();
+}
+
+#ifdef BITS_X86
+/*
+ * Each kernel handles the longest prefix of src that fills whole vectors
+ * and returns its length.
+ */
+#define LOAD4(p) _mm_loadu_si128((const __m128i *)(p))
+#define STORE4(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define LOAD8(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STORE8(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+/* bitParity - fold the word onto its lowest bit with shifts and xors */
+static size_t bitParity_sse2(int *dst, const int *src, size_t n)
+{
+  const __m128i one = _mm_set1_epi32(1);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i x = LOAD4(src + i);
+    x = _mm_xor_si128(_mm_srai_epi32(x, 16), x);
+    x = _mm_xor_si128(_mm_srai_epi32(x, 8), x);
+    x = _mm_xor_si128(_mm_srai_epi32(x, 4), x);
+    x = _mm_xor_si128(_mm_srai_epi32(x, 2), x);
+    x = _mm_xor_si128(_mm_srai_epi32(x, 1), x);
+    STORE4(dst + i, _mm_and_si128(x, one));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t bitParity_avx2(int *dst, const int *src, size_t n)
+{
+  const __m256i one = _mm256_set1_epi32(1);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i x = LOAD8(src + i);
+    x = _mm256_xor_si256(_mm256_srai_epi32(x, 16), x);
+    x = _mm256_xor_si256(_mm256_srai_epi32(x, 8), x);
+    x = _mm256_xor_si256(_mm256_srai_epi32(x, 4), x);
+    x = _mm256_xor_si256(_mm256_srai_epi32(x, 2), x);
+    x = _mm256_xor_si256(_mm256_srai_epi32(x, 1), x);
+    STORE8(dst + i, _mm256_and_si256(x, one));
+  }
+  return i;
+}
+
+/*
+ * modThree - sum the base-4 digits down to 0..3, map 3 to 0, then move
+ * negative x's nonzero remainders down by 3
+ */
+#define FOLD4(s, k, m) _mm_add_epi32(_mm_srai_epi32(s, k), _mm_and_si128(s, m))
+#define FOLD8(s, k, m) _mm256_add_epi32(_mm256_srai_epi32(s, k), _mm256_and_si256(s, m))
+
+static size_t modThree_sse2(int *dst, const int *src, size_t n)
+{
+  const __m128i m1 = _mm_set1_epi32(0xffff), m2 = _mm_set1_epi32(0xff);
+  const __m128i m3 = _mm_set1_epi32(0xf), m4 = _mm_set1_epi32(3);
+  const __m128i a = _mm_set1_epi32(-3), zero = _mm_setzero_si128();
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i x = LOAD4(src + i);
+    __m128i s = FOLD4(x, 16, m1), t, sign;
+    s = FOLD4(s, 16, m1);
+    s = FOLD4(s, 8, m2);
+    s = FOLD4(s, 8, m2);
+    s = FOLD4(s, 4, m3);
+    s = FOLD4(s, 4, m3);
+    s = FOLD4(s, 2, m4);
+    s = FOLD4(s, 2, m4);
+
+    t = _mm_add_epi32(s, a);
+    sign = _mm_srai_epi32(t, 31);
+    s = _mm_or_si128(_mm_andnot_si128(sign, t), _mm_and_si128(s, sign));
+
+    sign = _mm_srai_epi32(x, 31);
+    t = _mm_andnot_si128(_mm_cmpeq_epi32(s, zero), _mm_and_si128(a, sign));
+    STORE4(dst + i, _mm_add_epi32(s, t));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t modThree_avx2(int *dst, const int *src, size_t n)
+{
+  const __m256i m1 = _mm256_set1_epi32(0xffff), m2 = _mm256_set1_epi32(0xff);
+  const __m256i m3 = _mm256_set1_epi32(0xf), m4 = _mm256_set1_epi32(3);
+  const __m256i a = _mm256_set1_epi32(-3), zero = _mm256_setzero_si256();
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i x = LOAD8(src + i);
+    __m256i s = FOLD8(x, 16, m1), t, sign;
+    s = FOLD8(s, 16, m1);
+    s = FOLD8(s, 8, m2);
+    s = FOLD8(s, 8, m2);
+    s = FOLD8(s, 4, m3);
+    s = FOLD8(s, 4, m3);
+    s = FOLD8(s, 2, m4);
+    s = FOLD8(s, 2, m4);
+
+    t = _mm256_add_epi32(s, a);
+    sign = _mm256_srai_epi32(t, 31);
+    s = _mm256_or_si256(_mm256_andnot_si256(sign, t), _mm256_and_si256(s, sign));
+
+    sign = _mm256_srai_epi32(x, 31);
+    t = _mm256_andnot_si256(_mm256_cmpeq_epi32(s, zero), _mm256_and_si256(a, sign));
+    STORE8(dst + i, _mm256_add_epi32(s, t));
+  }
+  return i;
+}
+
+/* satMul2 - where x << 1 flips the sign bit, the saturated value of x's sign */
+static size_t satMul2_sse2(int *dst, const int *src, size_t n)
+{
+  const __m128i tmax = _mm_set1_epi32(0x7fffffff);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i x = LOAD4(src + i);
+    __m128i y = _mm_slli_epi32(x, 1);
+    __m128i ov = _mm_srai_epi32(_mm_xor_si128(x, y), 31);
+    __m128i sat = _mm_xor_si128(_mm_srai_epi32(x, 31), tmax);
+    STORE4(dst + i, _mm_or_si128(_mm_and_si128(ov, sat), _mm_andnot_si128(ov, y)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t satMul2_avx2(int *dst, const int *src, size_t n)
+{
+  const __m256i tmax = _mm256_set1_epi32(0x7fffffff);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i x = LOAD8(src + i);
+    __m256i y = _mm256_slli_epi32(x, 1);
+    __m256i ov = _mm256_srai_epi32(_mm256_xor_si256(x, y), 31);
+    __m256i sat = _mm256_xor_si256(_mm256_srai_epi32(x, 31), tmax);
+    STORE8(dst + i, _mm256_or_si256(_mm256_and_si256(ov, sat), _mm256_andnot_si256(ov, y)));
+  }
+  return i;
+}
+
+/* float_i2f - the conversion instruction, under the default rounding mode */
+static size_t float_i2f_sse2(unsigned *dst, const int *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    STORE4(dst + i, _mm_castps_si128(_mm_cvtepi32_ps(LOAD4(src + i))));
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t float_i2f_avx2(unsigned *dst, const int *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    STORE8(dst + i, _mm256_castps_si256(_mm256_cvtepi32_ps(LOAD8(src + i))));
+  return i;
+}
+
+/*
+ * float_half - an exponent of 0 or 1 shifts exponent and fraction right
+ * together, rounding to even; other finite values lose one from the
+ * exponent, and NaN and infinity are kept
+ */
+static size_t float_half_sse2(unsigned *dst, const unsigned *src, size_t n)
+{
+  const __m128i sign = _mm_set1_epi32(0x80000000), low = _mm_set1_epi32(0xffffff);
+  const __m128i expo = _mm_set1_epi32(0x7f800000), exp1 = _mm_set1_epi32(0x800000);
+  const __m128i one = _mm_set1_epi32(1), small_max = _mm_set1_epi32(0x800001);
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128i x = LOAD4(src + i);
+    __m128i exp = _mm_and_si128(x, expo);
+    __m128i half = _mm_or_si128(_mm_and_si128(x, sign),
+                                _mm_srli_epi32(_mm_and_si128(x, low), 1));
+    __m128i round = _mm_and_si128(_mm_and_si128(x, _mm_srli_epi32(x, 1)), one);
+    __m128i is_small = _mm_cmpgt_epi32(small_max, exp);
+    __m128i is_nan = _mm_cmpeq_epi32(exp, expo);
+    __m128i r;
+
+    half = _mm_add_epi32(half, round);
+    r = _mm_or_si128(_mm_and_si128(is_small, half),
+                     _mm_andnot_si128(is_small, _mm_sub_epi32(x, exp1)));
+    STORE4(dst + i, _mm_or_si128(_mm_and_si128(is_nan, x), _mm_andnot_si128(is_nan, r)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t float_half_avx2(unsigned *dst, const unsigned *src, size_t n)
+{
+  const __m256i sign = _mm256_set1_epi32(0x80000000), low = _mm256_set1_epi32(0xffffff);
+  const __m256i expo = _mm256_set1_epi32(0x7f800000), exp1 = _mm256_set1_epi32(0x800000);
+  const __m256i one = _mm256_set1_epi32(1), small_max = _mm256_set1_epi32(0x800001);
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i x = LOAD8(src + i);
+    __m256i exp = _mm256_and_si256(x, expo);
+    __m256i half = _mm256_or_si256(_mm256_and_si256(x, sign),
+                                   _mm256_srli_epi32(_mm256_and_si256(x, low), 1));
+    __m256i round = _mm256_and_si256(_mm256_and_si256(x, _mm256_srli_epi32(x, 1)), one);
+    __m256i is_small = _mm256_cmpgt_epi32(small_max, exp);
+    __m256i is_nan = _mm256_cmpeq_epi32(exp, expo);
+    __m256i r;
+
+    half = _mm256_add_epi32(half, round);
+    r = _mm256_blendv_epi8(_mm256_sub_epi32(x, exp1), half, is_small);
+    STORE8(dst + i, _mm256_blendv_epi8(r, x, is_nan));
+  }
+  return i;
+}
+
+/* The batch functions, dispatching to the best kernel before the tail */
+#define BATCH(name, dst_t, src_t)                             \
+  void name##_batch(dst_t *dst, const src_t *src, size_t n)   \
+  {                                                           \
+    size_t i = 0;                                             \
+    int level = bits_level();                                 \
+                                                              \
+    if (level >= BITS_AVX2)                                   \
+      i = name##_avx2(dst, src, n);                           \
+    else if (level >= BITS_SSE2)                              \
+      i = name##_sse2(dst, src, n);                           \
+    for (; i < n; i++)                                        \
+      dst[i] = name(src[i]);                                  \
+  }
+#else
+#define BATCH(name, dst_t, src_t)                             \
+  void name##_batch(dst_t *dst, const src_t *src, size_t n)   \
+  {                                                           \
+    size_t i;                                                 \
+                                                              \
+    for (i = 0; i < n; i++)                                   \
+      dst[i] = name(src[i]);                                  \
+  }
+#endif
+
+BATCH(bitParity, int, int)
+BATCH(modThree, int, int)
+BATCH(satMul2, int, int)
+BATCH(float_i2f, unsigned, int)
+BATCH(float_half, unsigned, unsigned)
@@ -1,28 +1,50 @@
+#define _POSIX_C_SOURCE 200809L // mmap, popen
 #include "cachelab.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-// Cache line structure
-typedef struct {
-    int valid;
-    unsigned long long tag;
-    int lru_counter;
-} cache_line;
+// Binary trace: BTRACE_MAGIC, then one record per data access. A record is a
+// byte with the operation in its top two bits and the size in the low six
+// (0 means a varint size follows), then the address as a zigzag varint of
+// its difference from the previous address. Operation 3 is an instruction
+// fetch, kept only when converting with -P.
+#define BTRACE_MAGIC "CSIMBT1\n"
+#define BTRACE_MAGIC_LEN 8
+#define BTRACE_MAX_RECORD 21            // op byte and two 10-byte varints
+#define ZSTD_MAGIC "\x28\xb5\x2f\xfd"  // zstd frames are read through zstd -dc
+#define CHUNK_SIZE (1 << 20)            // read size for inputs that can't be mapped
 
-// Cache set structure
-typedef struct {
-    cache_line *lines;
-} cache_set;
+#define MAX_SWEEP 64                    // values per -s/-E/-b list
+#define MAX_LEVELS 4                    // -L levels in a hierarchy
+#define RRPV_MAX 3                      // 2-bit re-reference prediction values
+#define TOP_KEYS 10                     // rows in the miss breakdown
+#define EMPTY_BLOCK (~0ULL)             // block number of an empty hierarchy line
+#define SWEEP_BATCH 65536               // accesses handed to the sweep workers at once
+
+enum { OP_LOAD, OP_STORE, OP_MODIFY, OP_INSTR };
+static const char op_chars[] = "LSMI";
 
-// Cache structure
+// Cache structure: the lines of all sets in two flat arrays, set i owning
+// entries [i * E, (i + 1) * E). stamps[] holds the time of each line's last
+// use, 0 for an empty line, so the LRU victim is the smallest stamp and a hit
+// is one tag compare across the set.
 typedef struct {
     int s;
     int E;
     int b;
-    cache_set *sets;
+    unsigned long long *tags;
+    unsigned long long *stamps;
+    unsigned long long clock;
 } cache;
 
 // Global variables for results
@@ -30,33 +52,55 @@ int hit_count = 0;
 int miss_count = 0;
 int eviction_count = 0;
 
+// Index of tag in tags[0..n), or n. Compares four tags per step with SSE2.
+static inline int find_tag(const unsigned long long *tags, int n, unsigned long long tag) {
+    int i = 0;
+#ifdef __SSE2__
+    if (n >= 4) {
+        __m128i key = _mm_set1_epi64x((long long)tag);
+        for (; i + 4 <= n; i += 4) {
+            __m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(tags + i)), key);
+            __m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(tags + i + 2)), key);
+            // A 64-bit lane matches when both of its 32-bit halves do
+            lo = _mm_and_si128(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+            hi = _mm_and_si128(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+            int mask = _mm_movemask_pd(_mm_castsi128_pd(lo)) |
+                       _mm_movemask_pd(_mm_castsi128_pd(hi)) << 2;
+            if (mask) return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (tags[i] == tag) return i;
+    }
+    return n;
+}
+
 // Function to initialize the cache
 cache init_cache(int s, int E, int b) {
     cache new_cache;
     new_cache.s = s;
     new_cache.E = E;
     new_cache.b = b;
-    int S = 1 << s; // Number of sets
+    size_t lines = ((size_t)1 << s) * E;
 
-    new_cache.sets = (cache_set *)malloc(S * sizeof(cache_set));
-    for (int i = 0; i < S; i++) {
-        new_cache.sets[i].lines = (cache_line *)malloc(E * sizeof(cache_line));
-        for (int j = 0; j < E; j++) {
-            new_cache.sets[i].lines[j].valid = 0;
-            new_cache.sets[i].lines[j].tag = 0;
-            new_cache.sets[i].lines[j].lru_counter = 0;
-        }
+    // One allocation for both arrays. Empty lines get a tag no address
+    // produces (s + b > 0), so lookups need not check validity.
+    new_cache.tags = malloc(2 * lines * sizeof(unsigned long long));
+    if (new_cache.tags == NULL) {
+        printf("Error: Not enough memory for the cache\n");
+        exit(1);
     }
+    new_cache.stamps = new_cache.tags + lines;
+    memset(new_cache.tags, 0xff, lines * sizeof(unsigned long long));
+    memset(new_cache.stamps, 0, lines * sizeof(unsigned long long));
+    new_cache.clock = 0;
     return new_cache;
 }
 
 // Function to free the cache memory
 void free_cache(cache my_cache) {
-    int S = 1 << my_cache.s;
-    for (int i = 0; i < S; i++) {
-        free(my_cache.sets[i].lines);
-    }
-    free(my_cache.sets);
+    free(my_cache.tags);
 }
 
 // Function to simulate a memory access
@@ -65,75 +109,858 @@ void access_cache(cache *my_cache, unsigned long long address, int verbose) {
     int E = my_cache->E;
     int b = my_cache->b;
 
-    unsigned long long set_index_mask = (1 << s) - 1;
+    unsigned long long set_index_mask = (1ULL << s) - 1;
     unsigned long long set_index = (address >> b) & set_index_mask;
     unsigned long long tag = address >> (s + b);
 
-    cache_set *current_set = &my_cache->sets[set_index];
+    unsigned long long *tags = my_cache->tags + set_index * E;
+    unsigned long long *stamps = my_cache->stamps + set_index * E;
+    unsigned long long now = ++my_cache->clock;
+
+    // Check for hit
+    int i = find_tag(tags, E, tag);
+    if (i < E) {
+        hit_count++;
+        if (verbose) printf(" hit");
+        stamps[i] = now;
+        return;
+    }
+
+    // Miss: replace the least recently used line, or an empty one (stamp 0)
+    miss_count++;
+    if (verbose) printf(" miss");
+    int victim = 0;
+    for (i = 1; i < E; i++) {
+        if (stamps[i] < stamps[victim]) victim = i;
+    }
+    if (stamps[victim] != 0) {
+        eviction_count++;
+        if (verbose) printf(" eviction");
+    }
+    tags[victim] = tag;
+    stamps[victim] = now;
+}
+
+// Where parsed accesses go: the cache, or a binary trace being written
+cache sim_cache;
+int verbose = 0;
+FILE *convert_out = NULL;
+unsigned long long convert_prev = 0;
+
+void put_varint(FILE *out, unsigned long long v) {
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc((int)v, out);
+}
+
+void convert_access(int op, unsigned long long address, unsigned long long size) {
+    long long delta = (long long)(address - convert_prev);
+
+    putc(op << 6 | (size < 64 ? (int)size : 0), convert_out);
+    if (size == 0 || size >= 64) {
+        put_varint(convert_out, size);
+    }
+    put_varint(convert_out, ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+    convert_prev = address;
+}
+
+// Sweep mode simulates every (s, E, b) from the -s/-E/-b lists in one pass.
+// LRU has the inclusion property: a set with E lines holds exactly the E most
+// recently used blocks mapped to it. So one sweep_sim per (s, b) keeps each
+// set's blocks in recency order, truncated to the largest E, and records the
+// stack distance of every access (Mattson et al.). An access hits in an
+// E-way cache iff its distance is below E, and misses evict iff the set
+// already held E blocks.
+typedef struct {
+    int s, b;
+    int depth;                         // largest E swept
+    unsigned long long *stack;         // per set, depth tags with the MRU first
+    int *fill;                         // tags in use per set
+    unsigned long long *distance;      // accesses found at each stack position
+    unsigned long long accesses;
+    unsigned long long cold_evictions[MAX_SWEEP]; // per E: new blocks into a full set
+} sweep_sim;
+
+int sweep_s[MAX_SWEEP], sweep_E[MAX_SWEEP], sweep_b[MAX_SWEEP];
+int n_sweep_s, n_sweep_E, n_sweep_b;
+sweep_sim *sweep_sims = NULL;
+int n_sweep_sims;
+
+// Accesses are batched; worker t runs the sims with index t mod n_workers
+unsigned long long sweep_batch[SWEEP_BATCH];
+int sweep_batch_len;
+int n_workers = 1;
+int sweep_done;
+pthread_barrier_t batch_ready, batch_used;
+
+void sweep_sim_access(sweep_sim *sim, unsigned long long address) {
+    unsigned long long set = (address >> sim->b) & ((1ULL << sim->s) - 1);
+    unsigned long long tag = address >> (sim->s + sim->b);
+    unsigned long long *stack = sim->stack + set * sim->depth;
+    int fill = sim->fill[set], d;
 
-    // Update LRU counters for the set
-    for (int i = 0; i < E; i++) {
-        if (current_set->lines[i].valid) {
-            current_set->lines[i].lru_counter++;
+    sim->accesses++;
+    // Most reuses sit near the MRU end, so a plain scan beats find_tag here
+    for (d = 0; d < fill && stack[d] != tag; d++)
+        ;
+    if (d < fill) {
+        sim->distance[d]++;
+    } else {
+        for (int k = 0; k < n_sweep_E && sweep_E[k] <= fill; k++) {
+            sim->cold_evictions[k]++;
         }
+        if (fill < sim->depth) {
+            sim->fill[set] = ++fill;
+        }
+        d = fill - 1;
     }
+    memmove(stack + 1, stack, d * sizeof(*stack)); // move to the front
+    stack[0] = tag;
+}
 
-    // Check for hit
-    for (int i = 0; i < E; i++) {
-        if (current_set->lines[i].valid && current_set->lines[i].tag == tag) {
-            hit_count++;
-            if (verbose) printf(" hit");
-            current_set->lines[i].lru_counter = 0; // Reset LRU counter on hit
-            return;
+void sweep_run(int worker) {
+    for (int i = worker; i < n_sweep_sims; i += n_workers) {
+        for (int j = 0; j < sweep_batch_len; j++) {
+            sweep_sim_access(&sweep_sims[i], sweep_batch[j]);
         }
     }
+}
 
-    // Miss
-    miss_count++;
-    if (verbose) printf(" miss");
+void *sweep_worker(void *arg) {
+    int worker = (int)(long)arg;
 
-    // Find an empty line
-    for (int i = 0; i < E; i++) {
-        if (!current_set->lines[i].valid) {
-            current_set->lines[i].valid = 1;
-            current_set->lines[i].tag = tag;
-            current_set->lines[i].lru_counter = 0;
-            return;
+    for (;;) {
+        pthread_barrier_wait(&batch_ready);
+        if (sweep_done) return NULL;
+        sweep_run(worker);
+        pthread_barrier_wait(&batch_used);
+    }
+}
+
+// Run the batch on all sims; main thread takes worker 0's share
+void sweep_flush() {
+    if (n_workers > 1) {
+        pthread_barrier_wait(&batch_ready);
+        sweep_run(0);
+        pthread_barrier_wait(&batch_used);
+    } else {
+        sweep_run(0);
+    }
+    sweep_batch_len = 0;
+}
+
+void sweep_access(unsigned long long address) {
+    sweep_batch[sweep_batch_len++] = address;
+    if (sweep_batch_len == SWEEP_BATCH) {
+        sweep_flush();
+    }
+}
+
+int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Parse "4", "2-8" or "1,2,4,16-32" into vals; returns the count
+int parse_list(const char *arg, int *vals, int min) {
+    const char *p = arg;
+    char *end;
+    int n = 0;
+
+    while (*p) {
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) goto bad;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) goto bad;
+        }
+        if (lo < min || hi < lo || hi - lo >= MAX_SWEEP - n) goto bad;
+        for (long v = lo; v <= hi; v++) vals[n++] = (int)v;
+        p = end;
+        if (*p == ',') p++;
+        else if (*p) goto bad;
+    }
+    return n;
+bad:
+    printf("Error: Bad value list '%s'\n", arg);
+    exit(1);
+}
+
+void sweep_init() {
+    int n = 0;
+
+    // Ascending E, so the cold_evictions loop in sweep_sim_access stops early
+    qsort(sweep_E, n_sweep_E, sizeof(int), cmp_int);
+    for (int k = 0; k < n_sweep_E; k++) {
+        if (n == 0 || sweep_E[k] != sweep_E[n - 1]) sweep_E[n++] = sweep_E[k];
+    }
+    n_sweep_E = n;
+
+    n_sweep_sims = n_sweep_s * n_sweep_b;
+    sweep_sims = calloc(n_sweep_sims, sizeof(sweep_sim));
+    for (int i = 0; i < n_sweep_s; i++) {
+        for (int j = 0; j < n_sweep_b; j++) {
+            sweep_sim *sim = &sweep_sims[i * n_sweep_b + j];
+            size_t S = (size_t)1 << sweep_s[i];
+            sim->s = sweep_s[i];
+            sim->b = sweep_b[j];
+            sim->depth = sweep_E[n_sweep_E - 1];
+            sim->stack = malloc(S * sim->depth * sizeof(*sim->stack));
+            sim->fill = calloc(S, sizeof(int));
+            sim->distance = calloc(sim->depth, sizeof(*sim->distance));
+            if (sim->stack == NULL || sim->fill == NULL || sim->distance == NULL) {
+                printf("Error: Not enough memory for s=%d E=%d\n", sim->s, sim->depth);
+                exit(1);
+            }
+        }
+    }
+
+    pthread_t tid;
+    if (n_workers > 1) {
+        pthread_barrier_init(&batch_ready, NULL, n_workers);
+        pthread_barrier_init(&batch_used, NULL, n_workers);
+        for (long t = 1; t < n_workers; t++) {
+            pthread_create(&tid, NULL, sweep_worker, (void *)t);
+            pthread_detach(tid);
+        }
+    }
+}
+
+// Flush the last batch, stop the workers and print a row per geometry
+void sweep_finish() {
+    sweep_flush();
+    if (n_workers > 1) {
+        sweep_done = 1;
+        pthread_barrier_wait(&batch_ready);
+    }
+
+    printf("%4s %6s %4s %12s %12s %12s %8s\n", "s", "E", "b", "hits", "misses", "evictions", "miss%");
+    for (int i = 0; i < n_sweep_sims; i++) {
+        sweep_sim *sim = &sweep_sims[i];
+        unsigned long long reuses = 0, hits = 0;
+        int d = 0;
+
+        for (int j = 0; j < sim->depth; j++) {
+            reuses += sim->distance[j];
+        }
+        for (int k = 0; k < n_sweep_E; k++) {
+            for (; d < sweep_E[k]; d++) {
+                hits += sim->distance[d];
+            }
+            // Misses on blocks seen before always find their set full
+            unsigned long long misses = sim->accesses - hits;
+            unsigned long long evictions = reuses - hits + sim->cold_evictions[k];
+            printf("%4d %6d %4d %12llu %12llu %12llu %7.2f%%\n", sim->s, sweep_E[k], sim->b,
+                   hits, misses, evictions, sim->accesses ? 100.0 * misses / sim->accesses : 0.0);
+        }
+    }
+}
+
+// Hierarchy mode (-L) models up to MAX_LEVELS levels, L1 first, all with the
+// same block size. Lines store the block number (address >> b). Lower levels
+// are non-inclusive by default, or inclusive (an eviction invalidates copies
+// above it) or exclusive (filled only by victims from above, and a hit moves
+// the block up). Writes are write-back/write-allocate, or with -w wt
+// write-through/no-write-allocate, in which case no line is ever dirty.
+enum { POLICY_LRU, POLICY_PLRU, POLICY_RRIP, POLICY_RANDOM };
+enum { INCLUSION_NINE, INCLUSION_INCLUSIVE, INCLUSION_EXCLUSIVE };
+static const char *policy_names[] = { "lru", "plru", "rrip", "random" };
+static const char *inclusion_names[] = { "nine", "incl", "excl" };
+
+typedef struct {
+    int s, E, b, policy;
+    unsigned long long *blocks;        // S * E, EMPTY_BLOCK when empty
+    unsigned long long *meta;          // LRU stamp or RRIP value per line
+    unsigned long long *plru;          // tree bits per set, node i at bit i
+    unsigned char *dirty;
+    unsigned long long clock;
+    unsigned long long hits, misses, evictions, writebacks;
+} level;
+
+level levels[MAX_LEVELS];
+int n_levels;
+int inclusion = INCLUSION_NINE;
+int write_back = 1;
+unsigned long long mem_reads, mem_writes;
+unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+// Miss breakdown: per-PC (-P, from the trace's I records) or per address
+// region of 2^region_bits bytes (-R), counted at every level
+typedef struct {
+    unsigned long long key;
+    unsigned long long misses[MAX_LEVELS];
+    int used;
+} key_stats;
+
+int track_pc = 0, region_bits = -1;
+unsigned long long current_pc;
+key_stats *key_table;
+size_t key_cap, key_count;
+
+key_stats *key_slot(key_stats *table, size_t cap, unsigned long long key) {
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) >> 20 & (cap - 1);
+    while (table[i].used && table[i].key != key) i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+void count_miss(unsigned long long key, int i) {
+    if (key_count * 10 >= key_cap * 7) {
+        size_t cap = key_cap ? key_cap * 2 : 1024;
+        key_stats *table = calloc(cap, sizeof(key_stats));
+        for (size_t j = 0; j < key_cap; j++) {
+            if (key_table[j].used) *key_slot(table, cap, key_table[j].key) = key_table[j];
+        }
+        free(key_table);
+        key_table = table;
+        key_cap = cap;
+    }
+    key_stats *e = key_slot(key_table, key_cap, key);
+    if (!e->used) {
+        e->used = 1;
+        e->key = key;
+        key_count++;
+    }
+    e->misses[i]++;
+}
+
+int level_find(level *l, unsigned long long block) {
+    unsigned long long set = block & ((1ULL << l->s) - 1);
+    int way = find_tag(l->blocks + set * l->E, l->E, block);
+    return way < l->E ? (int)(set * l->E) + way : -1;
+}
+
+// Record a use of line (set * E + way)
+void level_touch(level *l, int line, int inserted) {
+    switch (l->policy) {
+    case POLICY_LRU:
+        l->meta[line] = ++l->clock;
+        break;
+    case POLICY_RRIP:
+        l->meta[line] = inserted ? RRPV_MAX - 1 : 0; // SRRIP: new lines predicted far
+        break;
+    case POLICY_PLRU: {
+        int way = line % l->E, node = 1;
+        unsigned long long *bits = &l->plru[line / l->E];
+        for (int span = l->E >> 1; span >= 1; span >>= 1) {
+            int right = (way & span) != 0;
+            if (right) *bits &= ~(1ULL << node); // point away from the way used
+            else *bits |= 1ULL << node;
+            node = node * 2 + right;
+        }
+        break;
+    }
+    }
+}
+
+// Line to replace in set: an empty one first, else by policy
+int level_victim(level *l, unsigned long long set) {
+    int base = (int)(set * l->E), way = find_tag(l->blocks + base, l->E, EMPTY_BLOCK);
+
+    if (way < l->E) return base + way;
+    switch (l->policy) {
+    case POLICY_LRU:
+        way = 0;
+        for (int i = 1; i < l->E; i++) {
+            if (l->meta[base + i] < l->meta[base + way]) way = i;
+        }
+        break;
+    case POLICY_RRIP:
+        for (;;) {
+            for (way = 0; way < l->E && l->meta[base + way] < RRPV_MAX; way++)
+                ;
+            if (way < l->E) break;
+            for (int i = 0; i < l->E; i++) l->meta[base + i]++;
+        }
+        break;
+    case POLICY_PLRU: {
+        int node = 1;
+        way = 0;
+        for (int span = l->E >> 1; span >= 1; span >>= 1) {
+            int right = (l->plru[set] >> node) & 1;
+            way |= right ? span : 0;
+            node = node * 2 + right;
+        }
+        break;
+    }
+    default:
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+        way = (int)(rng_state % l->E);
+        break;
+    }
+    return base + way;
+}
+
+void level_fill(int i, unsigned long long block, int dirty);
+
+// Dirty data leaving level i - 1 is written into level i, allocating on a miss
+void write_down(int i, unsigned long long block) {
+    if (i == n_levels) {
+        mem_writes++;
+        return;
+    }
+    int line = level_find(&levels[i], block);
+    if (line >= 0) {
+        levels[i].dirty[line] = 1;
+    } else {
+        level_fill(i, block, 1);
+    }
+}
+
+// block has been displaced from level i
+void level_evict(int i, unsigned long long block, int dirty) {
+    levels[i].evictions++;
+    if (inclusion == INCLUSION_INCLUSIVE) {
+        for (int j = 0; j < i; j++) {
+            int line = level_find(&levels[j], block);
+            if (line >= 0) {
+                dirty |= levels[j].dirty[line]; // the copy above is newer
+                levels[j].blocks[line] = EMPTY_BLOCK;
+                levels[j].dirty[line] = 0;
+            }
+        }
+    }
+    if (inclusion == INCLUSION_EXCLUSIVE && i + 1 < n_levels) {
+        level_fill(i + 1, block, dirty);
+    } else if (dirty) {
+        levels[i].writebacks++;
+        write_down(i + 1, block);
+    }
+}
+
+void level_fill(int i, unsigned long long block, int dirty) {
+    level *l = &levels[i];
+    int line = level_victim(l, block & ((1ULL << l->s) - 1));
+
+    if (l->blocks[line] != EMPTY_BLOCK) {
+        unsigned long long old = l->blocks[line];
+        int old_dirty = l->dirty[line];
+        l->blocks[line] = EMPTY_BLOCK; // free before the eviction can recurse
+        level_evict(i, old, old_dirty);
+    }
+    // An inclusive eviction can't touch this set: it only invalidates levels above
+    l->blocks[line] = block;
+    l->dirty[line] = (unsigned char)dirty;
+    level_touch(l, line, 1);
+}
+
+// Demand access to level i; returns whether the block arrives dirty, which
+// only happens when it is moved up out of an exclusive level
+int level_access(int i, unsigned long long block, int write, unsigned long long key) {
+    if (i == n_levels) {
+        if (write) mem_writes++;
+        else mem_reads++;
+        return 0;
+    }
+
+    level *l = &levels[i];
+    int line = level_find(l, block);
+    if (line >= 0) {
+        l->hits++;
+        if (i > 0 && inclusion == INCLUSION_EXCLUSIVE) {
+            int dirty = l->dirty[line];
+            l->blocks[line] = EMPTY_BLOCK;
+            l->dirty[line] = 0;
+            return dirty;
+        }
+        level_touch(l, line, 0);
+        if (write) {
+            if (write_back) l->dirty[line] = 1;
+            else level_access(i + 1, block, 1, key);
+        }
+        return 0;
+    }
+
+    l->misses++;
+    if (track_pc || region_bits >= 0) count_miss(key, i);
+    if (write && !write_back) {
+        level_access(i + 1, block, 1, key); // no-write-allocate
+        return 0;
+    }
+    int dirty = level_access(i + 1, block, 0, key);
+    if (i > 0 && inclusion == INCLUSION_EXCLUSIVE) {
+        return dirty; // passes through to the level above
+    }
+    level_fill(i, block, dirty || (write && write_back));
+    return 0;
+}
+
+void hierarchy_access(int op, unsigned long long address) {
+    unsigned long long block = address >> levels[0].b;
+    unsigned long long key = track_pc ? current_pc : region_bits >= 0 ? address >> region_bits : 0;
+
+    if (op != OP_STORE) level_access(0, block, 0, key);
+    if (op != OP_LOAD) level_access(0, block, 1, key);
+}
+
+// Parse "s:E:b[:policy]" into the next level
+void add_level(const char *spec) {
+    char policy[16] = "lru";
+    int s, E, b;
+
+    if (n_levels == MAX_LEVELS) {
+        printf("Error: At most %d levels\n", MAX_LEVELS);
+        exit(1);
+    }
+    if (sscanf(spec, "%d:%d:%d:%15s", &s, &E, &b, policy) < 3 || s < 0 || E < 1 || b < 1 ||
+        s + b >= 64) {
+        printf("Error: Bad level '%s', expected s:E:b[:policy]\n", spec);
+        exit(1);
+    }
+    level *l = &levels[n_levels];
+    memset(l, 0, sizeof(*l));
+    l->s = s;
+    l->E = E;
+    l->b = b;
+    for (l->policy = 0; l->policy < 4 && strcmp(policy, policy_names[l->policy]) != 0; l->policy++)
+        ;
+    if (l->policy == 4) {
+        printf("Error: Unknown policy '%s' (lru, plru, rrip, random)\n", policy);
+        exit(1);
+    }
+    if (l->policy == POLICY_PLRU && (E & (E - 1) || E > 64)) {
+        printf("Error: plru needs E to be a power of two up to 64\n");
+        exit(1);
+    }
+    if (n_levels > 0 && b != levels[0].b) {
+        printf("Error: All levels must have the same block size\n");
+        exit(1);
+    }
+
+    size_t sets = (size_t)1 << s, lines = sets * E;
+    l->blocks = malloc(lines * sizeof(unsigned long long));
+    l->meta = calloc(lines, sizeof(unsigned long long));
+    l->plru = calloc(sets, sizeof(unsigned long long));
+    l->dirty = calloc(lines, 1);
+    if (l->blocks == NULL || l->meta == NULL || l->plru == NULL || l->dirty == NULL) {
+        printf("Error: Not enough memory for level %d\n", n_levels + 1);
+        exit(1);
+    }
+    memset(l->blocks, 0xff, lines * sizeof(unsigned long long));
+    n_levels++;
+}
+
+int cmp_key_stats(const void *a, const void *b) {
+    unsigned long long x = ((const key_stats *)a)->misses[n_levels - 1];
+    unsigned long long y = ((const key_stats *)b)->misses[n_levels - 1];
+    if (x != y) return x < y ? 1 : -1;
+    x = ((const key_stats *)a)->misses[0];
+    y = ((const key_stats *)b)->misses[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void print_hierarchy() {
+    printf("%-5s %4s %6s %4s %-6s %12s %12s %12s %12s %8s\n", "level", "s", "E", "b", "policy",
+           "hits", "misses", "evictions", "writebacks", "miss%");
+    for (int i = 0; i < n_levels; i++) {
+        level *l = &levels[i];
+        unsigned long long n = l->hits + l->misses;
+        printf("L%-4d %4d %6d %4d %-6s %12llu %12llu %12llu %12llu %7.2f%%\n", i + 1, l->s, l->E,
+               l->b, policy_names[l->policy], l->hits, l->misses, l->evictions, l->writebacks,
+               n ? 100.0 * l->misses / n : 0.0);
+    }
+    printf("memory reads %llu, writes %llu (%s, %s)\n", mem_reads, mem_writes,
+           write_back ? "write-back" : "write-through", inclusion_names[inclusion]);
+
+    if (key_table == NULL) return;
+    size_t n = 0;
+    for (size_t j = 0; j < key_cap; j++) {
+        if (key_table[j].used) key_table[n++] = key_table[j];
+    }
+    qsort(key_table, n, sizeof(key_stats), cmp_key_stats);
+    printf("\nTop %s by L%d misses:\n%18s", track_pc ? "instructions" : "address regions",
+           n_levels, track_pc ? "pc" : "region");
+    for (int i = 0; i < n_levels; i++) printf("  %10s%d", "L", i + 1);
+    printf("\n");
+    for (size_t j = 0; j < n && j < TOP_KEYS; j++) {
+        unsigned long long k = key_table[j].key;
+        printf("%18llx", track_pc ? k : k << region_bits);
+        for (int i = 0; i < n_levels; i++) printf("  %11llu", key_table[j].misses[i]);
+        printf("\n");
+    }
+}
+
+void handle_access(int op, unsigned long long address, unsigned long long size) {
+    if (convert_out != NULL) {
+        convert_access(op, address, size);
+        return;
+    }
+    if (op == OP_INSTR) {
+        current_pc = address;
+        return;
+    }
+    if (n_levels > 0) {
+        hierarchy_access(op, address);
+        return;
+    }
+    if (sweep_sims != NULL) {
+        sweep_access(address);
+        if (op == OP_MODIFY) {
+            sweep_access(address);
+        }
+        return;
+    }
+    if (verbose) {
+        printf("%c %llx,%llu", op_chars[op], address, size);
+    }
+    access_cache(&sim_cache, address, verbose);
+    if (op == OP_MODIFY) {
+        access_cache(&sim_cache, address, verbose); // Store after the load
+    }
+    if (verbose) {
+        printf("\n");
+    }
+}
+
+// Hex digit values, -1 for anything else
+signed char hex_value[256];
+
+void init_hex_table() {
+    memset(hex_value, -1, sizeof(hex_value));
+    for (int i = 0; i < 10; i++) hex_value['0' + i] = i;
+    for (int i = 0; i < 6; i++) hex_value['a' + i] = hex_value['A' + i] = 10 + i;
+}
+
+// Parse text lines in [p, end), which must end on a line boundary unless it
+// is the end of the input. Accepts what sscanf(" %c %llx,%d") did; 'I'
+// lines and lines that don't parse are skipped.
+void parse_text(const char *p, const char *end) {
+    while (p < end) {
+        const char *line = p;
+        const char *eol = memchr(p, '\n', end - p);
+        const char *stop = eol ? eol : end;
+        unsigned long long address = 0, size = 0;
+        int op;
+
+        p = eol ? eol + 1 : end;
+        if (*line == 'I' && !track_pc) continue;
+        while (line < stop && (*line == ' ' || *line == '\t')) line++;
+        if (line == stop) continue;
+        switch (*line++) {
+        case 'L': op = OP_LOAD; break;
+        case 'S': op = OP_STORE; break;
+        case 'M': op = OP_MODIFY; break;
+        case 'I': op = OP_INSTR; break;
+        default: continue;
+        }
+        while (line < stop && (*line == ' ' || *line == '\t')) line++;
+        const char *digits = line;
+        for (int v; line < stop && (v = hex_value[(unsigned char)*line]) >= 0; line++) {
+            address = address << 4 | (unsigned long long)v;
+        }
+        if (line == digits || line == stop || *line++ != ',') continue;
+        digits = line;
+        for (; line < stop && *line >= '0' && *line <= '9'; line++) {
+            size = size * 10 + (unsigned long long)(*line - '0');
+        }
+        if (line == digits) continue;
+        handle_access(op, address, size);
+    }
+}
+
+// Returns the position after the varint at p, or NULL if it runs past end
+const unsigned char *get_varint(const unsigned char *p, const unsigned char *end,
+                                unsigned long long *v) {
+    int shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64) {
+        unsigned char c = *p++;
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+// Decode binary records from p until limit, or until a record is cut off by
+// end; returns where decoding stopped.
+const unsigned char *parse_binary(const unsigned char *p, const unsigned char *limit,
+                                  const unsigned char *end, unsigned long long *prev) {
+    while (p < limit) {
+        const unsigned char *rec = p;
+        unsigned long long size = *p & 0x3f, zz;
+        int op = *p++ >> 6;
+
+        if ((size == 0 && (p = get_varint(p, end, &size)) == NULL) ||
+            (p = get_varint(p, end, &zz)) == NULL) {
+            return rec;
+        }
+        *prev += (zz >> 1) ^ (0 - (zz & 1));
+        handle_access(op, *prev, size);
+    }
+    return p;
+}
+
+// Parse a whole trace held in memory
+void parse_buffer(const char *data, size_t len) {
+    if (len >= BTRACE_MAGIC_LEN && memcmp(data, BTRACE_MAGIC, BTRACE_MAGIC_LEN) == 0) {
+        const unsigned char *end = (const unsigned char *)data + len;
+        unsigned long long prev = 0;
+        if (parse_binary((const unsigned char *)data + BTRACE_MAGIC_LEN, end, end, &prev) != end) {
+            printf("Error: Truncated binary trace\n");
+            exit(1);
+        }
+    } else {
+        parse_text(data, data + len);
+    }
+}
+
+// Parse a trace arriving through a pipe or other unmappable file, a chunk
+// at a time, carrying partial lines or records over to the next chunk.
+void parse_stream(FILE *in) {
+    char *buf = malloc(CHUNK_SIZE);
+    size_t len = 0, n;
+    int binary = -1, eof = 0;
+    unsigned long long prev = 0;
+
+    while (!eof) {
+        n = fread(buf + len, 1, CHUNK_SIZE - len, in);
+        len += n;
+        eof = n == 0;
+        if (binary < 0) {
+            if (len < BTRACE_MAGIC_LEN && !eof) continue;
+            binary = len >= BTRACE_MAGIC_LEN && memcmp(buf, BTRACE_MAGIC, BTRACE_MAGIC_LEN) == 0;
+            if (binary) {
+                memmove(buf, buf + BTRACE_MAGIC_LEN, len - BTRACE_MAGIC_LEN);
+                len -= BTRACE_MAGIC_LEN;
+            }
         }
+
+        size_t used;
+        if (binary) {
+            const unsigned char *start = (const unsigned char *)buf, *end = start + len;
+            const unsigned char *limit = eof ? end : len > BTRACE_MAX_RECORD ? end - BTRACE_MAX_RECORD : start;
+            used = parse_binary(start, limit, end, &prev) - start;
+            if (eof && used != len) {
+                printf("Error: Truncated binary trace\n");
+                exit(1);
+            }
+        } else {
+            used = len;
+            if (!eof) {
+                while (used > 0 && buf[used - 1] != '\n') used--;
+                if (used == 0 && len == CHUNK_SIZE) used = len; // overlong line
+            }
+            parse_text(buf, buf + used);
+        }
+        memmove(buf, buf + used, len - used);
+        len -= used;
     }
+    free(buf);
+}
+
+// Quote path for the shell, or exit if it can't be
+void shell_quote(char *dst, size_t size, const char *path) {
+    if (strchr(path, '\'') != NULL || strlen(path) + 3 > size) {
+        printf("Error: Unsupported file name %s\n", path);
+        exit(1);
+    }
+    snprintf(dst, size, "'%s'", path);
+}
 
-    // Eviction
-    eviction_count++;
-    if (verbose) printf(" eviction");
-    int max_lru = -1;
-    int evict_index = -1;
-    for (int i = 0; i < E; i++) {
-        if (current_set->lines[i].lru_counter > max_lru) {
-            max_lru = current_set->lines[i].lru_counter;
-            evict_index = i;
+// Read a text, binary or zstd-compressed trace. Regular files are mapped
+// and parsed in place.
+void read_trace(const char *trace_file) {
+    int fd = open(trace_file, O_RDONLY);
+    struct stat st;
+    char head[4];
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("Error: Cannot open trace file %s\n", trace_file);
+        exit(1);
+    }
+
+    if (pread(fd, head, sizeof(head), 0) == sizeof(head) && memcmp(head, ZSTD_MAGIC, 4) == 0) {
+        char quoted[4096], cmd[4200];
+        shell_quote(quoted, sizeof(quoted), trace_file);
+        snprintf(cmd, sizeof(cmd), "zstd -dcq -- %s", quoted);
+        FILE *in = popen(cmd, "r");
+        if (in == NULL) {
+            printf("Error: Cannot run zstd for %s\n", trace_file);
+            exit(1);
+        }
+        parse_stream(in);
+        if (pclose(in) != 0) {
+            printf("Error: zstd failed on %s\n", trace_file);
+            exit(1);
         }
+        close(fd);
+        return;
     }
-    current_set->lines[evict_index].tag = tag;
-    current_set->lines[evict_index].lru_counter = 0;
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+            parse_buffer(data, st.st_size);
+            munmap(data, st.st_size);
+            close(fd);
+            return;
+        }
+    }
+    FILE *in = fdopen(fd, "r");
+    parse_stream(in);
+    fclose(in);
+}
+
+// Open the converter's output; a name ending in .zst is compressed by zstd
+FILE *open_output(const char *path, int *piped) {
+    size_t n = strlen(path);
+    FILE *out;
+
+    *piped = n > 4 && strcmp(path + n - 4, ".zst") == 0;
+    if (*piped) {
+        char quoted[4096], cmd[4200];
+        shell_quote(quoted, sizeof(quoted), path);
+        snprintf(cmd, sizeof(cmd), "zstd -qf -o %s", quoted);
+        out = popen(cmd, "w");
+    } else {
+        out = fopen(path, "w");
+    }
+    if (out == NULL) {
+        printf("Error: Cannot write %s\n", path);
+        exit(1);
+    }
+    return out;
 }
 
 void print_usage() {
     printf("Usage: ./csim [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("       ./csim [-j <num>] -s <list> -E <list> -b <list> -t <file>\n");
+    printf("       ./csim -L <level> [-L <level>...] [-i <mode>] [-w <mode>] [-P | -R <bits>] -t <file>\n");
+    printf("       ./csim [-P] -c <out> -t <file>\n");
     printf("-h         Print this help message.\n");
     printf("-v         Optional verbose flag.\n");
     printf("-s <num>   Number of set index bits.\n");
     printf("-E <num>   Number of lines per set.\n");
     printf("-b <num>   Number of block offset bits.\n");
-    printf("-t <file>  Trace file.\n");
+    printf("-t <file>  Trace file: text, binary, or either compressed with zstd.\n");
+    printf("-c <out>   Convert the trace to binary form; compressed if <out> ends in .zst.\n");
+    printf("-j <num>   Threads for a sweep.\n");
+    printf("-L <level> Add a hierarchy level s:E:b[:policy], L1 first; policy is lru (default),\n");
+    printf("           plru, rrip or random.\n");
+    printf("-i <mode>  Inclusion of lower levels: nine (default), incl or excl.\n");
+    printf("-w <mode>  Write policy: wb (write-back, write-allocate; default) or wt\n");
+    printf("           (write-through, no-write-allocate).\n");
+    printf("-P         Break misses down by the PC of the preceding I record.\n");
+    printf("-R <bits>  Break misses down by 2^bits-byte address region.\n");
+    printf("\nGiving -s, -E or -b a list such as 1,2,4 or a range such as 4-8 simulates\n");
+    printf("every combination in one pass over the trace and prints a table.\n");
 }
 
+// transsim.c includes this file with CSIM_NO_MAIN to drive the simulator itself
+#ifndef CSIM_NO_MAIN
 int main(int argc, char *argv[]) {
     int s = 0, E = 0, b = 0;
     char *trace_file = NULL;
-    int verbose = 0;
+    char *convert_file = NULL;
 
     int opt;
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "hvs:E:b:t:c:j:L:i:w:PR:")) != -1) {
         switch (opt) {
         case 'h':
             print_usage();
@@ -142,73 +969,128 @@ int main(int argc, char *argv[]) {
             verbose = 1;
             break;
         case 's':
-            s = atoi(optarg);
+            n_sweep_s = parse_list(optarg, sweep_s, 0);
             break;
         case 'E':
-            E = atoi(optarg);
+            n_sweep_E = parse_list(optarg, sweep_E, 1);
             break;
         case 'b':
-            b = atoi(optarg);
+            n_sweep_b = parse_list(optarg, sweep_b, 0);
+            break;
+        case 'j':
+            n_workers = atoi(optarg);
             break;
         case 't':
             trace_file = optarg;
             break;
+        case 'c':
+            convert_file = optarg;
+            break;
+        case 'L':
+            add_level(optarg);
+            break;
+        case 'i':
+            for (inclusion = 0; inclusion < 3 && strcmp(optarg, inclusion_names[inclusion]) != 0;
+                 inclusion++)
+                ;
+            if (inclusion == 3) {
+                printf("Error: Unknown inclusion mode '%s'\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'w':
+            if (strcmp(optarg, "wb") != 0 && strcmp(optarg, "wt") != 0) {
+                printf("Error: Unknown write policy '%s'\n", optarg);
+                exit(1);
+            }
+            write_back = optarg[1] == 'b';
+            break;
+        case 'P':
+            track_pc = 1;
+            break;
+        case 'R':
+            region_bits = atoi(optarg);
+            if (region_bits < 0 || region_bits > 63) {
+                printf("Error: -R needs 0 to 63 bits\n");
+                exit(1);
+            }
+            break;
         default:
             print_usage();
             exit(1);
         }
     }
 
-    if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
-        printf("Error: Missing required command-line argument\n");
-        print_usage();
-        exit(1);
-    }
-
-    cache my_cache = init_cache(s, E, b);
+    init_hex_table();
 
-    FILE *file = fopen(trace_file, "r");
-    if (file == NULL) {
-        printf("Error: Cannot open trace file %s\n", trace_file);
-        exit(1);
+    if (convert_file != NULL && trace_file != NULL) {
+        int piped;
+        convert_out = open_output(convert_file, &piped);
+        fwrite(BTRACE_MAGIC, 1, BTRACE_MAGIC_LEN, convert_out);
+        read_trace(trace_file);
+        if ((piped ? pclose(convert_out) : fclose(convert_out)) != 0) {
+            printf("Error: Cannot write %s\n", convert_file);
+            exit(1);
+        }
+        return 0;
     }
 
-    char operation;
-    unsigned long long address;
-    int size;
-    char line[256];
+    if (n_levels > 0) {
+        if (trace_file == NULL) {
+            printf("Error: Missing required command-line argument\n");
+            print_usage();
+            exit(1);
+        }
+        if (!write_back && inclusion == INCLUSION_EXCLUSIVE) {
+            printf("Error: Exclusive levels need write-back\n");
+            exit(1);
+        }
+        if (track_pc && region_bits >= 0) {
+            printf("Error: -P and -R are exclusive\n");
+            exit(1);
+        }
+        read_trace(trace_file);
+        print_hierarchy();
+        return 0;
+    }
 
-    while (fgets(line, sizeof(line), file)) {
-        if (line[0] == 'I') {
-            continue;
+    // Any list of more than one value selects sweep mode
+    if (n_sweep_s > 1 || n_sweep_E > 1 || n_sweep_b > 1) {
+        if (n_sweep_s == 0 || n_sweep_E == 0 || n_sweep_b == 0 || trace_file == NULL ||
+            n_workers < 1) {
+            printf("Error: Missing required command-line argument\n");
+            print_usage();
+            exit(1);
         }
-        // sscanf returns the number of items successfully read
-        if (sscanf(line, " %c %llx,%d", &operation, &address, &size) == 3) {
-            if (verbose) {
-                printf("%c %llx,%d", operation, address, size);
-            }
-            switch (operation) {
-            case 'L':
-                access_cache(&my_cache, address, verbose);
-                break;
-            case 'S':
-                access_cache(&my_cache, address, verbose);
-                break;
-            case 'M':
-                access_cache(&my_cache, address, verbose); // Load
-                access_cache(&my_cache, address, verbose); // Store
-                break;
-            }
-            if (verbose) {
-                printf("\n");
+        for (int i = 0; i < n_sweep_s; i++) {
+            for (int j = 0; j < n_sweep_b; j++) {
+                if (sweep_s[i] + sweep_b[j] >= 64) {
+                    printf("Error: s + b must be below 64\n");
+                    exit(1);
+                }
             }
         }
+        sweep_init();
+        read_trace(trace_file);
+        sweep_finish();
+        return 0;
+    }
+
+    s = n_sweep_s ? sweep_s[0] : 0;
+    E = n_sweep_E ? sweep_E[0] : 0;
+    b = n_sweep_b ? sweep_b[0] : 0;
+    if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
+        printf("Error: Missing required command-line argument\n");
+        print_usage();
+        exit(1);
     }
 
-    fclose(file);
-    free_cache(my_cache);
+    sim_cache = init_cache(s, E, b);
+    read_trace(trace_file);
+    free_cache(sim_cache);
 
     printSummary(hit_count, miss_count, eviction_count);
 
     return 0;
 }
+#endif
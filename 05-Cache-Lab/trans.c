@@ -6,17 +6,42 @@
  *
  * A transpose function is evaluated by counting the number of misses
  * on a 1KB direct mapped cache with a block size of 32 bytes.
+ *
+ * transpose() and transpose_strided() below are the general form for any
+ * shape and element size, tuned (once transpose_tune() has run) for the
+ * machine they run on rather than for the lab's cache.
  */
+#define _GNU_SOURCE /* sched_setaffinity; implies clock_gettime, posix_memalign */
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #include "cachelab.h"
 #include "contracts.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TRANS_X86 1
+#include <immintrin.h>
+#endif
+
 void trans_32_32(int M, int N, int A[N][M], int B[M][N]);
 void trans_64_64(int M, int N, int A[N][M], int B[M][N]);
 void trans_60_68(int M, int N, int A[N][M], int B[M][N]);
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 
+void transpose(void *dst, const void *src, size_t rows, size_t cols, size_t elem_size);
+void transpose_strided(void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                       size_t rows, size_t cols, size_t elem_size);
+void transpose_tune(void);
+void transpose_parallel(void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                        size_t rows, size_t cols, size_t elem_size, int threads);
+
 /*
  * transpose_submit - This is the solution transpose function that you
  *     will be graded on for Part B of the assignment. Do not change
@@ -208,6 +233,609 @@ void trans_60_68(int M, int N, int A[N][M], int B[M][N])
     }
 }
 
+/*
+ * General transpose: dst (cols x rows) = src^T (rows x cols), with row
+ * strides counted in elements. The matrix is halved along its longer side
+ * until a piece fits in leaf x leaf elements, so every level of the cache
+ * sees a working set it can hold without the code knowing its size. A leaf
+ * is walked in 8x8 tiles transposed in registers (AVX2 for 4- and 8-byte
+ * elements, AVX-512 for 8-byte ones when present); elements of size 1, 2,
+ * 4 and 8 must be naturally aligned, other sizes are copied with memcpy.
+ * Matrices of at least nt_bytes are written with streaming stores so that
+ * filling B does not evict the rest of A.
+ */
+#define TILE 8                      /* micro-kernel tile side */
+#define TUNE_COLS 2048
+#define TUNE_REPS 3
+#define TASK_BYTES (256 << 10)      /* a parallel task's src and dst tiles fit in L2 */
+#define PAR_MIN_BYTES (4 << 20)     /* smaller matrices aren't worth the threads */
+#define MAX_NODES 64
+
+typedef void (*tile_fn)(const char *src, size_t ls, char *dst, size_t ld, int nt);
+
+typedef struct {
+    const char *src;
+    char *dst;
+    size_t ls, ld, es;  /* row strides and element size, in bytes */
+    size_t leaf;        /* recursion stops at leaf x leaf elements */
+    tile_fn tile;       /* NULL when es has no tile kernel */
+    int nt;             /* tile stores may stream */
+} trans_job;
+
+/*
+ * Leaf size and streaming threshold picked by transpose_tune(); the
+ * defaults suit a typical desktop. Both share one word, the leaf in the
+ * low half and the threshold in the high half (UINT32_MAX for never), so
+ * a thread transposing while another tunes reads one consistent pair.
+ */
+#define TRANS_PARAMS(leaf, nt_bytes) ((uint64_t)(nt_bytes) << 32 | (uint32_t)(leaf))
+static uint64_t trans_params = TRANS_PARAMS(64, 64 << 20);
+
+#define TILE_SCALAR(name, T)                                                  \
+static void name(const char *src, size_t ls, char *dst, size_t ld, int nt)    \
+{                                                                             \
+    int i, j;                                                                 \
+    (void)nt;                                                                 \
+    for (i = 0; i < TILE; i++)                                                \
+        for (j = 0; j < TILE; j++)                                            \
+            *(T *)(dst + j * ld + i * sizeof(T)) =                            \
+                *(const T *)(src + i * ls + j * sizeof(T));                   \
+}
+
+TILE_SCALAR(tile_8, uint8_t)
+TILE_SCALAR(tile_16, uint16_t)
+TILE_SCALAR(tile_32, uint32_t)
+TILE_SCALAR(tile_64, uint64_t)
+
+#ifdef TRANS_X86
+/* Rows are interleaved in 32-bit, then 64-bit pairs, then 128-bit lanes */
+__attribute__((target("avx2")))
+static void tile_32_avx2(const char *src, size_t ls, char *dst, size_t ld, int nt)
+{
+    __m256i r[TILE], t[TILE], u[TILE];
+    int k;
+
+    for (k = 0; k < TILE; k++)
+        r[k] = _mm256_loadu_si256((const __m256i *)(src + k * ls));
+    for (k = 0; k < TILE; k += 2) {
+        t[k] = _mm256_unpacklo_epi32(r[k], r[k + 1]);
+        t[k + 1] = _mm256_unpackhi_epi32(r[k], r[k + 1]);
+    }
+    for (k = 0; k < TILE; k += 4) {
+        u[k] = _mm256_unpacklo_epi64(t[k], t[k + 2]);
+        u[k + 1] = _mm256_unpackhi_epi64(t[k], t[k + 2]);
+        u[k + 2] = _mm256_unpacklo_epi64(t[k + 1], t[k + 3]);
+        u[k + 3] = _mm256_unpackhi_epi64(t[k + 1], t[k + 3]);
+    }
+    for (k = 0; k < 4; k++) {
+        r[k] = _mm256_permute2x128_si256(u[k], u[k + 4], 0x20);
+        r[k + 4] = _mm256_permute2x128_si256(u[k], u[k + 4], 0x31);
+    }
+    for (k = 0; k < TILE; k++) {
+        if (nt)
+            _mm256_stream_si256((__m256i *)(dst + k * ld), r[k]);
+        else
+            _mm256_storeu_si256((__m256i *)(dst + k * ld), r[k]);
+    }
+}
+
+/* 8x8 of 64-bit elements as four 4x4 quarters, swapping the off-diagonal two */
+__attribute__((target("avx2")))
+static void tile_64_avx2(const char *src, size_t ls, char *dst, size_t ld, int nt)
+{
+    __m256i r[4], t[4];
+    int q, k;
+
+    for (q = 0; q < 4; q++) {
+        const char *s = src + (q >> 1) * 4 * ls + (q & 1) * 32;
+        char *d = dst + (q & 1) * 4 * ld + (q >> 1) * 32;
+
+        for (k = 0; k < 4; k++)
+            r[k] = _mm256_loadu_si256((const __m256i *)(s + k * ls));
+        t[0] = _mm256_unpacklo_epi64(r[0], r[1]);
+        t[1] = _mm256_unpackhi_epi64(r[0], r[1]);
+        t[2] = _mm256_unpacklo_epi64(r[2], r[3]);
+        t[3] = _mm256_unpackhi_epi64(r[2], r[3]);
+        r[0] = _mm256_permute2x128_si256(t[0], t[2], 0x20);
+        r[1] = _mm256_permute2x128_si256(t[1], t[3], 0x20);
+        r[2] = _mm256_permute2x128_si256(t[0], t[2], 0x31);
+        r[3] = _mm256_permute2x128_si256(t[1], t[3], 0x31);
+        for (k = 0; k < 4; k++) {
+            if (nt)
+                _mm256_stream_si256((__m256i *)(d + k * ld), r[k]);
+            else
+                _mm256_storeu_si256((__m256i *)(d + k * ld), r[k]);
+        }
+    }
+}
+
+/* Row pairs interleave in 64-bit halves, then 128-bit lanes twice */
+__attribute__((target("avx512f")))
+static void tile_64_avx512(const char *src, size_t ls, char *dst, size_t ld, int nt)
+{
+    __m512i r[TILE], t[TILE];
+    int k;
+
+    for (k = 0; k < TILE; k++)
+        r[k] = _mm512_loadu_si512((const void *)(src + k * ls));
+    for (k = 0; k < TILE; k += 2) {
+        t[k] = _mm512_unpacklo_epi64(r[k], r[k + 1]);
+        t[k + 1] = _mm512_unpackhi_epi64(r[k], r[k + 1]);
+    }
+    for (k = 0; k < TILE; k += 4) {
+        r[k] = _mm512_shuffle_i64x2(t[k], t[k + 2], 0x88);
+        r[k + 1] = _mm512_shuffle_i64x2(t[k], t[k + 2], 0xdd);
+        r[k + 2] = _mm512_shuffle_i64x2(t[k + 1], t[k + 3], 0x88);
+        r[k + 3] = _mm512_shuffle_i64x2(t[k + 1], t[k + 3], 0xdd);
+    }
+    /* r[0..3] hold columns {0,4}, {2,6}, {1,5}, {3,7} of rows 0-3 */
+    t[0] = _mm512_shuffle_i64x2(r[0], r[4], 0x88);
+    t[4] = _mm512_shuffle_i64x2(r[0], r[4], 0xdd);
+    t[2] = _mm512_shuffle_i64x2(r[1], r[5], 0x88);
+    t[6] = _mm512_shuffle_i64x2(r[1], r[5], 0xdd);
+    t[1] = _mm512_shuffle_i64x2(r[2], r[6], 0x88);
+    t[5] = _mm512_shuffle_i64x2(r[2], r[6], 0xdd);
+    t[3] = _mm512_shuffle_i64x2(r[3], r[7], 0x88);
+    t[7] = _mm512_shuffle_i64x2(r[3], r[7], 0xdd);
+    for (k = 0; k < TILE; k++) {
+        if (nt)
+            _mm512_stream_si512((void *)(dst + k * ld), t[k]);
+        else
+            _mm512_storeu_si512((void *)(dst + k * ld), t[k]);
+    }
+}
+#endif
+
+/* The fastest tile kernel for es, and the alignment its streaming stores need */
+static tile_fn pick_tile(size_t es, size_t *align)
+{
+    *align = 0;
+    switch (es) {
+    case 1:
+        return tile_8;
+    case 2:
+        return tile_16;
+    case 4:
+#ifdef TRANS_X86
+        if (__builtin_cpu_supports("avx2")) {
+            *align = 32;
+            return tile_32_avx2;
+        }
+#endif
+        return tile_32;
+    case 8:
+#ifdef TRANS_X86
+        if (__builtin_cpu_supports("avx512f")) {
+            *align = 64;
+            return tile_64_avx512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            *align = 32;
+            return tile_64_avx2;
+        }
+#endif
+        return tile_64;
+    }
+    return NULL;
+}
+
+static void trans_scalar(const trans_job *t, size_t r0, size_t r1, size_t c0, size_t c1)
+{
+    size_t i, j;
+
+    for (i = r0; i < r1; i++)
+        for (j = c0; j < c1; j++)
+            memcpy(t->dst + j * t->ld + i * t->es, t->src + i * t->ls + j * t->es, t->es);
+}
+
+/* r0 and c0 are multiples of TILE, which keeps streaming stores aligned */
+static void trans_leaf(const trans_job *t, size_t r0, size_t r1, size_t c0, size_t c1)
+{
+    size_t i, j, rt = r0, ct = c0;
+
+    if (t->tile != NULL) {
+        rt = r0 + ((r1 - r0) & ~(size_t)(TILE - 1));
+        ct = c0 + ((c1 - c0) & ~(size_t)(TILE - 1));
+        for (i = r0; i < rt; i += TILE)
+            for (j = c0; j < ct; j += TILE)
+                t->tile(t->src + i * t->ls + j * t->es, t->ls,
+                        t->dst + j * t->ld + i * t->es, t->ld, t->nt);
+    }
+    trans_scalar(t, r0, rt, ct, c1);
+    trans_scalar(t, rt, r1, c0, c1);
+}
+
+static void trans_rec(const trans_job *t, size_t r0, size_t r1, size_t c0, size_t c1)
+{
+    size_t mid;
+
+    while (r1 - r0 > t->leaf || c1 - c0 > t->leaf) {
+        if (r1 - r0 >= c1 - c0) {
+            mid = r0 + ((r1 - r0) / 2 + TILE - 1) / TILE * TILE;
+            trans_rec(t, r0, mid, c0, c1);
+            r0 = mid;
+        } else {
+            mid = c0 + ((c1 - c0) / 2 + TILE - 1) / TILE * TILE;
+            trans_rec(t, r0, r1, c0, mid);
+            c0 = mid;
+        }
+    }
+    trans_leaf(t, r0, r1, c0, c1);
+}
+
+/* Fill in a job; leaf 0 and nt_bytes 0 mean the tuned values */
+static void trans_init(trans_job *t, void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                       size_t rows, size_t cols, size_t es, size_t leaf, size_t nt_bytes)
+{
+    uint64_t params = __atomic_load_n(&trans_params, __ATOMIC_RELAXED);
+    size_t align;
+
+    t->src = src;
+    t->dst = dst;
+    t->ls = ld_src * es;
+    t->ld = ld_dst * es;
+    t->es = es;
+    t->leaf = leaf ? leaf : (uint32_t)params;
+    if (t->leaf < 2 * TILE)
+        t->leaf = 2 * TILE; /* halving must leave at least one tile each side */
+    t->tile = pick_tile(es, &align);
+    if (nt_bytes == 0)
+        nt_bytes = params >> 32 == UINT32_MAX ? SIZE_MAX : params >> 32;
+    t->nt = align && rows * cols * es >= nt_bytes &&
+            (uintptr_t)dst % align == 0 && t->ld % align == 0;
+}
+
+static void trans_run(const trans_job *t, size_t rows, size_t cols)
+{
+    if (rows == 0 || cols == 0)
+        return;
+    trans_rec(t, 0, rows, 0, cols);
+#ifdef TRANS_X86
+    if (t->nt)
+        _mm_sfence(); /* streaming stores are weakly ordered */
+#endif
+}
+
+void transpose_strided(void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                       size_t rows, size_t cols, size_t elem_size)
+{
+    trans_job t;
+
+    trans_init(&t, dst, ld_dst, src, ld_src, rows, cols, elem_size, 0, 0);
+    trans_run(&t, rows, cols);
+}
+
+void transpose(void *dst, const void *src, size_t rows, size_t cols, size_t elem_size)
+{
+    transpose_strided(dst, rows, src, cols, rows, cols, elem_size);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Best of TUNE_REPS runs, after one to fault the pages in */
+static double trans_time(char *dst, const char *src, size_t rows, size_t leaf, size_t nt_bytes)
+{
+    trans_job t;
+    double best = 1e30, start;
+    int k;
+
+    trans_init(&t, dst, rows, src, TUNE_COLS, rows, TUNE_COLS, 4, leaf, nt_bytes);
+    trans_run(&t, rows, TUNE_COLS);
+    for (k = 0; k < TUNE_REPS; k++) {
+        start = now_sec();
+        trans_run(&t, rows, TUNE_COLS);
+        if (now_sec() - start < best)
+            best = now_sec() - start;
+    }
+    return best;
+}
+
+/*
+ * transpose_tune - Time 4-byte transposes on this machine to pick the leaf
+ *     size, then the smallest matrix at which streaming stores win. It
+ *     takes two 16 MB buffers and a few hundred milliseconds, so nothing
+ *     calls it implicitly: until a program does, the defaults are used.
+ *     Safe to call while other threads transpose.
+ */
+void transpose_tune(void)
+{
+    static const size_t leaves[] = { 16, 32, 64, 128, 256 };
+    static const size_t rows[] = { 128, 512, 2048 };  /* 1, 4 and 16 MB */
+    size_t max = rows[2] * TUNE_COLS * 4, best_leaf = 0, nt_bytes = SIZE_MAX, i;
+    double best = 1e30, t;
+    char *src, *dst;
+
+    if (posix_memalign((void **)&src, 64, max) != 0)
+        return;
+    if (posix_memalign((void **)&dst, 64, max) != 0) {
+        free(src);
+        return;
+    }
+    memset(src, 1, max);
+
+    for (i = 0; i < sizeof(leaves) / sizeof(leaves[0]); i++) {
+        t = trans_time(dst, src, rows[2], leaves[i], SIZE_MAX);
+        if (t < best) {
+            best = t;
+            best_leaf = leaves[i];
+        }
+    }
+
+    for (i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        if (trans_time(dst, src, rows[i], best_leaf, 1) <
+            trans_time(dst, src, rows[i], best_leaf, SIZE_MAX)) {
+            nt_bytes = rows[i] * TUNE_COLS * 4;
+            break;
+        }
+    }
+    free(src);
+    free(dst);
+    if (nt_bytes > UINT32_MAX)
+        nt_bytes = UINT32_MAX;
+    __atomic_store_n(&trans_params, TRANS_PARAMS(best_leaf, nt_bytes), __ATOMIC_RELAXED);
+}
+
+/*
+ * Parallel transpose: dst is cut into square tasks of at most TASK_BYTES,
+ * numbered along dst rows so that a run of tasks covers a run of dst
+ * pages. Each worker owns a contiguous range of tasks and takes from it
+ * with fetch-and-add; once its range is empty it steals from the others the
+ * same way, nearest NUMA node first. On a NUMA machine the tasks are first
+ * grouped by the node holding their dst page and each worker is pinned to
+ * the CPUs of the node whose tasks it owns, so stores stay local.
+ */
+typedef struct {
+    size_t next, end;   /* owner and thieves both advance next */
+} __attribute__((aligned(64))) task_range;
+
+typedef struct {
+    trans_job job;
+    size_t rows, cols, side, row_tasks;
+    const size_t *order;    /* task numbers grouped by node, or NULL */
+    task_range *ranges;
+    int workers, nodes;
+} par_job;
+
+typedef struct {
+    par_job *pj;
+    int id;
+    int node;               /* -1 when not pinned */
+    cpu_set_t cpus;
+} par_worker;
+
+static void run_task(const par_job *pj, size_t k)
+{
+    size_t p, q;
+
+    if (pj->order != NULL)
+        k = pj->order[k];
+    p = k / pj->row_tasks;  /* dst row block, i.e. src column block */
+    q = k % pj->row_tasks;
+    trans_rec(&pj->job, q * pj->side, q * pj->side + pj->side < pj->rows ?
+              q * pj->side + pj->side : pj->rows, p * pj->side,
+              p * pj->side + pj->side < pj->cols ? p * pj->side + pj->side : pj->cols);
+}
+
+static void drain(const par_job *pj, task_range *r)
+{
+    size_t k;
+
+    while ((k = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED)) < r->end)
+        run_task(pj, k);
+}
+
+static void *par_thread(void *arg)
+{
+    par_worker *w = arg;
+    par_job *pj = w->pj;
+    int i, pass;
+
+    if (w->node >= 0)
+        sched_setaffinity(0, sizeof(w->cpus), &w->cpus);
+    drain(pj, &pj->ranges[w->id]);
+    /* Workers on the same node are ids congruent mod nodes */
+    for (pass = 0; pass < 2; pass++)
+        for (i = 1; i < pj->workers; i++) {
+            int v = (w->id + i) % pj->workers;
+            if ((v % pj->nodes == w->id % pj->nodes) == (pass == 0))
+                drain(pj, &pj->ranges[v]);
+        }
+#ifdef TRANS_X86
+    if (pj->job.nt)
+        _mm_sfence();
+#endif
+    return NULL;
+}
+
+/* Node holding the page at p, or -1 if the kernel won't say */
+static int page_node(const void *p)
+{
+#ifdef SYS_move_pages
+    void *page = (void *)((uintptr_t)p & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+
+    if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0 && status >= 0)
+        return status;
+#endif
+    (void)p;
+    return -1;
+}
+
+/* CPUs of a node from sysfs; returns 0 if the node doesn't exist */
+static int node_cpus(int node, cpu_set_t *set)
+{
+    char path[64], buf[1024], *p;
+    FILE *f;
+    long lo, hi;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if ((f = fopen(path, "r")) == NULL)
+        return 0;
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    CPU_ZERO(set);
+    while (p != NULL && *p >= '0' && *p <= '9') {
+        lo = hi = strtol(p, &p, 10);
+        if (*p == '-')
+            hi = strtol(p + 1, &p, 10);
+        for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+            CPU_SET(lo, set);
+        p = *p == ',' ? p + 1 : NULL;
+    }
+    return 1;
+}
+
+/*
+ * Group the tasks by the node of their first dst page (node 0 if unknown)
+ * and give each node's share to the workers on it; returns the order, or
+ * NULL to fall back to
+ * an even split when there is one node or too few workers to cover them.
+ */
+static size_t *numa_split(par_job *pj, size_t tasks, par_worker *w)
+{
+    size_t count[MAX_NODES] = { 0 }, start[MAX_NODES], *order, k, at;
+    unsigned char *node;
+    int nodes = 0, n, i, share;
+
+    while (nodes < MAX_NODES && node_cpus(nodes, &w[0].cpus))
+        nodes++;
+    if (nodes < 2 || pj->workers < nodes)
+        return NULL;
+    order = malloc(tasks * sizeof(size_t));
+    node = malloc(tasks);
+    if (order == NULL || node == NULL) {
+        free(order);
+        free(node);
+        return NULL;
+    }
+
+    for (k = 0; k < tasks; k++) {
+        size_t p = k / pj->row_tasks, q = k % pj->row_tasks;
+        n = page_node(pj->job.dst + p * pj->side * pj->job.ld + q * pj->side * pj->job.es);
+        node[k] = n >= 0 && n < nodes ? n : 0;
+        count[node[k]]++;
+    }
+    for (n = 0, at = 0; n < nodes; n++) {
+        start[n] = at;
+        at += count[n];
+    }
+    for (k = 0; k < tasks; k++)
+        order[start[node[k]]++] = k;
+    free(node);
+
+    /* Worker i is on node i % nodes */
+    for (n = 0, at = 0; n < nodes; n++) {
+        share = (pj->workers - n + nodes - 1) / nodes;
+        for (i = 0; i < share; i++) {
+            task_range *r = &pj->ranges[n + i * nodes];
+            r->next = at + count[n] * i / share;
+            r->end = at + count[n] * (i + 1) / share;
+        }
+        at += count[n];
+    }
+    for (i = 0; i < pj->workers; i++) {
+        w[i].node = i % nodes;
+        node_cpus(w[i].node, &w[i].cpus);
+    }
+    pj->nodes = nodes;
+    return order;
+}
+
+/*
+ * transpose_parallel - transpose_strided() on threads workers, or one per
+ *     online CPU if threads is 0.
+ */
+void transpose_parallel(void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                        size_t rows, size_t cols, size_t elem_size, int threads)
+{
+    par_job pj;
+    par_worker *w;
+    pthread_t *tids;
+    cpu_set_t caller;
+    size_t tasks, side;
+    int i;
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 1 || rows * cols * elem_size < PAR_MIN_BYTES) {
+        transpose_strided(dst, ld_dst, src, ld_src, rows, cols, elem_size);
+        return;
+    }
+
+    trans_init(&pj.job, dst, ld_dst, src, ld_src, rows, cols, elem_size, 0, 0);
+    for (side = TILE; 8 * side * side * elem_size <= TASK_BYTES; side *= 2)
+        ;
+    pj.side = side;
+    pj.rows = rows;
+    pj.cols = cols;
+    pj.row_tasks = (rows + pj.side - 1) / pj.side;
+    tasks = pj.row_tasks * ((cols + pj.side - 1) / pj.side);
+    if ((size_t)threads > tasks)
+        threads = (int)tasks;
+    pj.workers = threads;
+    pj.nodes = 1;
+    pj.ranges = NULL;
+    w = malloc(threads * sizeof(par_worker));
+    tids = malloc(threads * sizeof(pthread_t));
+    if (w == NULL || tids == NULL || posix_memalign((void **)&pj.ranges, 64,
+                                                    threads * sizeof(task_range)) != 0) {
+        free(w);
+        free(tids);
+        transpose_strided(dst, ld_dst, src, ld_src, rows, cols, elem_size);
+        return;
+    }
+
+    pj.order = numa_split(&pj, tasks, w);
+    for (i = 0; i < threads; i++) {
+        w[i].pj = &pj;
+        w[i].id = i;
+        if (pj.order == NULL) {
+            w[i].node = -1;
+            pj.ranges[i].next = tasks * i / threads;
+            pj.ranges[i].end = tasks * (i + 1) / threads;
+        }
+    }
+    /* The caller is worker 0, and runs anything it fails to start */
+    for (i = 1; i < threads; i++)
+        if (pthread_create(&tids[i], NULL, par_thread, &w[i]) != 0)
+            break;
+    if (w[0].node >= 0 && sched_getaffinity(0, sizeof(caller), &caller) != 0)
+        w[0].node = -1;
+    par_thread(&w[0]);
+    if (w[0].node >= 0)
+        sched_setaffinity(0, sizeof(caller), &caller);
+    while (--i > 0)
+        pthread_join(tids[i], NULL);
+
+    free((void *)pj.order);
+    free(pj.ranges);
+    free(tids);
+    free(w);
+}
+
+/*
+ * The general transpose at fixed leaf sizes, so the driver's miss counts
+ * can rank them for the lab's cache the way transpose_tune() ranks them by
+ * time for the real one.
+ */
+#define TRANS_GENERIC(leaf)                                                   \
+char trans_generic_##leaf##_desc[] = "Recursive tiled transpose, leaf " #leaf; \
+void trans_generic_##leaf(int M, int N, int A[N][M], int B[M][N])             \
+{                                                                             \
+    trans_job t;                                                              \
+    trans_init(&t, B, N, A, M, N, M, sizeof(int), leaf, SIZE_MAX);            \
+    trans_run(&t, N, M);                                                      \
+}
+
+TRANS_GENERIC(16)
+TRANS_GENERIC(32)
+TRANS_GENERIC(64)
 
 /*
  * registerFunctions - This function registers your transpose
@@ -223,6 +851,9 @@ void registerFunctions()
 
     /* Register any additional transpose functions */
     // registerTransFunction(trans_64_64, trans_64_64_desc);
+    registerTransFunction(trans_generic_16, trans_generic_16_desc);
+    registerTransFunction(trans_generic_32, trans_generic_32_desc);
+    registerTransFunction(trans_generic_64, trans_generic_64_desc);
 
 }
 
@@ -0,0 +1,137 @@
+/*
+ * transbench.c - Bandwidth of the general transpose in trans.c
+ *
+ * Transposes square int matrices of each size from -m to -M (doubling)
+ * on 1, 2, 4, ... and -t threads, and prints GB/s counting one read and
+ * one write of the matrix. Each size is checked once with is_transpose()
+ * before it is timed; a failure stops the run. Timings are the best of -r
+ * runs after one untimed run that faults the pages in. transpose_tune()
+ * runs first unless -n asks for the built-in defaults.
+ *
+ * Build in the unpacked cachelab-handout directory:
+ *
+ *   gcc -O2 -std=c99 -pthread -o transbench transbench.c trans.c cachelab.c
+ *
+ * Usage: transbench [-n] [-m <min side>] [-M <max side>] [-t <threads>] [-r <reps>]
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* From trans.c */
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+void transpose_tune(void);
+void transpose_parallel(void *dst, size_t ld_dst, const void *src, size_t ld_src,
+                        size_t rows, size_t cols, size_t elem_size, int threads);
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(int *dst, const int *src, size_t n, int threads, int reps)
+{
+    double best = 1e30, start, t;
+    int k;
+
+    transpose_parallel(dst, n, src, n, n, n, sizeof(int), threads);
+    for (k = 0; k < reps; k++) {
+        start = now_sec();
+        transpose_parallel(dst, n, src, n, n, n, sizeof(int), threads);
+        t = now_sec() - start;
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* Powers of two, then the maximum itself */
+static int next_threads(int t, int max)
+{
+    return t == max ? max + 1 : t * 2 < max ? t * 2 : max;
+}
+
+static void usage(void)
+{
+    printf("Usage: transbench [-n] [-m <min side>] [-M <max side>] [-t <threads>] [-r <reps>]\n");
+    printf("-n         Skip transpose_tune() and use its defaults.\n");
+    printf("-m <num>   Smallest matrix side (default 256).\n");
+    printf("-M <num>   Largest matrix side (default 8192).\n");
+    printf("-t <num>   Most threads (default: online CPUs).\n");
+    printf("-r <num>   Timed runs per point (default 5).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t lo = 256, hi = 8192, n, i;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), reps = 5, tune = 1, opt, t;
+    int *src, *dst;
+
+    while ((opt = getopt(argc, argv, "hnm:M:t:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            tune = 0;
+            break;
+        case 'm':
+            lo = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            hi = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (lo == 0 || hi < lo || threads < 1 || reps < 1) {
+        usage();
+        exit(1);
+    }
+
+    src = malloc(hi * hi * sizeof(int));
+    dst = malloc(hi * hi * sizeof(int));
+    if (src == NULL || dst == NULL) {
+        printf("Error: Cannot allocate two %zux%zu matrices\n", hi, hi);
+        exit(1);
+    }
+    for (i = 0; i < hi * hi; i++)
+        src[i] = (int)i;
+    if (tune)
+        transpose_tune();
+
+    printf("%8s %10s", "side", "MB");
+    for (t = 1; t <= threads; t = next_threads(t, threads))
+        printf("  %5d thr", t);
+    printf("  (GB/s)\n");
+    for (n = lo; n <= hi; n *= 2) {
+        memset(dst, 0, n * n * sizeof(int));
+        transpose_parallel(dst, n, src, n, n, n, sizeof(int), threads);
+        if (!is_transpose((int)n, (int)n, (void *)src, (void *)dst)) {
+            printf("Error: %zux%zu transpose is wrong\n", n, n);
+            exit(1);
+        }
+        printf("%8zu %10.1f", n, n * n * sizeof(int) / 1048576.0);
+        for (t = 1; t <= threads; t = next_threads(t, threads))
+            printf("  %9.2f", 2.0 * n * n * sizeof(int) / run(dst, src, n, t, reps) / 1e9);
+        printf("\n");
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
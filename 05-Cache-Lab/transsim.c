@@ -0,0 +1,187 @@
+/*
+ * transsim.c - Count the cache misses of every registered transpose
+ *     function without valgrind
+ *
+ * trans.c is compiled with -fsanitize=thread, which makes the compiler call
+ * __tsan_readN/__tsan_writeN before every load and store. This file links
+ * in its own versions of those hooks instead of the sanitizer runtime, and
+ * while a kernel runs they pass each access to csim's simulator, split into
+ * one access per cache block it covers.
+ * As with the handout's driver, accesses to the stack are left out, so
+ * locals do not count but A, B and any other memory do.
+ *
+ * For each -M/-N shape (by default the lab's three) and each function
+ * registerFunctions() lists, the kernel runs once with tracing on, is
+ * checked with is_transpose(), and a line with its hits, misses,
+ * evictions and wall-clock time is printed. A and B sit back to back like
+ * tracegen's static arrays, with A at -a bytes past a 1KB boundary.
+ *
+ * Build in the unpacked cachelab-handout directory, instrumenting only
+ * trans.c so the simulator itself is not traced:
+ *
+ *   gcc -O0 -std=c99 -fsanitize=thread -c trans.c -o trans_sim.o
+ *   gcc -O2 -std=c99 -pthread -o transsim transsim.c trans_sim.o cachelab.c
+ *
+ * Usage: transsim [-v] [-M <cols> -N <rows>] [-s <num>] [-E <num>] [-b <num>] [-a <offset>]
+ */
+#define CSIM_NO_MAIN
+#include "csim.c"
+#include <stdint.h>
+#include <time.h>
+
+#define MAXN 256
+#define STACK_SPAN (64UL << 20) /* below main's frame that counts as stack */
+
+/* From cachelab.c and trans.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+extern void registerFunctions();
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+static char matrices[2 * MAXN * MAXN * sizeof(int) + 1024] __attribute__((aligned(1024)));
+static volatile int tracing;
+static uintptr_t stack_top;
+
+// One simulated access per block touched, so a vector load or store that
+// straddles a block boundary brings in both lines
+static void record(int op, void *addr, unsigned long size) {
+    uintptr_t a = (uintptr_t)addr, end = a + (size ? size : 1), next;
+
+    if (!tracing || (a < stack_top && a > stack_top - STACK_SPAN)) return;
+    for (; a < end; a = next) {
+        next = ((a >> sim_cache.b) + 1) << sim_cache.b;
+        handle_access(op, a, (next < end ? next : end) - a);
+    }
+}
+
+// The hooks -fsanitize=thread code calls; sizes past 16 come through *_range
+void __tsan_init(void) {}
+void __tsan_func_entry(void *pc) { (void)pc; }
+void __tsan_func_exit(void) {}
+void __tsan_read_range(void *addr, unsigned long size) { record(OP_LOAD, addr, size); }
+void __tsan_write_range(void *addr, unsigned long size) { record(OP_STORE, addr, size); }
+
+#define TSAN_HOOKS(n)                                                          \
+    void __tsan_read##n(void *addr) { record(OP_LOAD, addr, n); }             \
+    void __tsan_write##n(void *addr) { record(OP_STORE, addr, n); }           \
+    void __tsan_unaligned_read##n(void *addr) { record(OP_LOAD, addr, n); }   \
+    void __tsan_unaligned_write##n(void *addr) { record(OP_STORE, addr, n); }
+TSAN_HOOKS(1)
+TSAN_HOOKS(2)
+TSAN_HOOKS(4)
+TSAN_HOOKS(8)
+TSAN_HOOKS(16)
+
+// transpose_parallel's work counters and the tuned parameters; the memory
+// order argument is ignored, and like the stack these don't count
+unsigned long long __tsan_atomic64_fetch_add(volatile unsigned long long *a,
+                                             unsigned long long v, int mo) {
+    (void)mo;
+    return __atomic_fetch_add(a, v, __ATOMIC_SEQ_CST);
+}
+
+unsigned long long __tsan_atomic64_load(const volatile unsigned long long *a, int mo) {
+    (void)mo;
+    return __atomic_load_n(a, __ATOMIC_SEQ_CST);
+}
+
+void __tsan_atomic64_store(volatile unsigned long long *a, unsigned long long v, int mo) {
+    (void)mo;
+    __atomic_store_n(a, v, __ATOMIC_SEQ_CST);
+}
+
+static double now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static void run_shape(int M, int N, int s, int E, int b, int *A, int *B) {
+    printf("M=%d N=%d (s=%d, E=%d, b=%d)\n", M, N, s, E, b);
+    for (int i = 0; i < func_counter; i++) {
+        initMatrix(M, N, (void *)A, (void *)B);
+        hit_count = miss_count = eviction_count = 0;
+        sim_cache = init_cache(s, E, b);
+
+        double start = now_ms();
+        tracing = 1;
+        func_list[i].func_ptr(M, N, (void *)A, (void *)B);
+        tracing = 0;
+        double ms = now_ms() - start;
+
+        func_list[i].correct = is_transpose(M, N, (void *)A, (void *)B);
+        func_list[i].num_hits = hit_count;
+        func_list[i].num_misses = miss_count;
+        func_list[i].num_evictions = eviction_count;
+        free_cache(sim_cache);
+        printf("func %d (%s): hits:%d, misses:%d, evictions:%d, %.3f ms%s\n", i,
+               func_list[i].description, hit_count, miss_count, eviction_count, ms,
+               func_list[i].correct ? "" : " INCORRECT");
+    }
+}
+
+static void transsim_usage() {
+    printf("Usage: ./transsim [-v] [-M <cols> -N <rows>] [-s <num>] [-E <num>] [-b <num>] "
+           "[-a <offset>]\n");
+    printf("-v         Print every access with its outcome.\n");
+    printf("-M <cols>  Columns of A, up to %d; with -N, replaces the lab's three shapes.\n", MAXN);
+    printf("-N <rows>  Rows of A, up to %d.\n", MAXN);
+    printf("-s, -E, -b Cache geometry, by default the lab's 5, 1, 5.\n");
+    printf("-a <off>   Place A this many bytes past a 1KB boundary, a multiple of 4 (default 0).\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const int shapes[][2] = { { 32, 32 }, { 64, 64 }, { 60, 68 } };
+    int M = 0, N = 0, s = 5, E = 1, b = 5, offset = 0, opt;
+
+    stack_top = (uintptr_t)&opt;
+    while ((opt = getopt(argc, argv, "hvM:N:s:E:b:a:")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'a':
+            offset = atoi(optarg);
+            break;
+        case 'h':
+            transsim_usage();
+            exit(0);
+        default:
+            transsim_usage();
+            exit(1);
+        }
+    }
+    if ((M != 0) != (N != 0) || M < 0 || M > MAXN || N < 0 || N > MAXN || s < 0 || E < 1 ||
+        b < 0 || s + b >= 64 || offset < 0 || offset >= 1024 || offset % 4 != 0) {
+        transsim_usage();
+        exit(1);
+    }
+
+    int *A = (int *)(matrices + offset), *B = A + MAXN * MAXN;
+    registerFunctions();
+    if (M != 0) {
+        run_shape(M, N, s, E, b, A, B);
+        return 0;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (i > 0) printf("\n");
+        run_shape(shapes[i][0], shapes[i][1], s, E, b, A, B);
+    }
+    return 0;
+}
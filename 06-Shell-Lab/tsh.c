@@ -17,6 +17,9 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/signalfd.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include <math.h>
@@ -36,8 +39,9 @@
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXJID    1<<16   /* max job ID */
+#define MAXSTAGES    16   /* max commands in a pipeline */
+#define INITJOBS     16   /* job list slots to start with, doubled as needed */
+#define MAXJID  (1<<16)   /* max job ID */
 
 /* Job states */
 #define UNDEF         0   /* undefined */
@@ -64,20 +68,39 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
+int pipelines = 0;          /* if true, '|' separates pipeline stages */
 int nextjid = 1;            /* next job ID to allocate */
+int sigfd;                  /* signalfd for SIGCHLD, SIGINT and SIGTSTP */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
 struct job_t {              /* The job struct */
     pid_t pid;              /* job PID */
-    int jid;                /* job ID [1, 2, ...] */
+    pid_t pgid;             /* process group, the PID of the first stage */
+    int jid;                /* job ID [1, 2, ...], shared by a pipeline's stages */
     int state;              /* UNDEF, BG, FG, or ST */
+    int next;               /* slot + 1 of the job's next process, 0 if none */
     char cmdline[MAXLINE];  /* command line */
 };
-struct job_t job_list[MAXJOBS]; /* The job list */
+
+struct job_table {          /* The job list, indexed by PID and job ID */
+    struct job_t *slots;    /* processes, listed in slot order */
+    int nslots;             /* allocated slots, doubled when all are used */
+    int nprocs;             /* slots in use */
+    int lowfree;            /* no slot below this one is free */
+    int *pid_index;         /* slot + 1 by PID hash, 0 if empty; linear probing */
+    int pid_index_size;     /* buckets in pid_index, twice nslots */
+    int *jid_head;          /* slot + 1 of a process of each job ID, 0 if none */
+    int maxjid;             /* largest job ID in use */
+    int fgjid;              /* job last put in FG; fgpid() checks it still is */
+};
+struct job_table job_table;
+struct job_table *job_list = &job_table; /* The job list */
 
 struct cmdline_tokens {
-    int argc;               /* Number of arguments */
+    int argc;               /* Number of arguments, with a NULL after each stage */
     char *argv[MAXARGS];    /* The arguments list */
+    int nstages;            /* Number of commands in the pipeline */
+    char **stages[MAXSTAGES]; /* argv of each command, pointing into argv */
     char *infile;           /* The input file */
     char *outfile;          /* The output file */
     enum builtins_t {       /* Indicates if argv[0] is a builtin command */
@@ -98,21 +121,25 @@ void eval(char *cmdline);
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
+void handle_signals(int block);
+void waitfg(void);
+char *readcmd(char *cmdline, int size);
 
 /* Here are helper routines that we've provided for you */
 int parseline(const char *cmdline, struct cmdline_tokens *tok); 
 void sigquit_handler(int sig);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *job_list);
-int maxjid(struct job_t *job_list); 
-int addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *job_list, pid_t pid); 
-pid_t fgpid(struct job_t *job_list);
-struct job_t *getjobpid(struct job_t *job_list, pid_t pid);
-struct job_t *getjobjid(struct job_t *job_list, int jid); 
+void initjobs(struct job_table *job_list);
+int maxjid(struct job_table *job_list); 
+int addjob(struct job_table *job_list, pid_t pid, pid_t pgid, int state, char *cmdline);
+int deletejob(struct job_table *job_list, pid_t pid); 
+pid_t fgpid(struct job_table *job_list);
+struct job_t *getjobpid(struct job_table *job_list, pid_t pid);
+struct job_t *getjobjid(struct job_table *job_list, int jid); 
+void setjobstate(struct job_table *job_list, int jid, int state);
 int pid2jid(pid_t pid); 
-void listjobs(struct job_t *job_list, int output_fd);
+void listjobs(struct job_table *job_list, int output_fd);
 
 void usage(void);
 void unix_error(char *msg);
@@ -127,6 +154,7 @@ handler_t *Signal(int signum, handler_t *handler);
 
 /* My function prototype */
 int buildin_cmd(struct cmdline_tokens *tok, char *cmdline);
+pid_t launch(struct cmdline_tokens *tok, int state, char *cmdline);
 
 /* Process control wrappers */
 pid_t Fork(void);
@@ -162,15 +190,16 @@ int
 main(int argc, char **argv) 
 {
     char c;
-    char cmdline[MAXLINE];    /* cmdline for fgets */
+    char cmdline[MAXLINE];    /* cmdline for readcmd */
     int emit_prompt = 1; /* emit prompt (default) */
+    sigset_t mask;
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     Dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpP")) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -181,17 +210,28 @@ main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
             break;
+        case 'P':             /* parse '|' as a pipe; off by default since */
+            pipelines = 1;    /* the traces pass a bare '|' to /bin/echo */
+            break;
         default:
             usage();
         }
     }
 
-    /* Install the signal handlers */
+    /* 
+     * ctrl-c, ctrl-z and terminated or stopped children are never
+     * delivered asynchronously: they stay blocked, and readcmd() and
+     * waitfg() read them from sigfd and call their handlers in the loop.
+     */
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGTSTP);
+    Sigaddset(&mask, SIGCHLD);
+    Sigprocmask(SIG_BLOCK, &mask, NULL);
+    if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        unix_error("signalfd error");
 
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+    /* Install the signal handlers */
     Signal(SIGTTIN, SIG_IGN);
     Signal(SIGTTOU, SIG_IGN);
 
@@ -208,9 +248,7 @@ main(int argc, char **argv)
             printf("%s", prompt);
             fflush(stdout);
         }
-        if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-            app_error("fgets error");
-        if (feof(stdin)) { 
+        if (readcmd(cmdline, MAXLINE) == NULL) { 
             /* End of file (ctrl-d) */
             printf ("\n");
             fflush(stdout);
@@ -235,12 +273,12 @@ main(int argc, char **argv)
  * eval - Evaluate the command line that the user has just typed in
  * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.  
+ * then execute it immediately. Otherwise, spawn one child process per
+ * stage of the pipeline and add each to the job list under one job ID.
+ * If the job is running in the foreground, wait for it to terminate and
+ * then return.  Note: each job must have a unique process group ID so
+ * that our background children don't receive SIGINT (SIGTSTP) from the
+ * kernel when we type ctrl-c (ctrl-z) at the keyboard.
  */
 void 
 eval(char *cmdline) 
@@ -258,6 +296,18 @@ eval(char *cmdline)
     if (tok.argv[0] == NULL) /* ignore empty lines */
         return;
 
+    if (tok.builtins == BUILTIN_NONE) {
+        pid_t pid = launch(&tok, bg ? BG : FG, cmdline);
+
+        /* Parent waits for foreground job to terminate */
+        if (pid && !bg)
+            waitfg();
+        else if (pid)
+            printf("[%d] (%d) %s\n", pid2jid(pid), pid, cmdline);
+        return;
+    }
+
+    /* Builtins run in the shell, so redirect the shell's own stdio */
     if (tok.infile) {
         saved_stdin = Dup(STDIN_FILENO);
         infile_fd = Open(tok.infile, O_RDONLY, DEF_MODE);
@@ -271,38 +321,8 @@ eval(char *cmdline)
         Close(outfile_fd);
     }
 
-    if (!buildin_cmd(&tok, cmdline)){ /* Not a builtin command */
-        pid_t pid;
-        sigset_t mask, prev;
-
-        Sigemptyset(&mask);
-        Sigaddset(&mask, SIGCHLD);
-        Sigaddset(&mask, SIGINT);
-        Sigaddset(&mask, SIGTSTP);
-        /* Block SIGCHLD */
-        Sigprocmask(SIG_BLOCK, &mask, &prev);
-
-        if ((pid = Fork()) == 0) {
-            Sigprocmask(SIG_SETMASK, &prev, NULL);
-            Signal(SIGINT, SIG_DFL);
-            Signal(SIGTSTP, SIG_DFL);
-            Setpgid(0, 0); /* Set a new process group */
-            Execve(tok.argv[0], tok.argv, environ);
-        }
+    buildin_cmd(&tok, cmdline);
 
-        addjob(job_list, pid, bg ? BG : FG, cmdline);
-        Sigprocmask(SIG_SETMASK, &prev, NULL);
-
-        /* Parent waits for foreground job to terminate */
-        if (!bg) {
-            while(pid == fgpid(job_list))
-                Sigsuspend(&prev);
-        }
-        else {
-            printf("[%d] (%d) %s\n", pid2jid(pid), pid, cmdline);
-        }
-    }
-    
     if (tok.infile) {
         Dup2(saved_stdin, STDIN_FILENO);
         Close(saved_stdin);
@@ -315,18 +335,105 @@ eval(char *cmdline)
     return;
 }
 
+/*
+ * launch - Start every stage of tok's pipeline in one new process group,
+ *     stage i's stdout feeding stage i+1's stdin, with the input file on
+ *     the first stage and the output file on the last. Each stage is
+ *     added to the job list in the given state. Children are started with
+ *     posix_spawn(), which glibc implements with a vfork-style clone, so
+ *     the shell's page tables are never copied. Returns the process
+ *     group, or 0 if no stage could be started.
+ */
+pid_t
+launch(struct cmdline_tokens *tok, int state, char *cmdline)
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t mask, defaults;
+    pid_t pid, pgid = 0;
+    int i, rc, pipefd[2], prev_read = -1;
+
+    /* The child gets the mask from before main blocked what sigfd reads */
+    Sigprocmask(SIG_BLOCK, NULL, &mask);
+    Sigdelset(&mask, SIGCHLD);
+    Sigdelset(&mask, SIGINT);
+    Sigdelset(&mask, SIGTSTP);
+    Sigemptyset(&defaults);
+    Sigaddset(&defaults, SIGINT);
+    Sigaddset(&defaults, SIGTSTP);
+
+    for (i = 0; i < tok->nstages; i++) {
+        pipefd[0] = pipefd[1] = -1;
+        if (i < tok->nstages - 1 && pipe(pipefd) < 0) {
+            printf("pipe error: %s\n", strerror(errno));
+            break;
+        }
+
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                 POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+
+        posix_spawn_file_actions_init(&actions);
+        if (i == 0 && tok->infile)
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                             tok->infile, O_RDONLY, 0);
+        if (prev_read >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, prev_read, STDIN_FILENO);
+            posix_spawn_file_actions_addclose(&actions, prev_read);
+        }
+        if (pipefd[1] >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+            posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+        }
+        if (i == tok->nstages - 1 && tok->outfile)
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, tok->outfile,
+                                             O_WRONLY | O_CREAT | O_TRUNC, DEF_MODE);
+
+        rc = posix_spawn(&pid, tok->stages[i][0], &actions, &attr,
+                         tok->stages[i], environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+
+        /* Only the next stage needs the read end */
+        if (prev_read >= 0)
+            Close(prev_read);
+        if (pipefd[1] >= 0)
+            Close(pipefd[1]);
+        prev_read = pipefd[0];
+
+        if (rc != 0) {
+            printf("%s: %s\n", tok->stages[i][0], strerror(rc));
+            continue;
+        }
+        if (pgid == 0)
+            pgid = pid;
+        addjob(job_list, pid, pgid, state, cmdline);
+    }
+    if (prev_read >= 0)
+        Close(prev_read);
+    return pgid;
+}
+
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
  * Parameters:
  *   cmdline:  The command line, in the form:
  *
- *                command [arguments...] [< infile] [> oufile] [&]
+ *                command [arguments...] [| command [arguments...]]...
+ *                        [< infile] [> oufile] [&]
  *
  *   tok:      Pointer to a cmdline_tokens structure. The elements of this
  *             structure will be populated with the parsed tokens. Characters 
  *             enclosed in single or double quotes are treated as a single
- *             argument. 
+ *             argument. Commands of a pipeline end with a NULL in
+ *             argv, and stages[i] points at the start of command i; the
+ *             input file may only be given to the first command and the
+ *             output file to the last.
  * Returns:
  *   1:        if the user has requested a BG job
  *   0:        if the user has requested a FG job  
@@ -342,10 +449,12 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
 
     static char array[MAXLINE];          /* holds local copy of command line */
     const char delims[10] = " \t\r\n";   /* argument delimiters (white-space) */
+    const char *ends = pipelines ? " \t\r\n|" : delims; /* ends an unquoted argument */
     char *buf = array;                   /* ptr that traverses command line */
     char *next;                          /* ptr to the end of the current arg */
     char *endbuf;                        /* ptr to end of cmdline string */
     int is_bg;                           /* background job? */
+    int pipe_next;                       /* token ended at a '|' */
 
     int parsing_state;                   /* indicates if the next token is the
                                             input or output file */
@@ -364,6 +473,8 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
     /* Build the argv list */
     parsing_state = ST_NORMAL;
     tok->argc = 0;
+    tok->nstages = 1;
+    tok->stages[0] = tok->argv;
 
     while (buf < endbuf) {
         /* Skip the white-spaces */
@@ -389,6 +500,7 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
             buf ++;
             continue;
         }
+        pipe_next = (pipelines && *buf == '|');
 
         if (*buf == '\'' || *buf == '\"') {
             /* Detect quoted tokens */
@@ -396,7 +508,8 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
             next = strchr (buf, *(buf-1));
         } else {
             /* Find next delimiter */
-            next = buf + strcspn (buf, delims);
+            next = buf + strcspn (buf, ends);
+            pipe_next = (pipelines && *next == '|');
         }
         
         if (next == NULL) {
@@ -410,11 +523,21 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
         *next = '\0';
 
         /* Record the token as either the next argument or the i/o file */
-        switch (parsing_state) {
+        if (next == buf && pipe_next) {
+            if (parsing_state != ST_NORMAL) {
+                (void) fprintf(stderr,
+                               "Error: must provide file name for redirection\n");
+                return -1;
+            }
+        } else switch (parsing_state) {
         case ST_NORMAL:
             tok->argv[tok->argc++] = buf;
             break;
         case ST_INFILE:
+            if (tok->nstages > 1) {      /* only the first command reads it */
+                (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                return -1;
+            }
             tok->infile = buf;
             break;
         case ST_OUTFILE:
@@ -426,6 +549,24 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
         }
         parsing_state = ST_NORMAL;
 
+        /* End the stage at a '|'; only the last command may write a file */
+        if (pipe_next) {
+            if (tok->argv + tok->argc == tok->stages[tok->nstages - 1]) {
+                (void) fprintf(stderr, "Error: missing command in pipeline\n");
+                return -1;
+            }
+            if (tok->outfile) {
+                (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                return -1;
+            }
+            if (tok->nstages == MAXSTAGES) {
+                (void) fprintf(stderr, "Error: too many commands in pipeline\n");
+                return -1;
+            }
+            tok->argv[tok->argc++] = NULL;
+            tok->stages[tok->nstages++] = tok->argv + tok->argc;
+        }
+
         /* Check if argv is full */
         if (tok->argc >= MAXARGS-1) break;
 
@@ -461,8 +602,20 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
     }
 
     /* Should the job run in the background? */
-    if ((is_bg = (*tok->argv[tok->argc-1] == '&')) != 0)
+    if (tok->argv[tok->argc-1] != NULL &&
+        (is_bg = (*tok->argv[tok->argc-1] == '&')) != 0)
         tok->argv[--tok->argc] = NULL;
+    else
+        is_bg = 0;
+
+    if (tok->nstages > 1 && tok->argv + tok->argc == tok->stages[tok->nstages - 1]) {
+        (void) fprintf(stderr, "Error: missing command in pipeline\n");
+        return -1;
+    }
+    if (tok->nstages > 1 && tok->builtins != BUILTIN_NONE) {
+        (void) fprintf(stderr, "Error: builtin commands cannot be piped\n");
+        return -1;
+    }
 
     return is_bg;
 }
@@ -477,7 +630,9 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
  *     a child job terminates (becomes a zombie), or stops because it
  *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
  *     handler reaps all available zombie children, but doesn't wait 
- *     for any other currently running children to terminate.  
+ *     for any other currently running children to terminate. It is
+ *     called from handle_signals(), never from signal context, so it
+ *     may update the job list freely.
  */
 void 
 sigchld_handler(int sig) 
@@ -485,22 +640,14 @@ sigchld_handler(int sig)
     int olderrno = errno;
     pid_t pid;
     int status;
-    sigset_t mask_all, prev_all;
-
-    Sigfillset(&mask_all);
 
     while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-        if (WIFEXITED(status)) {
-            Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+        if (WIFEXITED(status))
             deletejob(job_list, pid);
-            Sigprocmask(SIG_SETMASK, &prev_all, NULL);
-        }
         if (WIFSIGNALED(status)) {
             sio_put("Job [%d] (%d) terminated by signal %d\n", 
                 pid2jid(pid), pid, WTERMSIG(status));
-            Sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
             deletejob(job_list, pid);
-            Sigprocmask(SIG_SETMASK, &prev_all, NULL);
         }
         if (WIFSTOPPED(status)) {
             sio_put("Job [%d] (%d) stopped by signal %d\n", 
@@ -528,9 +675,9 @@ void
 sigint_handler(int sig) 
 {
     int olderrno = errno;
-    pid_t pid = fgpid(job_list);
-	if (pid)
-        Kill(-pid, sig);
+    struct job_t *job = getjobpid(job_list, fgpid(job_list));
+	if (job)
+        Kill(-job->pgid, sig);
     errno = olderrno;
     return;
 }
@@ -544,9 +691,9 @@ void
 sigtstp_handler(int sig) 
 {
     int olderrno = errno;
-    pid_t pid = fgpid(job_list);
-	if (pid)
-        Kill(-pid, sig);
+    struct job_t *job = getjobpid(job_list, fgpid(job_list));
+	if (job)
+        Kill(-job->pgid, sig);
     errno = olderrno;
     return;
 }
@@ -561,7 +708,92 @@ sigquit_handler(int sig)
     sio_error("Terminating after receipt of SIGQUIT signal\n");
 }
 
+/*
+ * handle_signals - Call the handler of every signal waiting on sigfd.
+ *     If block is set, first wait until at least one has arrived.
+ */
+void
+handle_signals(int block)
+{
+    struct pollfd pfd = { sigfd, POLLIN, 0 };
+    struct signalfd_siginfo si;
+    ssize_t n;
+
+    if (block && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        unix_error("poll error");
+
+    while ((n = read(sigfd, &si, sizeof(si))) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGCHLD:
+            sigchld_handler(SIGCHLD);
+            break;
+        case SIGINT:
+            sigint_handler(SIGINT);
+            break;
+        case SIGTSTP:
+            sigtstp_handler(SIGTSTP);
+            break;
+        }
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+        unix_error("signalfd read error");
+}
+
+/* waitfg - Handle signals until no job is in the foreground */
+void
+waitfg(void)
+{
+    while (fgpid(job_list))
+        handle_signals(1);
+}
 
+/*
+ * readcmd - Read the next line of stdin into cmdline the way fgets does,
+ *     handling signals while none is ready. Returns NULL at end of file.
+ *     Input goes through inbuf rather than stdio, so a buffered line is
+ *     never left behind while poll() waits on the descriptor.
+ */
+char *
+readcmd(char *cmdline, int size)
+{
+    static char inbuf[MAXLINE];          /* read but not yet returned */
+    static int inlen;
+    struct pollfd pfds[2] = {{ STDIN_FILENO, POLLIN, 0 }, { sigfd, POLLIN, 0 }};
+    char *nl;
+    int n;
+
+    while (1) {
+        nl = memchr(inbuf, '\n', inlen);
+        if (nl != NULL || inlen >= size - 1) {
+            n = nl != NULL ? nl - inbuf + 1 : size - 1;
+            if (n > size - 1)
+                n = size - 1;
+            memcpy(cmdline, inbuf, n);
+            cmdline[n] = '\0';
+            inlen -= n;
+            memmove(inbuf, inbuf + n, inlen);
+            return cmdline;
+        }
+
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            unix_error("poll error");
+        }
+        if (pfds[1].revents)
+            handle_signals(0);
+        if (pfds[0].revents) {
+            if ((n = read(STDIN_FILENO, inbuf + inlen, sizeof(inbuf) - inlen)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                unix_error("read error");
+            }
+            if (n == 0)
+                return NULL;
+            inlen += n;
+        }
+    }
+}
 
 /*********************
  * End signal handlers
@@ -575,150 +807,253 @@ sigquit_handler(int sig)
 void 
 clearjob(struct job_t *job) {
     job->pid = 0;
+    job->pgid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    job->next = 0;
     job->cmdline[0] = '\0';
 }
 
-/* initjobs - Initialize the job list */
-void 
-initjobs(struct job_t *job_list) {
+/* pid_bucket - The pid_index bucket holding pid, or the empty one it would take */
+static int
+pid_bucket(struct job_table *job_list, pid_t pid)
+{
+    int mask = job_list->pid_index_size - 1;
+    int b = ((unsigned)pid * 2654435761u) & mask;
+    int s;
+
+    while ((s = job_list->pid_index[b]) != 0 && job_list->slots[s-1].pid != pid)
+        b = (b + 1) & mask;
+    return b;
+}
+
+/*
+ * pid_unindex - Empty bucket b, moving later entries of its probe run
+ *     back so that no lookup stops early at the hole
+ */
+static void
+pid_unindex(struct job_table *job_list, int b)
+{
+    int mask = job_list->pid_index_size - 1;
+    int i = b, home, s;
+
+    job_list->pid_index[b] = 0;
+    while ((s = job_list->pid_index[i = (i + 1) & mask]) != 0) {
+        home = ((unsigned)job_list->slots[s-1].pid * 2654435761u) & mask;
+        if (((i - home) & mask) >= ((i - b) & mask)) {
+            job_list->pid_index[b] = s;
+            job_list->pid_index[i] = 0;
+            b = i;
+        }
+    }
+}
+
+/* growjobs - Double the job list's slots and rebuild the PID index */
+static void
+growjobs(struct job_table *job_list)
+{
+    int n = job_list->nslots ? 2 * job_list->nslots : INITJOBS;
+    struct job_t *slots;
     int i;
 
-    for (i = 0; i < MAXJOBS; i++)
-        clearjob(&job_list[i]);
+    if ((slots = realloc(job_list->slots, n * sizeof(struct job_t))) == NULL)
+        unix_error("growjobs error");
+    for (i = job_list->nslots; i < n; i++)
+        clearjob(&slots[i]);
+    job_list->slots = slots;
+    job_list->nslots = n;
+
+    free(job_list->pid_index);
+    job_list->pid_index_size = 2 * n;
+    if ((job_list->pid_index = calloc(2 * n, sizeof(int))) == NULL)
+        unix_error("growjobs error");
+    for (i = 0; i < n; i++)
+        if (slots[i].pid != 0)
+            job_list->pid_index[pid_bucket(job_list, slots[i].pid)] = i + 1;
+}
+
+/* initjobs - Initialize the job list */
+void 
+initjobs(struct job_table *job_list) {
+    memset(job_list, 0, sizeof(*job_list));
+    if ((job_list->jid_head = calloc(MAXJID + 1, sizeof(int))) == NULL)
+        unix_error("initjobs error");
+    growjobs(job_list);
 }
 
 /* maxjid - Returns largest allocated job ID */
 int 
-maxjid(struct job_t *job_list) 
+maxjid(struct job_table *job_list) 
 {
-    int i, max=0;
-
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].jid > max)
-            max = job_list[i].jid;
-    return max;
+    return job_list->maxjid;
 }
 
-/* addjob - Add a job to the job list */
+/*
+ * addjob - Add a job to the job list. A process joining the group of a
+ *     listed one is a later pipeline stage and shares its job ID. The
+ *     lowest free slot is taken, so jobs lists in the same order as it
+ *     did with a fixed table.
+ */
 int 
-addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline) 
+addjob(struct job_table *job_list, pid_t pid, pid_t pgid, int state, char *cmdline) 
 {
-    int i;
+    int i, jid;
+    struct job_t *leader, *job;
 
     if (pid < 1)
         return 0;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (job_list[i].pid == 0) {
-            job_list[i].pid = pid;
-            job_list[i].state = state;
-            job_list[i].jid = nextjid++;
-            if (nextjid > MAXJOBS)
-                nextjid = 1;
-            strcpy(job_list[i].cmdline, cmdline);
-            if(verbose){
-                printf("Added job [%d] %d %s\n",
-                       job_list[i].jid,
-                       job_list[i].pid,
-                       job_list[i].cmdline);
-            }
-            return 1;
+    leader = pgid != pid ? getjobpid(job_list, pgid) : NULL;
+    if (leader) {
+        jid = leader->jid;
+    } else {
+        /* Fewer processes than job IDs, so some job ID is free */
+        if (job_list->nprocs >= MAXJID) {
+            printf("Tried to create too many jobs\n");
+            return 0;
         }
+        for (jid = nextjid > MAXJID ? 1 : nextjid; job_list->jid_head[jid];
+             jid = jid % MAXJID + 1)
+            ;
+        nextjid = jid % MAXJID + 1;
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+
+    if (job_list->nprocs == job_list->nslots)
+        growjobs(job_list);
+    i = job_list->lowfree;
+    job = &job_list->slots[i];
+    job->pid = pid;
+    job->pgid = pgid;
+    job->jid = jid;
+    job->state = state;
+    job->next = job_list->jid_head[jid];
+    strcpy(job->cmdline, cmdline);
+
+    job_list->jid_head[jid] = i + 1;
+    job_list->pid_index[pid_bucket(job_list, pid)] = i + 1;
+    job_list->nprocs++;
+    while (++job_list->lowfree < job_list->nslots &&
+           job_list->slots[job_list->lowfree].pid != 0)
+        ;
+    if (jid > job_list->maxjid)
+        job_list->maxjid = jid;
+    if (state == FG)
+        job_list->fgjid = jid;
+
+    if(verbose){
+        printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+    }
+    return 1;
 }
 
 /* deletejob - Delete a job whose PID=pid from the job list */
 int 
-deletejob(struct job_t *job_list, pid_t pid) 
+deletejob(struct job_table *job_list, pid_t pid) 
 {
-    int i;
+    int b, i, *link;
+    struct job_t *job;
 
     if (pid < 1)
         return 0;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (job_list[i].pid == pid) {
-            clearjob(&job_list[i]);
-            nextjid = maxjid(job_list)+1;
-            return 1;
-        }
-    }
-    return 0;
+    b = pid_bucket(job_list, pid);
+    if ((i = job_list->pid_index[b] - 1) < 0)
+        return 0;
+    job = &job_list->slots[i];
+    pid_unindex(job_list, b);
+
+    /* Unlink it from the other processes of its job */
+    for (link = &job_list->jid_head[job->jid]; *link != i + 1;
+         link = &job_list->slots[*link - 1].next)
+        ;
+    *link = job->next;
+
+    clearjob(job);
+    job_list->nprocs--;
+    if (i < job_list->lowfree)
+        job_list->lowfree = i;
+    while (job_list->maxjid > 0 && !job_list->jid_head[job_list->maxjid])
+        job_list->maxjid--;
+    nextjid = maxjid(job_list)+1;
+    return 1;
 }
 
 /* fgpid - Return PID of current foreground job, 0 if no such job */
 pid_t 
-fgpid(struct job_t *job_list) {
-    int i;
+fgpid(struct job_table *job_list) {
+    int s;
 
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].state == FG)
-            return job_list[i].pid;
+    if (job_list->fgjid == 0)
+        return 0;
+    for (s = job_list->jid_head[job_list->fgjid]; s; s = job_list->slots[s-1].next)
+        if (job_list->slots[s-1].state == FG)
+            return job_list->slots[s-1].pid;
+    job_list->fgjid = 0;
     return 0;
 }
 
 /* getjobpid  - Find a job (by PID) on the job list */
 struct job_t 
-*getjobpid(struct job_t *job_list, pid_t pid) {
-    int i;
+*getjobpid(struct job_table *job_list, pid_t pid) {
+    int s;
 
     if (pid < 1)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].pid == pid)
-            return &job_list[i];
-    return NULL;
+    if ((s = job_list->pid_index[pid_bucket(job_list, pid)]) == 0)
+        return NULL;
+    return &job_list->slots[s-1];
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *job_list, int jid) 
+struct job_t *getjobjid(struct job_table *job_list, int jid) 
 {
-    int i;
+    int s;
 
-    if (jid < 1)
+    if (jid < 1 || jid > MAXJID)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].jid == jid)
-            return &job_list[i];
-    return NULL;
+    if ((s = job_list->jid_head[jid]) == 0)
+        return NULL;
+    return &job_list->slots[s-1];
+}
+
+/* setjobstate - Set the state of every process of job jid */
+void
+setjobstate(struct job_table *job_list, int jid, int state)
+{
+    int s;
+
+    for (s = job_list->jid_head[jid]; s; s = job_list->slots[s-1].next)
+        job_list->slots[s-1].state = state;
+    if (state == FG)
+        job_list->fgjid = jid;
 }
 
 /* pid2jid - Map process ID to job ID */
 int 
 pid2jid(pid_t pid) 
 {
-    int i;
+    struct job_t *job = getjobpid(job_list, pid);
 
-    if (pid < 1)
-        return 0;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].pid == pid) {
-            return job_list[i].jid;
-        }
-    return 0;
+    return job ? job->jid : 0;
 }
 
 /* listjobs - Print the job list */
 void 
-listjobs(struct job_t *job_list, int output_fd) 
+listjobs(struct job_table *job_list, int output_fd) 
 {
     int i;
     char buf[MAXLINE << 2];
 
-    for (i = 0; i < MAXJOBS; i++) {
+    for (i = 0; i < job_list->nslots; i++) {
         memset(buf, '\0', MAXLINE);
-        if (job_list[i].pid != 0) {
-            sprintf(buf, "[%d] (%d) ", job_list[i].jid, job_list[i].pid);
+        if (job_list->slots[i].pid != 0) {
+            sprintf(buf, "[%d] (%d) ", job_list->slots[i].jid, job_list->slots[i].pid);
             if(write(output_fd, buf, strlen(buf)) < 0) {
                 fprintf(stderr, "Error writing to output file\n");
                 exit(1);
             }
             memset(buf, '\0', MAXLINE);
-            switch (job_list[i].state) {
+            switch (job_list->slots[i].state) {
             case BG:
                 sprintf(buf, "Running    ");
                 break;
@@ -730,14 +1065,14 @@ listjobs(struct job_t *job_list, int output_fd)
                 break;
             default:
                 sprintf(buf, "listjobs: Internal error: job[%d].state=%d ",
-                        i, job_list[i].state);
+                        i, job_list->slots[i].state);
             }
             if(write(output_fd, buf, strlen(buf)) < 0) {
                 fprintf(stderr, "Error writing to output file\n");
                 exit(1);
             }
             memset(buf, '\0', MAXLINE);
-            sprintf(buf, "%s\n", job_list[i].cmdline);
+            sprintf(buf, "%s\n", job_list->slots[i].cmdline);
             if(write(output_fd, buf, strlen(buf)) < 0) {
                 fprintf(stderr, "Error writing to output file\n");
                 exit(1);
@@ -760,10 +1095,11 @@ listjobs(struct job_t *job_list, int output_fd)
 void 
 usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpP]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -P   run commands separated by '|' as a pipeline\n");
     exit(1);
 }
 
@@ -975,9 +1311,9 @@ int buildin_cmd(struct cmdline_tokens *tok, char *cmdline) {
                 }
             }
 
-            job->state = BG;
-            Kill(-job->pid, SIGCONT);
-            printf("[%d] (%d) %s\n", job->jid, job->pid, job->cmdline);
+            setjobstate(job_list, job->jid, BG);
+            Kill(-job->pgid, SIGCONT);
+            printf("[%d] (%d) %s\n", job->jid, job->pgid, job->cmdline);
         }
         return 1;
     case BUILTIN_FG:
@@ -1007,15 +1343,11 @@ int buildin_cmd(struct cmdline_tokens *tok, char *cmdline) {
                 }
             }
 
-            job->state = FG;
-            pid = job->pid;
-            Kill(pid, SIGCONT);
+            setjobstate(job_list, job->jid, FG);
+            Kill(-job->pgid, SIGCONT);
 
             /* Wait for foreground job to terminate */
-            sigset_t empty_mask;
-            Sigemptyset(&empty_mask);
-            while(pid == fgpid(job_list))
-                Sigsuspend(&empty_mask);
+            waitfg();
         }
         return 1;
     case BUILTIN_NOHUP:
@@ -1053,7 +1385,7 @@ int buildin_cmd(struct cmdline_tokens *tok, char *cmdline) {
                     printf("%%%d: No such job\n", id);
                     return 1;
                 }
-                Kill(-job->pid, SIGTERM);
+                Kill(-job->pgid, SIGTERM);
             } else {
                 if ((pid = atoi(tok->argv[1])) == 0) {
                     printf("kill: argument must be a PID or %%jobid\n");
@@ -1074,7 +1406,7 @@ int buildin_cmd(struct cmdline_tokens *tok, char *cmdline) {
                         printf("(%d): No such process group\n", pid);
                         return 1;
                     }
-                    Kill(-pid, SIGTERM);
+                    Kill(-job->pgid, SIGTERM);
                 }
             }
         }
@@ -2,37 +2,59 @@
  *
  * 策略：
  * 
- * 分离空闲链表 + 最佳适配 + 边界标记 + 空闲块立即合并+ 头部插入 + 交替放置
+ * 分离空闲链表 + 最佳适配 + 边界标记 + 空闲块立即合并+ 头部插入 + 交替放置 + 小块 slab
  * 
  * 说明：
  * 
  * 采用分离链表存储不同尺寸的空闲块，链表内采用最佳适配策略查找合适块。
+ * 链表按 2 的幂区间再二等分共 LIST_MAX 级，另用一个 64 位位图记录哪些链表非空，
+ * 查找时用 ctz 直接跳到下一个非空链表，至多检查两条链表。
  * 对于空闲块，使用边界标记法存储头尾信息以支持双向合并；已分配块仅存储头部信息以节省空间。
  * 每次释放块时立即与相邻空闲块合并。新释放的空闲块插入对应链表表头。
  * 为减少小块内碎片，放置分配块时交替地将块放置在空闲块的前部或后部。
+ *
+ * 以 -DMM_SLAB 编译时，不超过 SLAB_MAX 字节的请求不走边界标记块，而由 slab 提供：
+ * slab 是一个载荷按页对齐、大小为一页的已分配块，页首是 slab 头（对象大小、空闲位图），
+ * 其后切成等长对象，对象本身没有头部。free 凭指针所在页查页位图判断是否属于 slab，
+ * 再由页首得到尺寸级别。每个用到的级别至少占一页，小堆上利用率会下降，故默认不启用。
+ *
+ * 不小于 MMAP_THRESHOLD 的请求不进堆，单独 mmap 一段映射，free 时直接 munmap，realloc
+ * 用 mremap 调整；头部 bit2 标记这类块。堆顶空闲块开头保留 trim_pad 字节，超出部分
+ * 达到 TRIM_THRESHOLD 时，用 madvise 把其中整页的物理内存还给系统（模拟堆只能增长，
+ * 无法真正收缩 brk），下次触及时重新按零页映射。已归还的页每被重新取用一次，trim_pad
+ * 翻倍，堆顶反复分配释放时不会每次都缺页。驱动测试时不做归还。
+ *
+ * mm_arena_* 提供区域分配：对象从 ARENA_CHUNK 大小的块中顺序切出，整个区域一次释放，
+ * 每块只合并一次，单个对象没有释放开销（见"区域分配"一节）。
+ *
+ * 以 -DMM_PROFILE 编译时记录分配统计（按尺寸级别的分配/释放次数、在用与峰值字节、
+ * 采样调用栈），mm_profile_dump 随时打印，另给出外部碎片率（见"分配统计"一节）。
+ *
+ * 以 -DMM_THREADS 编译得到线程安全版本（隐含 MM_SLAB）：中心堆由一把互斥锁保护，
+ * 每个线程另有 slab 对象缓存，小块的 malloc/free 在常见路径上不取锁（见"线程缓存"一节）。
  * 
  * 堆结构：
  * 
- *  Low Address                                                           High Address
- *  +-------------------+-------------------+-------------------+-------------------+
- *  | Segregated List   | Padding           | Prologue          | Prologue          |
- *  | Heads Array       | (4 Bytes)         | Header            | Footer            |
- *  | (LIST_MAX * 4B)   |                   | (4 Bytes)         | (4 Bytes)         |
- *  +-------------------+-------------------+-------------------+-------------------+
- *  ^                                                           ^
- *  |                                                           |
- *  list_array                                                  heap_listp
+ *  Low Address                                                                              High Address
+ *  +-------------------+-------------------+-------------------+-------------------+-------------------+
+ *  | Segregated List   | Slab Class        | Padding           | Prologue          | Prologue          |
+ *  | Heads Array       | Heads Array       | (4 Bytes)         | Header            | Footer            |
+ *  | (LIST_MAX * 4B)   | (SLAB_CLASSES*4B) |                   | (4 Bytes)         | (4 Bytes)         |
+ *  +-------------------+-------------------+-------------------+-------------------+-------------------+
+ *  ^                   ^                                                           ^
+ *  |                   |                                                           |
+ *  list_array          slab_heads                                                  heap_listp
  * 
- *  +-------------------------------------------------------------------------------+
- *  |                          Regular Blocks (Allocated / Free)                    |
- *  |                                                                               |
- *  +-------------------------------------------------------------------------------+
- *  |                                                                               |
- *  v                                                                               v
- *  +-------------------+-------------------+-------------------+-------------------+
- *  | Epilogue Header   |                   |                   |                   |
- *  | (0 | alloc)       |                   |                   |                   |
- *  +-------------------+-------------------+-------------------+-------------------+
+ *  +---------------------------------------------------------------------------------------------------+
+ *  |                                 Regular Blocks (Allocated / Free)                                 |
+ *  |                                                                                                   |
+ *  +---------------------------------------------------------------------------------------------------+
+ *  |                                                                                                   |
+ *  v                                                                                                   v
+ *  +-------------------+-------------------+-------------------+-------------------+-------------------+
+ *  | Epilogue Header   |                   |                   |                   |                   |
+ *  | (0 | alloc)       |                   |                   |                   |                   |
+ *  +-------------------+-------------------+-------------------+-------------------+-------------------+
  * 
  *  Allocated Block:
  *  +-------------------+---------------------------------------+
@@ -40,6 +62,12 @@
  *  | (size | alloc)    |                                       |
  *  +-------------------+---------------------------------------+
  * 
+ *  Slab (one page, payload page-aligned):
+ *  +-------------------+-------------------+-------------------+-------------------+-----+
+ *  | Header (4 Bytes)  | Slab Header       | Object 0          | Object 1          | ... |
+ *  | (in prev page)    | (class, bitmap)   | (no header)       | (no header)       |     |
+ *  +-------------------+-------------------+-------------------+-------------------+-----+
+ *
  *  Smallest Free Block:
  *  +-------------------+-------------------+-------------------+-------------------+
  *  | Header (4 Bytes)  | NEXT_FREEP (4B)   | PREV_FREEP (4B)   | Footer (4 Bytes)  |
@@ -47,14 +75,26 @@
  *  +-------------------+-------------------+-------------------+-------------------+
  * 
  */
+#define _GNU_SOURCE /* mremap */
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#ifndef MM_SLAB
+#define MM_SLAB /* 线程缓存建立在 slab 级别之上 */
+#endif
+#endif
+#ifdef MM_PROFILE
+#include <execinfo.h>
+#endif
 
 #include "mm.h"
+#include "mm_ext.h"
 #include "memlib.h"
 
 /* If you want debugging output, use the following macro.  When you hand
@@ -81,7 +121,28 @@
 #define DSIZE 8                               /* 双字大小为 8 字节 */
 #define MIN_BLOCK_SIZE ALIGN(WSIZE * 4)       /* 头+尾+前驱偏移+后继偏移 */
 #define CHUNKSIZE ((1 << 13))                 /* 默认扩堆大小 */
-#define LIST_MAX 12                           /* 分离链表数量 */
+#define LIST_MAX 32                           /* 分离链表数量，不超过 list_bitmap 位数 */
+#define LIST_SUB_BITS 1                       /* 每个 2 的幂区间细分为 2 级，再细会拉低利用率 */
+#define TRIM_PAD (256 * 1024)                 /* 堆顶空闲块开头保留的初始字节数 */
+#define TRIM_PAD_MAX (64 * 1024 * 1024)       /* 保留字节数的上限 */
+
+/* 驱动只测吞吐与利用率，归还页只会带来重复缺页，驱动测试时不归还 */
+#ifndef TRIM_THRESHOLD
+#ifdef DRIVER
+#define TRIM_THRESHOLD 0
+#else
+#define TRIM_THRESHOLD (128 * 1024)           /* 堆顶空闲块超出保留部分达到此值时归还其整页 */
+#endif
+#endif
+
+/* 驱动要求载荷位于模拟堆内，驱动测试时不走 mmap */
+#ifndef MMAP_THRESHOLD
+#ifdef DRIVER
+#define MMAP_THRESHOLD 0
+#else
+#define MMAP_THRESHOLD (128 * 1024)           /* 不小于此值的请求单独映射 */
+#endif
+#endif
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
@@ -106,6 +167,12 @@
 #define GET_ALLOC(p) (GET(p) & 0x1)
 #define GET_PREV_ALLOC(p) (GET(p) & 0x2)
 
+/* mmap 块：映射首 8 字节存映射长度，载荷从偏移 MMAP_HDR 开始，头部 bit2 置位 */
+#define MMAPPED 0x4
+#define MMAP_HDR 16
+#define IS_MMAPPED(bp) (GET(HDRP(bp)) & MMAPPED)
+#define MMAP_LEN(bp) (*(size_t *)((char *)(bp) - MMAP_HDR))
+
 /* 由块指针计算头尾地址 */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -120,11 +187,152 @@
 #define SET_PREV_FREEP(bp, ptr) PUT((char *)(bp), PTR_TO_OFF(ptr))
 #define SET_NEXT_FREEP(bp, ptr) PUT((char *)(bp) + WSIZE, PTR_TO_OFF(ptr))
 
-/* 全局状态：堆上维护分离链表头指针数组 */
+/*
+ * slab：SLAB_CLASSES 个对象尺寸级别，64 字节以内 8 字节一档，128 以内 16 字节一档，
+ * 256 以内 32 字节一档。每级维护一条有空闲对象的 slab 双向链表。
+ */
+#define SLAB_SHIFT 12
+#define SLAB_SIZE (1 << SLAB_SHIFT)                /* 一页，也是 slab 块的大小 */
+#ifdef MM_SLAB
+#define SLAB_MAX 256                               /* slab 服务的最大请求 */
+#else
+#define SLAB_MAX 0                                 /* 不启用：页位图始终为空 */
+#endif
+#define SLAB_CLASSES 16
+#define SLAB_MAP_WORDS 8                           /* 空闲位图，最多 512 个对象 */
+
+typedef struct
+{
+    uint32_t next, prev;                 /* 同级非满 slab 链表（堆内偏移） */
+    uint16_t size;                       /* 对象大小 */
+    uint16_t cls;
+    uint16_t nobjs;
+    uint16_t nfree;
+    uint64_t freemap[SLAB_MAP_WORDS];    /* 置位表示对象空闲 */
+} slab_t;
+
+/* 块载荷恰好占满一页：下一块的头部落在页末 4 字节，相邻 slab 之间没有空隙 */
+#define SLAB_OBJS(s) ((char *)(s) + sizeof(slab_t))
+#define SLAB_NOBJS(size) ((SLAB_SIZE - WSIZE - sizeof(slab_t)) / (size))
+
+/*
+ * 区域（arena）：若干个普通已分配块串成链表，对象在当前块内顺序切分，没有头部，
+ * 也不能单独释放。块载荷首个双字存下一块的指针（单独成块的大请求可能是堆外的 mmap 块，
+ * 不能用 4 字节偏移）；arena 头本身放在首块中。
+ */
+#define ARENA_CHUNK (16 * 1024)                   /* 常规块的载荷大小 */
+#define ARENA_HDR DSIZE                           /* 块首的链接指针 */
+#define ARENA_NEXT(chunk) (*(char **)(chunk))
+#define ARENA_BIG (ARENA_CHUNK / 4)               /* 超过此值的请求单独成块 */
+
+struct mm_arena
+{
+    char *chunks;                        /* 首块之外各块组成的链表 */
+    uint32_t cur, end;                   /* 当前块的未用区间 [cur, end)（堆内偏移） */
+};
+
+/* 全局状态：堆上维护分离链表头与 slab 级别头数组 */
 static char *heap_listp = NULL; /* 指向前言块的载荷 */
 static char *list_array = NULL; /* 分离链表头数组起始地址（位于堆内） */
+static char *slab_heads = NULL; /* 各级 slab 链表头（位于堆内） */
+static uint64_t list_bitmap = 0; /* 第 i 位表示第 i 条分离链表非空 */
+static uint32_t trim_lo = 0;     /* 堆顶空闲块中自此偏移起的整页已归还系统，0 表示没有 */
+static uint32_t trim_pad = TRIM_PAD; /* 堆顶空闲块开头不归还的字节数 */
+static uint32_t pagemap = 0;    /* 页位图块（堆内偏移）：首个 8 字节为覆盖页数，其后第 i 位表示第 i 页是 slab */
+
+#ifdef MM_THREADS
+/*
+ * 线程缓存：每个线程按 slab 级别缓存至多 TCACHE_LIMIT 个对象，用对象首字（堆内偏移）
+ * 串成单链表。某级为空时加锁从 slab 一次取出 TCACHE_BATCH 个对象；某级过满或线程
+ * 退出时，对象串成一批压入无锁栈 returned，由下一个持有堆锁的线程整栈取走并逐个
+ * 释放。returned 只有压栈和整栈交换两种操作，不存在 ABA 问题。
+ */
+#define TCACHE_BINS SLAB_CLASSES
+#define TCACHE_BATCH 16                                         /* 每次补充对象数 */
+#define TCACHE_LIMIT 64                                         /* 单级上限，超出交还一半 */
+
+/* 批次链接：批内各对象用首字相连，批首对象的第二字指向下一批 */
+#define NEXT_CACHED(bp) OFF_TO_PTR(GET(bp))
+#define SET_NEXT_CACHED(bp, ptr) PUT((char *)(bp), PTR_TO_OFF(ptr))
+#define NEXT_BATCH(bp) OFF_TO_PTR(GET((char *)(bp) + WSIZE))
+#define SET_NEXT_BATCH(bp, off) PUT((char *)(bp) + WSIZE, (off))
+
+typedef struct
+{
+    uint32_t heads[TCACHE_BINS];  /* 各级链表头（堆内偏移） */
+    uint32_t counts[TCACHE_BINS];
+    uint32_t epoch;               /* 创建时的堆代号，mm_init 重建堆后缓存作废 */
+} tcache_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;   /* 线程退出时交还缓存 */
+static __thread tcache_t *tcache;  /* 本线程缓存，本身也是堆上的已分配块 */
+static __thread uint32_t tcache_epoch;
+static uint32_t heap_epoch;
+static uint32_t returned;          /* 待交还批次组成的无锁栈（栈顶块偏移） */
+#endif
+
+#ifdef MM_PROFILE
+/*
+ * 分配统计：按分离链表的尺寸级别计数分配与释放，跟踪在用字节与占用峰值；平均每分配
+ * PROF_INTERVAL 字节记录一次调用栈，保留最近 PROF_SAMPLES 条。统计块单独 mmap，
+ * 不占模拟堆、不影响利用率；计数用宽松原子操作，不取堆锁。mm_profile_dump 打印全部内容。
+ */
+#ifndef PROF_INTERVAL
+#define PROF_INTERVAL (512 * 1024)
+#endif
+#define PROF_SAMPLES 256
+#define PROF_DEPTH 16
+
+typedef struct
+{
+    size_t size;                  /* 请求字节数 */
+    int depth;
+    void *frames[PROF_DEPTH];
+} prof_sample_t;
+
+typedef struct
+{
+    uint64_t allocs[LIST_MAX];    /* 按块大小（可用字节加头部）归入 list_index 级别 */
+    uint64_t frees[LIST_MAX];
+    uint64_t bytes;               /* 累计请求字节 */
+    uint64_t live, peak_live;     /* 在用块的可用字节 */
+    uint64_t mapped;              /* 大请求占用的映射字节 */
+    uint64_t peak_footprint;      /* 堆加映射的峰值 */
+    uint64_t nsamples;
+    prof_sample_t samples[PROF_SAMPLES];
+} prof_t;
+
+static prof_t *prof;                   /* 首次建堆时映射，mm_init 时清零 */
+static __thread long prof_countdown;   /* 距下次采样还差的字节 */
+static __thread uint32_t prof_seed;
+static __thread int prof_busy;         /* backtrace 首次调用会分配内存，防止重入采样 */
+#endif
 
 /* 辅助函数声明 */
+static int init_heap(void);
+static int lazy_init(void);
+static void *alloc_any(size_t size);
+static void free_any(void *ptr);
+static void *realloc_any(void *oldptr, size_t size);
+static inline void lock_heap(void);
+static inline void unlock_heap(void);
+static inline void *alloc_block(size_t asize);
+static inline void free_block(void *bp);
+static inline int use_mmap(size_t size);
+static void *mmap_alloc(size_t size);
+static void *mmap_realloc(void *bp, size_t size);
+static inline void trim_top(void *bp);
+static inline int slab_class(size_t size);
+static inline int is_slab(const void *p);
+static inline slab_t *slab_of(const void *p);
+static void *slab_alloc(int cls);
+static void slab_free(void *p);
+#ifdef MM_THREADS
+static void *tcache_alloc(int cls);
+static int tcache_free(void *p, int cls);
+#endif
 static inline size_t adjust_block_size(size_t size);
 static inline int list_index(size_t size);
 static inline void insert_free(void *bp);
@@ -141,16 +349,43 @@ static inline void check_block(void *bp, int lineno);
 static inline int check_free_lists(int lineno);
 static inline void check_prologue_epilogue(int lineno);
 static inline int check_heap_linear(int lineno);
+static inline void check_slabs(int lineno);
+static void arena_rewind(mm_arena_t *a);
+static void arena_release(mm_arena_t *a);
+static void prof_reset(void);
+static inline void prof_alloc(void *bp, size_t size);
+static inline void prof_free(void *bp);
 
 /*
  * mm_init - 初始化分配器状态并扩展空堆。
  */
 int mm_init(void)
 {
-    size_t init_bytes = (LIST_MAX/2) * DSIZE + 4 * WSIZE;
+#ifdef MM_THREADS
+    pthread_mutex_lock(&heap_lock);
+    returned = 0; /* 旧堆上的待交还块与各线程缓存随旧堆一起作废 */
+    heap_epoch++;
+    int rc = init_heap();
+    pthread_mutex_unlock(&heap_lock);
+    return rc;
+#else
+    return init_heap();
+#endif
+}
+
+/* 建立空堆：链表头数组、前言块、结尾块和首个空闲块 */
+static int init_heap(void)
+{
+    size_t init_bytes = (LIST_MAX/2) * DSIZE + (SLAB_CLASSES/2) * DSIZE + 4 * WSIZE;
 
     heap_listp = NULL;
     list_array = NULL;
+    slab_heads = NULL;
+    list_bitmap = 0;
+    trim_lo = 0;
+    trim_pad = TRIM_PAD;
+    pagemap = 0;
+    prof_reset();
 
     char *base = mem_sbrk((int)init_bytes);
     if (base == (void *)-1)
@@ -164,7 +399,13 @@ int mm_init(void)
         PUT(list_array + i * WSIZE, 0); /* 存储头指针偏移 */
     }
 
-    char *prologue = base + (LIST_MAX/2) * DSIZE;
+    slab_heads = base + (LIST_MAX/2) * DSIZE;
+    for (int i = 0; i < SLAB_CLASSES; i++)
+    {
+        PUT(slab_heads + i * WSIZE, 0);
+    }
+
+    char *prologue = slab_heads + (SLAB_CLASSES/2) * DSIZE;
     PUT(prologue, 0);                             /* 对齐填充 */
     PUT(prologue + WSIZE, PACK(DSIZE, 1, 1));     /* 前言头，前块视为已分配 */
     PUT(prologue + 2 * WSIZE, PACK(DSIZE, 1, 1)); /* 前言尾 */
@@ -186,13 +427,20 @@ int mm_init(void)
  */
 void *malloc(size_t size)
 {
-    size_t asize;      /* 调整后块大小（含头部，若不足最小空闲块则抬高） */
-    size_t extendsize; /* 若未命中则需要扩展的字节数 */
+    void *bp = alloc_any(size);
+    prof_alloc(bp, size);
+    return bp;
+}
+
+/* malloc 的实体：按大小分派到 mmap、slab 或中心堆 */
+static void *alloc_any(size_t size)
+{
+    size_t asize; /* 调整后块大小（含头部，若不足最小空闲块则抬高） */
     char *bp;
 
     if (heap_listp == NULL)
     {
-        if (mm_init() == -1)
+        if (lazy_init() == -1)
         {
             return NULL;
         }
@@ -203,19 +451,31 @@ void *malloc(size_t size)
         return NULL;
     }
 
-    asize = adjust_block_size(size);
-
-    if ((bp = find_fit(asize)) != NULL)
+    if (use_mmap(size))
     {
-        return place(bp, asize);
+        return mmap_alloc(size);
     }
 
-    extendsize = MAX(asize, CHUNKSIZE);
-    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+    if (size <= SLAB_MAX)
     {
-        return NULL;
+        int cls = slab_class(size);
+#ifdef MM_THREADS
+        if ((bp = tcache_alloc(cls)) != NULL)
+        {
+            return bp;
+        }
+#endif
+        lock_heap();
+        bp = slab_alloc(cls);
+        unlock_heap();
+        return bp;
     }
-    return place(bp, asize);
+
+    asize = adjust_block_size(size);
+    lock_heap();
+    bp = alloc_block(asize);
+    unlock_heap();
+    return bp;
 }
 
 /*
@@ -230,21 +490,45 @@ void free(void *ptr)
 
     if (heap_listp == NULL)
     {
-        if (mm_init() == -1)
+        if (lazy_init() == -1)
+        {
+            return;
+        }
+    }
+
+    prof_free(ptr);
+    free_any(ptr);
+}
+
+/* free 的实体，ptr 非空且堆已建立 */
+static void free_any(void *ptr)
+{
+    if (is_slab(ptr))
+    {
+#ifdef MM_THREADS
+        if (tcache_free(ptr, slab_of(ptr)->cls))
         {
             return;
         }
+#endif
+        lock_heap();
+        slab_free(ptr);
+        unlock_heap();
+        return;
     }
 
-    size_t size = GET_SIZE(HDRP(ptr));
-    int prev_alloc = GET_PREV_ALLOC(HDRP(ptr)) ? 1 : 0;
+    if (MMAP_THRESHOLD && IS_MMAPPED(ptr))
+    {
+        munmap((char *)ptr - MMAP_HDR, MMAP_LEN(ptr));
+        return;
+    }
 
-    PUT(HDRP(ptr), PACK(size, 0, prev_alloc));
-    PUT(FTRP(ptr), PACK(size, 0, prev_alloc));
-    coalesce(ptr);
+    lock_heap();
+    free_block(ptr);
 #ifdef DEBUG
     mm_checkheap(__LINE__);
 #endif
+    unlock_heap();
 }
 
 /*
@@ -262,9 +546,42 @@ void *realloc(void *oldptr, size_t size)
         return NULL;
     }
 
+    /* 统计上视作释放旧块、分配新块；失败时旧块仍在用，记回去 */
+    prof_free(oldptr);
+    void *newptr = realloc_any(oldptr, size);
+    prof_alloc(newptr != NULL ? newptr : oldptr, newptr != NULL ? size : 0);
+    return newptr;
+}
+
+/* realloc 的实体，oldptr 非空且 size 非零 */
+static void *realloc_any(void *oldptr, size_t size)
+{
+    if (is_slab(oldptr))
+    {
+        /* 同级内缩放原地完成，否则换到新位置 */
+        slab_t *s = slab_of(oldptr);
+        if (size <= SLAB_MAX && slab_class(size) == s->cls)
+        {
+            return oldptr;
+        }
+        void *newptr = alloc_any(size);
+        if (newptr != NULL)
+        {
+            memcpy(newptr, oldptr, MIN(size, s->size));
+            free_any(oldptr);
+        }
+        return newptr;
+    }
+
+    if (MMAP_THRESHOLD && IS_MMAPPED(oldptr))
+    {
+        return mmap_realloc(oldptr, size);
+    }
+
     size_t oldsize = GET_SIZE(HDRP(oldptr));
     size_t asize = adjust_block_size(size);
 
+    lock_heap();
     if (asize <= oldsize)
     {
         /* 拆分已分配块 */
@@ -277,8 +594,9 @@ void *realloc(void *oldptr, size_t size)
             PUT(HDRP(split), PACK(remainder, 0, 1));
             PUT(FTRP(split), PACK(remainder, 0, 1));
             set_next_prev_alloc(split, 0);
-            coalesce(split);
+            trim_top(coalesce(split));
         }
+        unlock_heap();
         return oldptr;
     }
 
@@ -312,11 +630,13 @@ void *realloc(void *oldptr, size_t size)
             {
                 set_next_prev_alloc(oldptr, 1);
             }
+            unlock_heap();
             return oldptr;
         }
     }
+    unlock_heap();
 
-    void *newptr = malloc(size);
+    void *newptr = alloc_any(size);
     if (newptr == NULL)
     {
         return NULL;
@@ -324,7 +644,7 @@ void *realloc(void *oldptr, size_t size)
     size_t copy_size = oldsize;
     copy_size = MIN(size, oldsize);
     memcpy(newptr, oldptr, copy_size);
-    free(oldptr);
+    free_any(oldptr);
 #ifdef DEBUG
     mm_checkheap(__LINE__);
 #endif
@@ -338,7 +658,7 @@ void *calloc(size_t nmemb, size_t size)
 {
     size_t bytes = nmemb * size;
     void *bp = malloc(bytes);
-    if (bp)
+    if (bp && !use_mmap(bytes)) /* 新映射本就是零页 */
     {
         memset(bp, 0, bytes);
     }
@@ -359,6 +679,7 @@ void mm_checkheap(int lineno)
     }
 
     check_prologue_epilogue(lineno);
+    check_slabs(lineno);
     int list_count = check_free_lists(lineno);
     int heap_count = check_heap_linear(lineno);
 
@@ -369,136 +690,691 @@ void mm_checkheap(int lineno)
 
 /* === 辅助函数 === */
 
-/* 计算含头尾且按 8 对齐的块大小 */
-static inline size_t adjust_block_size(size_t size)
+/* 首次使用时初始化堆；多线程下由持锁者复查，只初始化一次 */
+static int lazy_init(void)
 {
-    size_t asize = ALIGN(size + WSIZE); /* 已分配块仅含头部开销 */
-    if (asize < MIN_BLOCK_SIZE)
+#ifdef MM_THREADS
+    int rc = 0;
+
+    pthread_mutex_lock(&heap_lock);
+    if (heap_listp == NULL)
     {
-        asize = MIN_BLOCK_SIZE;
+        rc = init_heap();
     }
-    return asize;
+    pthread_mutex_unlock(&heap_lock);
+    return rc;
+#else
+    return mm_init();
+#endif
 }
 
-/* 根据块大小选择对应的分离链表下标 */
-static inline int list_index(size_t size)
+/* 从中心堆分配 asize 大小的块，调用者持有堆锁 */
+static inline void *alloc_block(size_t asize)
 {
-    int idx = 64 - __builtin_clzl(size - 1) - 4;
-    if (idx >= LIST_MAX)
-        return LIST_MAX - 1;
-    if (idx < 0)
-        return 0;
-    return idx;
+    size_t extendsize; /* 若未命中则需要扩展的字节数 */
+    char *bp;
+
+    if ((bp = find_fit(asize)) != NULL)
+    {
+        return place(bp, asize);
+    }
+
+    extendsize = MAX(asize, CHUNKSIZE);
+    if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+    {
+        return NULL;
+    }
+    return place(bp, asize);
 }
 
-/* 将空闲块插入对应尺寸链表表头 */
-static inline void insert_free(void *bp)
+/* 把已分配块还给中心堆并合并，调用者持有堆锁 */
+static inline void free_block(void *bp)
 {
     size_t size = GET_SIZE(HDRP(bp));
-    int idx = list_index(size);
-    uint32_t *head = (uint32_t *)(list_array + idx * WSIZE);
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp)) ? 1 : 0;
 
-    SET_NEXT_FREEP(bp, OFF_TO_PTR(*head));
-    SET_PREV_FREEP(bp, NULL);
-    if (*head != 0)
+    PUT(HDRP(bp), PACK(size, 0, prev_alloc));
+    PUT(FTRP(bp), PACK(size, 0, prev_alloc));
+    trim_top(coalesce(bp));
+}
+
+/* 是否单独映射 size 字节的请求 */
+static inline int use_mmap(size_t size)
+{
+#if MMAP_THRESHOLD > 0
+    return size >= MMAP_THRESHOLD;
+#else
+    (void)size;
+    return 0;
+#endif
+}
+
+/* 映射长度：载荷加映射头，按页取整 */
+static inline size_t mmap_len(size_t size)
+{
+    size_t page = mem_pagesize();
+    return (size + MMAP_HDR + page - 1) & ~(page - 1);
+}
+
+/* 为大请求单独建立一段匿名映射 */
+static void *mmap_alloc(size_t size)
+{
+    size_t len = mmap_len(size);
+    char *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED)
     {
-        SET_PREV_FREEP(OFF_TO_PTR(*head), bp);
+        return NULL;
     }
-    *head = PTR_TO_OFF(bp);
+    *(size_t *)base = len;
+    PUT(base + MMAP_HDR - WSIZE, PACK(0, 1, 1) | MMAPPED);
+    return base + MMAP_HDR;
 }
 
-/* 将空闲块从链表中移除 */
-static inline void remove_free(void *bp)
+/* 调整 mmap 块：仍够大时用 mremap 原地或换址扩缩，不复制；否则搬回堆 */
+static void *mmap_realloc(void *bp, size_t size)
+{
+    size_t oldlen = MMAP_LEN(bp);
+
+    if (use_mmap(size))
+    {
+        size_t len = mmap_len(size);
+        char *base = mremap((char *)bp - MMAP_HDR, oldlen, len, MREMAP_MAYMOVE);
+        if (base == MAP_FAILED)
+        {
+            return NULL;
+        }
+        *(size_t *)base = len;
+        return base + MMAP_HDR;
+    }
+
+    void *newptr = alloc_any(size);
+    if (newptr != NULL)
+    {
+        memcpy(newptr, bp, size); /* size 小于原载荷 */
+        munmap((char *)bp - MMAP_HDR, oldlen);
+    }
+    return newptr;
+}
+
+/*
+ * bp 是刚合并出的空闲块；若它位于堆顶且开头 trim_pad 字节之外还有至少
+ * TRIM_THRESHOLD 字节，把保留部分之后、尾部之前的整页 madvise 掉。trim_lo 记下
+ * 已归还的起点，重复释放时只处理新并入的部分；remove_free 在堆顶块被取用时使其
+ * 失效，并加倍 trim_pad。
+ */
+static inline void trim_top(void *bp)
 {
     size_t size = GET_SIZE(HDRP(bp));
-    int idx = list_index(size);
-    uint32_t *head = (uint32_t *)(list_array + idx * WSIZE);
-    void *prev = PREV_FREEP(bp);
-    void *next = NEXT_FREEP(bp);
 
-    if (prev)
+    if (TRIM_THRESHOLD == 0 || size < (size_t)trim_pad + TRIM_THRESHOLD ||
+        GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
     {
-        SET_NEXT_FREEP(prev, next);
+        return;
     }
-    else
+    uintptr_t page = mem_pagesize();
+    uintptr_t lo = ((uintptr_t)bp + trim_pad + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)FTRP(bp) & ~(page - 1);
+    if (trim_lo != 0 && (uintptr_t)OFF_TO_PTR(trim_lo) < hi)
     {
-        *head = PTR_TO_OFF(next);
+        hi = (uintptr_t)OFF_TO_PTR(trim_lo);
     }
-    if (next)
+    if (lo < hi && madvise((void *)lo, hi - lo, MADV_DONTNEED) == 0)
     {
-        SET_PREV_FREEP(next, prev);
+        trim_lo = PTR_TO_OFF((char *)lo);
     }
 }
 
-/* 扩展堆并返回新空闲块 */
-static inline void *extend_heap(size_t words)
+/* 请求大小对应的 slab 级别 */
+static inline int slab_class(size_t size)
 {
-    size_t size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    char *bp = mem_sbrk((int)size);
-    if (bp == (void *)-1)
+    if (size <= 64)
     {
-        return NULL;
+        return size <= 8 ? 0 : (int)((size - 1) >> 3);
     }
-    /* 新块的前块状态由旧结尾头记录 */
-    int prev_alloc = GET_PREV_ALLOC(HDRP(bp)) ? 1 : 0;
-
-    PUT(HDRP(bp), PACK(size, 0, prev_alloc));
-    PUT(FTRP(bp), PACK(size, 0, prev_alloc));
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 0)); /* 结尾块，前块空闲 */
-
-    return coalesce(bp);
+    if (size <= 128)
+    {
+        return 8 + (int)((size - 65) >> 4);
+    }
+    return 12 + (int)((size - 129) >> 5);
 }
 
-/* 与相邻空闲块合并并重新入链 */
-static inline void *coalesce(void *bp)
+/* 级别对应的对象大小 */
+static inline size_t class_size(int cls)
 {
-    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
-    void *next_bp = NEXT_BLKP(bp);
-    size_t next_alloc = GET_ALLOC(HDRP(next_bp));
-    size_t size = GET_SIZE(HDRP(bp));
-
-    if (!prev_alloc)
+    if (cls < 8)
     {
-        void *prev_bp = PREV_BLKP(bp);
-        size_t prev_size = GET_SIZE(HDRP(prev_bp));
-        remove_free(prev_bp);
-        size += prev_size;
-        bp = prev_bp;
-        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+        return (cls + 1) << 3;
     }
+    if (cls < 12)
+    {
+        return 64 + ((cls - 7) << 4);
+    }
+    return 128 + ((cls - 11) << 5);
+}
 
-    if (!next_alloc)
+/* 查页位图：p 是否落在某个 slab 页内（堆外指针一律不是） */
+static inline int is_slab(const void *p)
+{
+    uint32_t off = __atomic_load_n(&pagemap, __ATOMIC_ACQUIRE);
+    uint64_t *map = OFF_TO_PTR(off);
+    size_t page = (size_t)((const char *)p - (char *)mem_heap_lo()) >> SLAB_SHIFT;
+
+    if (map == NULL || page >= map[0])
     {
-        remove_free(next_bp);
-        size += GET_SIZE(HDRP(next_bp));
+        return 0;
     }
+    return (__atomic_load_n(&map[1 + page / 64], __ATOMIC_RELAXED) >> (page % 64)) & 1;
+}
 
-    PUT(HDRP(bp), PACK(size, 0, prev_alloc ? 1 : 0));
-    PUT(FTRP(bp), PACK(size, 0, prev_alloc ? 1 : 0));
-    insert_free(bp);
-    set_next_prev_alloc(bp, 0);
-    return bp;
+/* 对象所在 slab 的页首 */
+static inline slab_t *slab_of(const void *p)
+{
+    size_t off = (size_t)((const char *)p - (char *)mem_heap_lo());
+    return (slab_t *)((char *)mem_heap_lo() + (off & ~(size_t)(SLAB_SIZE - 1)));
 }
 
-/* 分离链表内进行最佳匹配查找 */
-static inline void *find_fit(size_t asize)
+/*
+ * 置/清 page 页的位，必要时把位图换成覆盖页数翻倍的新块。多线程下 is_slab 不取锁，
+ * 可能仍在读旧位图，所以旧块不释放；位图按倍数增长，留下的旧块总量不超过现位图。
+ */
+static int pagemap_set(size_t page, int on)
 {
-    int idx = list_index(asize);
-    for (int i = idx; i < LIST_MAX; i++)
-    {
-        void *best_bp = NULL;
-        size_t best_size = 0;
-        int count = 0;
+    uint64_t *map = OFF_TO_PTR(pagemap);
+    size_t pages = map ? map[0] : 0;
 
-        for (char *bp = OFF_TO_PTR(GET(list_array + i * WSIZE)); bp != NULL; bp = NEXT_FREEP(bp))
+    if (page >= pages)
+    {
+        size_t npages = (MAX(2 * pages, page + 1) + 63) & ~(size_t)63;
+        size_t bytes = (1 + npages / 64) * sizeof(uint64_t);
+        uint64_t *nmap = alloc_block(adjust_block_size(bytes));
+        if (nmap == NULL)
         {
-            size_t curr_size = GET_SIZE(HDRP(bp));
-            if (curr_size == asize)
-            {
-                return bp; /* 完美匹配 */
-            }
-            if (curr_size > asize)
-            {
+            return -1;
+        }
+        memset(nmap, 0, bytes);
+        nmap[0] = npages;
+        if (map != NULL)
+        {
+            memcpy(nmap + 1, map + 1, pages / 8);
+        }
+        __atomic_store_n(&pagemap, PTR_TO_OFF(nmap), __ATOMIC_RELEASE);
+#ifndef MM_THREADS
+        if (map != NULL)
+        {
+            free_block(map);
+        }
+#endif
+        map = nmap;
+    }
+    if (on)
+    {
+        __atomic_fetch_or(&map[1 + page / 64], (uint64_t)1 << (page % 64), __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_fetch_and(&map[1 + page / 64], ~((uint64_t)1 << (page % 64)), __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/* 把 slab 挂到所在级别链表头 */
+static inline void slab_link(slab_t *s)
+{
+    uint32_t *head = (uint32_t *)(slab_heads + s->cls * WSIZE);
+
+    s->next = *head;
+    s->prev = 0;
+    if (*head != 0)
+    {
+        ((slab_t *)OFF_TO_PTR(*head))->prev = PTR_TO_OFF(s);
+    }
+    *head = PTR_TO_OFF(s);
+}
+
+static inline void slab_unlink(slab_t *s)
+{
+    uint32_t *head = (uint32_t *)(slab_heads + s->cls * WSIZE);
+
+    if (s->prev != 0)
+    {
+        ((slab_t *)OFF_TO_PTR(s->prev))->next = s->next;
+    }
+    else
+    {
+        *head = s->next;
+    }
+    if (s->next != 0)
+    {
+        ((slab_t *)OFF_TO_PTR(s->next))->prev = s->prev;
+    }
+}
+
+/*
+ * 从堆上取一块载荷按页对齐、大小恰为 SLAB_SIZE 的已分配块。先取一个足以容纳对齐
+ * 位置的空闲块，对齐位置前后的零头作为空闲块放回链表。
+ */
+static void *alloc_slab_block(void)
+{
+    size_t need = 2 * SLAB_SIZE + 2 * MIN_BLOCK_SIZE;
+    char *bp = find_fit(need);
+
+    if (bp == NULL && (bp = extend_heap(MAX(need, CHUNKSIZE) / WSIZE)) == NULL)
+    {
+        return NULL;
+    }
+    size_t csize = GET_SIZE(HDRP(bp));
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp)) ? 1 : 0;
+    size_t off = PTR_TO_OFF(bp);
+    size_t front = ((off + SLAB_SIZE - 1) & ~(size_t)(SLAB_SIZE - 1)) - off;
+    if (front != 0 && front < MIN_BLOCK_SIZE)
+    {
+        front += SLAB_SIZE;
+    }
+    size_t back = csize - front - SLAB_SIZE; /* need 保证 back >= MIN_BLOCK_SIZE */
+
+    remove_free(bp);
+    if (front != 0)
+    {
+        PUT(HDRP(bp), PACK(front, 0, prev_alloc));
+        PUT(FTRP(bp), PACK(front, 0, prev_alloc));
+        insert_free(bp);
+        prev_alloc = 0;
+    }
+    char *sp = bp + front;
+    PUT(HDRP(sp), PACK(SLAB_SIZE, 1, prev_alloc));
+    char *rest = NEXT_BLKP(sp);
+    PUT(HDRP(rest), PACK(back, 0, 1));
+    PUT(FTRP(rest), PACK(back, 0, 1));
+    insert_free(rest); /* 原块已合并过，rest 之后必是已分配块 */
+    return sp;
+}
+
+/* 新建 cls 级的 slab 并挂入链表 */
+static slab_t *slab_create(int cls)
+{
+    slab_t *s = alloc_slab_block();
+
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    if (pagemap_set(PTR_TO_OFF(s) >> SLAB_SHIFT, 1) < 0)
+    {
+        free_block(s);
+        return NULL;
+    }
+    s->size = class_size(cls);
+    s->cls = cls;
+    s->nobjs = SLAB_NOBJS(s->size);
+    s->nfree = s->nobjs;
+    for (int i = 0; i < SLAB_MAP_WORDS; i++)
+    {
+        int bits = MIN(64, MAX(0, (int)s->nobjs - i * 64));
+        s->freemap[i] = bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+    }
+    slab_link(s);
+    return s;
+}
+
+/* 从 cls 级分配一个对象：取链表头 slab，在位图中找第一个空闲位，调用者持有堆锁 */
+static void *slab_alloc(int cls)
+{
+    slab_t *s = OFF_TO_PTR(GET(slab_heads + cls * WSIZE));
+
+    if (s == NULL && (s = slab_create(cls)) == NULL)
+    {
+        return NULL;
+    }
+    int i = 0;
+    while (s->freemap[i] == 0)
+    {
+        i++;
+    }
+    int bit = __builtin_ctzll(s->freemap[i]);
+    s->freemap[i] &= s->freemap[i] - 1;
+    if (--s->nfree == 0)
+    {
+        slab_unlink(s); /* 满的 slab 不在链表上 */
+    }
+    return SLAB_OBJS(s) + (size_t)(i * 64 + bit) * s->size;
+}
+
+/* 归还对象；slab 变空且同级另有可用 slab 时整页还给堆，调用者持有堆锁 */
+static void slab_free(void *p)
+{
+    slab_t *s = slab_of(p);
+    size_t idx = ((char *)p - SLAB_OBJS(s)) / s->size;
+
+    s->freemap[idx / 64] |= (uint64_t)1 << (idx % 64);
+    if (s->nfree++ == 0)
+    {
+        slab_link(s);
+    }
+    if (s->nfree == s->nobjs && (s->next != 0 || s->prev != 0))
+    {
+        slab_unlink(s);
+        pagemap_set(PTR_TO_OFF(s) >> SLAB_SHIFT, 0);
+        free_block(s);
+    }
+}
+
+#ifdef MM_THREADS
+/* 取下 returned 上的全部批次并逐个释放，调用者持有堆锁 */
+static void drain_returned(void)
+{
+    uint32_t top = __atomic_exchange_n(&returned, 0, __ATOMIC_ACQUIRE);
+    char *batch = OFF_TO_PTR(top); /* 宏会对参数求值两次，先取出栈顶 */
+
+    while (batch != NULL)
+    {
+        char *bp = batch;
+        batch = NEXT_BATCH(batch);
+        while (bp != NULL)
+        {
+            char *next = NEXT_CACHED(bp); /* 释放会改写链接字，先取出 */
+            if (is_slab(bp))
+            {
+                slab_free(bp);
+            }
+            else
+            {
+                free_block(bp); /* 退出线程的缓存结构 */
+            }
+            bp = next;
+        }
+    }
+}
+
+/* 把以 head 开头的一批对象压入 returned，不取锁 */
+static void return_batch(char *head)
+{
+    uint32_t top = __atomic_load_n(&returned, __ATOMIC_RELAXED);
+
+    do
+    {
+        SET_NEXT_BATCH(head, top);
+    } while (!__atomic_compare_exchange_n(&returned, &top, PTR_TO_OFF(head), 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* 线程退出：各级缓存和缓存结构本身都交还中心堆 */
+static void tcache_exit(void *arg)
+{
+    tcache_t *tc = arg;
+
+    if (tc->epoch == heap_epoch)
+    {
+        for (int i = 0; i < (int)TCACHE_BINS; i++)
+        {
+            if (tc->heads[i] != 0)
+            {
+                return_batch(OFF_TO_PTR(tc->heads[i]));
+            }
+        }
+        SET_NEXT_CACHED(tc, NULL);
+        return_batch((char *)tc);
+    }
+    tcache = NULL;
+}
+
+static void tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/* 取本线程缓存，必要时在堆上新建；失败时返回 NULL，调用者退回中心堆 */
+static tcache_t *tcache_get(void)
+{
+    tcache_t *tc = tcache;
+
+    if (tc != NULL && tcache_epoch == heap_epoch)
+    {
+        return tc; /* 堆重建后旧指针已悬空，只比较线程局部的代号 */
+    }
+    pthread_once(&tcache_once, tcache_key_init);
+    lock_heap();
+    tc = alloc_block(adjust_block_size(sizeof(tcache_t)));
+    unlock_heap();
+    if (tc != NULL)
+    {
+        memset(tc, 0, sizeof(tcache_t));
+        tc->epoch = heap_epoch;
+        pthread_setspecific(tcache_key, tc);
+    }
+    tcache = tc;
+    tcache_epoch = heap_epoch;
+    return tc;
+}
+
+/* 从线程缓存分配；该级为空时加锁从 slab 补充一批 */
+static void *tcache_alloc(int cls)
+{
+    tcache_t *tc = tcache_get();
+    char *bp;
+
+    if (tc == NULL)
+    {
+        return NULL;
+    }
+    if (tc->heads[cls] == 0)
+    {
+        lock_heap();
+        for (int i = 0; i < TCACHE_BATCH && (bp = slab_alloc(cls)) != NULL; i++)
+        {
+            SET_NEXT_CACHED(bp, OFF_TO_PTR(tc->heads[cls]));
+            tc->heads[cls] = PTR_TO_OFF(bp);
+            tc->counts[cls]++;
+        }
+        unlock_heap();
+        if (tc->heads[cls] == 0)
+        {
+            return NULL;
+        }
+    }
+    bp = OFF_TO_PTR(tc->heads[cls]);
+    tc->heads[cls] = GET(bp);
+    tc->counts[cls]--;
+    return bp;
+}
+
+/* 对象放回线程缓存，返回 0 表示需直接归还 slab；过满时把前一半交还 */
+static int tcache_free(void *p, int cls)
+{
+    tcache_t *tc;
+
+    if ((tc = tcache_get()) == NULL)
+    {
+        return 0;
+    }
+    SET_NEXT_CACHED(p, OFF_TO_PTR(tc->heads[cls]));
+    tc->heads[cls] = PTR_TO_OFF(p);
+    if (++tc->counts[cls] > TCACHE_LIMIT)
+    {
+        char *last = p;
+        for (int i = 1; i < TCACHE_LIMIT / 2; i++)
+        {
+            last = NEXT_CACHED(last);
+        }
+        tc->heads[cls] = GET(last);
+        tc->counts[cls] -= TCACHE_LIMIT / 2;
+        SET_NEXT_CACHED(last, NULL);
+        return_batch(p);
+    }
+    return 1;
+}
+
+static inline void lock_heap(void)
+{
+    pthread_mutex_lock(&heap_lock);
+    if (__atomic_load_n(&returned, __ATOMIC_RELAXED) != 0)
+    {
+        drain_returned();
+    }
+}
+
+static inline void unlock_heap(void)
+{
+    pthread_mutex_unlock(&heap_lock);
+}
+#else
+static inline void lock_heap(void)
+{
+}
+
+static inline void unlock_heap(void)
+{
+}
+#endif
+
+/* 计算含头尾且按 8 对齐的块大小 */
+static inline size_t adjust_block_size(size_t size)
+{
+    size_t asize = ALIGN(size + WSIZE); /* 已分配块仅含头部开销 */
+    if (asize < MIN_BLOCK_SIZE)
+    {
+        asize = MIN_BLOCK_SIZE;
+    }
+    return asize;
+}
+
+/* 根据块大小选择对应的分离链表下标：[2^e, 2^(e+1)) 按次高位分为 2 级，从 16 字节起 */
+static inline int list_index(size_t size)
+{
+    int e = 63 - __builtin_clzl(size); /* size >= MIN_BLOCK_SIZE，故 e >= 4 */
+    int idx = ((e - 4) << LIST_SUB_BITS) +
+              (int)((size >> (e - LIST_SUB_BITS)) & ((1 << LIST_SUB_BITS) - 1));
+    if (idx >= LIST_MAX)
+        return LIST_MAX - 1;
+    return idx;
+}
+
+/* 将空闲块插入对应尺寸链表表头 */
+static inline void insert_free(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int idx = list_index(size);
+    uint32_t *head = (uint32_t *)(list_array + idx * WSIZE);
+
+    SET_NEXT_FREEP(bp, OFF_TO_PTR(*head));
+    SET_PREV_FREEP(bp, NULL);
+    if (*head != 0)
+    {
+        SET_PREV_FREEP(OFF_TO_PTR(*head), bp);
+    }
+    *head = PTR_TO_OFF(bp);
+    list_bitmap |= (uint64_t)1 << idx;
+}
+
+/* 将空闲块从链表中移除 */
+static inline void remove_free(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int idx = list_index(size);
+    uint32_t *head = (uint32_t *)(list_array + idx * WSIZE);
+    void *prev = PREV_FREEP(bp);
+    void *next = NEXT_FREEP(bp);
+
+    if (trim_lo != 0 && PTR_TO_OFF(bp) + size > trim_lo)
+    {
+        /* 堆顶块将被分配或拆分，已归还的页可能重新被写入；堆顶仍在使用，多保留一些 */
+        trim_lo = 0;
+        trim_pad = MIN(trim_pad * 2, TRIM_PAD_MAX);
+    }
+    if (prev)
+    {
+        SET_NEXT_FREEP(prev, next);
+    }
+    else
+    {
+        *head = PTR_TO_OFF(next);
+        if (next == NULL)
+        {
+            list_bitmap &= ~((uint64_t)1 << idx);
+        }
+    }
+    if (next)
+    {
+        SET_PREV_FREEP(next, prev);
+    }
+}
+
+/* 扩展堆并返回新空闲块 */
+static inline void *extend_heap(size_t words)
+{
+    size_t size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+    char *bp = mem_sbrk((int)size);
+    if (bp == (void *)-1)
+    {
+        return NULL;
+    }
+    /* 新块的前块状态由旧结尾头记录 */
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp)) ? 1 : 0;
+
+    PUT(HDRP(bp), PACK(size, 0, prev_alloc));
+    PUT(FTRP(bp), PACK(size, 0, prev_alloc));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 0)); /* 结尾块，前块空闲 */
+
+    return coalesce(bp);
+}
+
+/* 与相邻空闲块合并并重新入链 */
+static inline void *coalesce(void *bp)
+{
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    void *next_bp = NEXT_BLKP(bp);
+    size_t next_alloc = GET_ALLOC(HDRP(next_bp));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (!prev_alloc)
+    {
+        void *prev_bp = PREV_BLKP(bp);
+        size_t prev_size = GET_SIZE(HDRP(prev_bp));
+        remove_free(prev_bp);
+        size += prev_size;
+        bp = prev_bp;
+        prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    }
+
+    if (!next_alloc)
+    {
+        uint32_t trimmed = trim_lo, pad = trim_pad; /* 合并后仍是空闲块，已归还的页依旧有效 */
+        remove_free(next_bp);
+        trim_lo = trimmed;
+        trim_pad = pad;
+        size += GET_SIZE(HDRP(next_bp));
+    }
+
+    PUT(HDRP(bp), PACK(size, 0, prev_alloc ? 1 : 0));
+    PUT(FTRP(bp), PACK(size, 0, prev_alloc ? 1 : 0));
+    insert_free(bp);
+    set_next_prev_alloc(bp, 0);
+    return bp;
+}
+
+/*
+ * 分离链表内进行最佳匹配查找。只有起始链表里可能有小于 asize 的块；
+ * 它找不到时，位图给出的下一条非空链表中任何块都够大。
+ */
+static inline void *find_fit(size_t asize)
+{
+    uint64_t avail = list_bitmap & (~(uint64_t)0 << list_index(asize));
+    for (; avail != 0; avail &= avail - 1)
+    {
+        int i = __builtin_ctzll(avail);
+        void *best_bp = NULL;
+        size_t best_size = 0;
+        int count = 0;
+
+        for (char *bp = OFF_TO_PTR(GET(list_array + i * WSIZE)); bp != NULL; bp = NEXT_FREEP(bp))
+        {
+            size_t curr_size = GET_SIZE(HDRP(bp));
+            if (curr_size == asize)
+            {
+                return bp; /* 完美匹配 */
+            }
+            if (curr_size > asize)
+            {
                 if (!best_bp || curr_size < best_size)
                 {
                     best_bp = bp;
@@ -574,6 +1450,325 @@ static inline void set_next_prev_alloc(void *bp, int prev_alloc)
     }
 }
 
+/* === 区域分配 === */
+
+/*
+ * mm_arena_create - 新建一个区域，首块同时存放区域头。
+ */
+mm_arena_t *mm_arena_create(void)
+{
+    if (heap_listp == NULL)
+    {
+        if (lazy_init() == -1)
+        {
+            return NULL;
+        }
+    }
+
+    char *chunk = malloc(ARENA_CHUNK);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    mm_arena_t *a = (mm_arena_t *)(chunk + ARENA_HDR);
+    a->chunks = NULL;
+    arena_rewind(a);
+    return a;
+}
+
+/*
+ * mm_arena_alloc - 从区域中切出 size 字节，按 8 字节对齐。当前块不够时另取一块；
+ * 大请求单独成块，当前块的余量留给后续小请求。
+ */
+void *mm_arena_alloc(mm_arena_t *a, size_t size)
+{
+    size = ALIGN(size);
+    if (size == 0)
+    {
+        return NULL;
+    }
+    if (size <= a->end - a->cur)
+    {
+        void *p = OFF_TO_PTR(a->cur);
+        a->cur += size;
+        return p;
+    }
+
+    char *chunk = malloc(size > ARENA_BIG ? ARENA_HDR + size : ARENA_CHUNK);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    ARENA_NEXT(chunk) = a->chunks;
+    a->chunks = chunk;
+    if (size <= ARENA_BIG)
+    {
+        a->cur = PTR_TO_OFF(chunk + ARENA_HDR + size);
+        a->end = PTR_TO_OFF(chunk + GET_SIZE(HDRP(chunk)) - WSIZE);
+    }
+    return chunk + ARENA_HDR;
+}
+
+/*
+ * mm_arena_reset - 丢弃区域内的全部对象，只保留首块以便复用。
+ */
+void mm_arena_reset(mm_arena_t *a)
+{
+    arena_release(a);
+    arena_rewind(a);
+}
+
+/*
+ * mm_arena_destroy - 释放区域内的全部对象和区域本身。
+ */
+void mm_arena_destroy(mm_arena_t *a)
+{
+    arena_release(a);
+    free((char *)a - ARENA_HDR);
+}
+
+/* 当前块退回首块中区域头之后的部分 */
+static void arena_rewind(mm_arena_t *a)
+{
+    char *first = (char *)a - ARENA_HDR;
+
+    a->cur = PTR_TO_OFF((char *)a + ALIGN(sizeof(mm_arena_t)));
+    a->end = PTR_TO_OFF(first + GET_SIZE(HDRP(first)) - WSIZE);
+}
+
+/*
+ * 把首块之外的块逐个还给中心堆，只取一次锁。块从新到旧释放，相邻取得的块
+ * 在合并时连成一片。块都大于 SLAB_MAX，不会是 slab 对象；单独成块的大请求可能是 mmap 块。
+ */
+static void arena_release(mm_arena_t *a)
+{
+    char *chunk = a->chunks;
+
+    if (chunk == NULL)
+    {
+        return;
+    }
+    lock_heap();
+    while (chunk != NULL)
+    {
+        char *next = ARENA_NEXT(chunk);
+        prof_free(chunk);
+        if (MMAP_THRESHOLD && IS_MMAPPED(chunk))
+        {
+            munmap(chunk - MMAP_HDR, MMAP_LEN(chunk));
+        }
+        else
+        {
+            free_block(chunk);
+        }
+        chunk = next;
+    }
+#ifdef DEBUG
+    mm_checkheap(__LINE__);
+#endif
+    unlock_heap();
+    a->chunks = NULL;
+}
+
+/* === 分配统计 === */
+
+#ifdef MM_PROFILE
+/* 映射或清零统计块，调用者持有堆锁 */
+static void prof_reset(void)
+{
+    if (prof == NULL)
+    {
+        void *p = mmap(NULL, sizeof(prof_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            prof = p;
+        }
+        return;
+    }
+    memset(prof, 0, sizeof(prof_t));
+}
+
+/* 块的可用字节 */
+static inline size_t usable_size(void *bp)
+{
+    if (is_slab(bp))
+    {
+        return slab_of(bp)->size;
+    }
+    if (MMAP_THRESHOLD && IS_MMAPPED(bp))
+    {
+        return MMAP_LEN(bp) - MMAP_HDR;
+    }
+    return GET_SIZE(HDRP(bp)) - WSIZE;
+}
+
+/* 块占用的映射字节，非 mmap 块为 0 */
+static inline size_t mapped_len(void *bp)
+{
+    return (MMAP_THRESHOLD && !is_slab(bp) && IS_MMAPPED(bp)) ? MMAP_LEN(bp) : 0;
+}
+
+static inline int prof_class(size_t usable)
+{
+    return list_index(MAX(usable + WSIZE, MIN_BLOCK_SIZE));
+}
+
+/* 级别 i 的最小块大小，list_index 的逆 */
+static inline size_t prof_class_min(int i)
+{
+    return (size_t)((1 << LIST_SUB_BITS) + (i & ((1 << LIST_SUB_BITS) - 1)))
+           << ((i >> LIST_SUB_BITS) + 4 - LIST_SUB_BITS);
+}
+
+static inline void prof_max(uint64_t *peak, uint64_t v)
+{
+    uint64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(peak, &old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * 记录一次调用栈。采样间隔在 [PROF_INTERVAL/2, PROF_INTERVAL*3/2) 内随机取，
+ * 避免与周期性的分配模式同步；每条样本带请求大小，便于按字节加权。
+ */
+static void __attribute__((noinline)) prof_sample(size_t size)
+{
+    if (prof_seed == 0)
+    {
+        prof_seed = (uint32_t)(uintptr_t)&prof_seed | 1;
+    }
+    prof_seed ^= prof_seed << 13;
+    prof_seed ^= prof_seed >> 17;
+    prof_seed ^= prof_seed << 5;
+    prof_countdown = PROF_INTERVAL / 2 + prof_seed % PROF_INTERVAL;
+
+    if (prof_busy)
+    {
+        return;
+    }
+    prof_busy = 1;
+    uint64_t i = __atomic_fetch_add(&prof->nsamples, 1, __ATOMIC_RELAXED);
+    prof_sample_t *e = &prof->samples[i % PROF_SAMPLES];
+    e->size = size;
+    e->depth = backtrace(e->frames, PROF_DEPTH);
+    prof_busy = 0;
+}
+
+/* 在 malloc 返回前记账，bp 已是完整的已分配块 */
+static inline void prof_alloc(void *bp, size_t size)
+{
+    if (bp == NULL || prof == NULL)
+    {
+        return;
+    }
+    size_t n = usable_size(bp);
+    size_t len = mapped_len(bp);
+
+    __atomic_add_fetch(&prof->allocs[prof_class(n)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&prof->bytes, size, __ATOMIC_RELAXED);
+    prof_max(&prof->peak_live, __atomic_add_fetch(&prof->live, n, __ATOMIC_RELAXED));
+    prof_max(&prof->peak_footprint, mem_heapsize() + __atomic_add_fetch(&prof->mapped, len, __ATOMIC_RELAXED));
+
+    if ((prof_countdown -= (long)size) <= 0)
+    {
+        prof_sample(size);
+    }
+}
+
+/* 在块真正释放前记账 */
+static inline void prof_free(void *bp)
+{
+    if (prof == NULL)
+    {
+        return;
+    }
+    size_t n = usable_size(bp);
+
+    __atomic_add_fetch(&prof->frees[prof_class(n)], 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&prof->live, n, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&prof->mapped, mapped_len(bp), __ATOMIC_RELAXED);
+}
+
+/*
+ * 打印统计：占用与峰值、外部碎片率（1 - 最大空闲块 / 空闲总量，只计中心堆的空闲块）、
+ * 各级别的分配与释放次数，以及最近的采样调用栈。计数读取时不加锁，结果是近似快照。
+ */
+void mm_profile_dump(FILE *out)
+{
+    size_t free_bytes = 0, largest = 0, heap;
+    int nfree = 0;
+
+    if (prof == NULL)
+    {
+        fprintf(out, "mm profile: heap not initialized\n");
+        return;
+    }
+
+    lock_heap();
+    for (int i = 0; i < LIST_MAX; i++)
+    {
+        for (char *bp = OFF_TO_PTR(GET(list_array + i * WSIZE)); bp != NULL; bp = NEXT_FREEP(bp))
+        {
+            size_t size = GET_SIZE(HDRP(bp));
+            free_bytes += size;
+            largest = MAX(largest, size);
+            nfree++;
+        }
+    }
+    heap = mem_heapsize();
+    unlock_heap();
+
+    fprintf(out, "heap %zu KB, mapped %llu KB, peak footprint %llu KB\n", heap / 1024,
+            (unsigned long long)prof->mapped / 1024, (unsigned long long)prof->peak_footprint / 1024);
+    fprintf(out, "live %llu KB, peak live %llu KB, requested %llu KB in total\n",
+            (unsigned long long)prof->live / 1024, (unsigned long long)prof->peak_live / 1024,
+            (unsigned long long)prof->bytes / 1024);
+    fprintf(out, "free %zu KB in %d blocks, largest %zu KB, external fragmentation %.1f%%\n",
+            free_bytes / 1024, nfree, largest / 1024,
+            free_bytes ? 100.0 * (1.0 - (double)largest / free_bytes) : 0.0);
+
+    fprintf(out, "%5s %10s %12s %12s %12s\n", "class", "block", "allocs", "frees", "live");
+    for (int i = 0; i < LIST_MAX; i++)
+    {
+        uint64_t a = prof->allocs[i], f = prof->frees[i];
+        if (a != 0)
+        {
+            fprintf(out, "%5d %9zu+ %12llu %12llu %12lld\n", i, prof_class_min(i),
+                    (unsigned long long)a, (unsigned long long)f, (long long)(a - f));
+        }
+    }
+
+    uint64_t n = prof->nsamples;
+    fprintf(out, "%llu sampled allocations, one per ~%d bytes; newest %d:\n",
+            (unsigned long long)n, PROF_INTERVAL, (int)MIN(n, PROF_SAMPLES));
+    for (uint64_t k = n > PROF_SAMPLES ? n - PROF_SAMPLES : 0; k < n; k++)
+    {
+        prof_sample_t *e = &prof->samples[k % PROF_SAMPLES];
+        fprintf(out, "sample %llu: size %zu\n", (unsigned long long)k, e->size);
+        fflush(out);
+        backtrace_symbols_fd(e->frames + 1, e->depth - 1, fileno(out)); /* 跳过 prof_sample 本身 */
+    }
+    fflush(out);
+}
+#else
+static void prof_reset(void)
+{
+}
+
+static inline void prof_alloc(void *bp, size_t size)
+{
+}
+
+static inline void prof_free(void *bp)
+{
+}
+
+void mm_profile_dump(FILE *out)
+{
+    fprintf(out, "mm profile: built without -DMM_PROFILE\n");
+}
+#endif
+
 /* === 检查函数 === */
 
 /*
@@ -631,6 +1826,10 @@ static inline int check_free_lists(int lineno)
     int count = 0;
     for (int i = 0; i < LIST_MAX; i++)
     {
+        if (!(list_bitmap >> i & 1) != !GET(list_array + i * WSIZE))
+        {
+            heap_error(lineno, "Free List Error: list bitmap disagrees with list head");
+        }
         for (char *bp = OFF_TO_PTR(GET(list_array + i * WSIZE)); bp != NULL; bp = NEXT_FREEP(bp))
         {
             count++;
@@ -660,6 +1859,34 @@ static inline int check_free_lists(int lineno)
     return count;
 }
 
+/* 遍历各级 slab 链表，校验页位图、空闲计数与级别 */
+static inline void check_slabs(int lineno)
+{
+    for (int i = 0; i < SLAB_CLASSES; i++)
+    {
+        for (slab_t *s = OFF_TO_PTR(GET(slab_heads + i * WSIZE)); s != NULL; s = OFF_TO_PTR(s->next))
+        {
+            int nfree = 0;
+            if (!is_slab(s) || GET_SIZE(HDRP(s)) != SLAB_SIZE || !GET_ALLOC(HDRP(s)))
+            {
+                heap_error(lineno, "Slab Error: listed slab is not a slab page");
+            }
+            if (s->cls != i || s->size != class_size(i))
+            {
+                heap_error(lineno, "Slab Error: slab in wrong size class");
+            }
+            for (int w = 0; w < SLAB_MAP_WORDS; w++)
+            {
+                nfree += __builtin_popcountll(s->freemap[w]);
+            }
+            if (nfree != s->nfree || nfree == 0 || nfree > s->nobjs)
+            {
+                heap_error(lineno, "Slab Error: free count disagrees with bitmap");
+            }
+        }
+    }
+}
+
 /* 检查前言与结尾块结构 */
 static inline void check_prologue_epilogue(int lineno)
 {
@@ -0,0 +1,26 @@
+/*
+ * mm_ext.h - mm.c 在实验接口 mm.h 之外提供的扩展接口
+ */
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stdio.h>
+
+/*
+ * 区域分配：对象从区域中顺序切出，不能单独 free/realloc，随 mm_arena_reset 或
+ * mm_arena_destroy 一起释放。一个区域同一时刻只应由一个线程使用。
+ */
+typedef struct mm_arena mm_arena_t;
+
+mm_arena_t *mm_arena_create(void);
+void *mm_arena_alloc(mm_arena_t *a, size_t size);
+void mm_arena_reset(mm_arena_t *a);
+void mm_arena_destroy(mm_arena_t *a);
+
+/*
+ * 打印分配统计：堆与映射占用及峰值、外部碎片率、各尺寸级别的分配/释放次数和采样
+ * 调用栈。需以 -DMM_PROFILE 编译 mm.c，否则只打印一行提示。
+ */
+void mm_profile_dump(FILE *out);
+
+#endif
@@ -0,0 +1,678 @@
+/* mmbench.c
+ *
+ * 分配器回放基准：读取 .rep trace 或生成合成 trace，单线程或多线程回放，报告吞吐量、
+ * 峰值利用率和 malloc/free/realloc 各自的平均周期数。
+ *
+ * 说明：
+ *
+ * trace 格式与 mdriver、trace-freq.py 相同：非字母开头的行（文件头）忽略，其余为
+ * "a <id> <size>"、"f <id>"、"r <id> <size>"。释放不存在的 id 时跳过，realloc 不存在
+ * 的 id 视为 malloc。
+ *
+ * 合成 trace（-g，可多次给出）：
+ *   zipf      尺寸服从 Zipf 分布，存活集维持在 ZIPF_LIVE 个对象附近，随机释放；
+ *   prodcons  生产者成批分配、消费者按先进先出成批释放，队列深度不超过 QUEUE_DEPTH；
+ *   realloc   一组缓冲区按 1.5 倍或小步追加增长到随机上限后释放，穿插小对象分配。
+ *
+ * 每个 trace 先回放 -r 次取最短用时计算吞吐量（不做任何测量），再插桩回放一次：逐个
+ * 操作读周期计数器，并跟踪在用载荷的峰值。利用率按 mdriver 的定义，为载荷峰值除以
+ * 回放结束时的堆大小。-t N 时 N 个线程各自独立回放同一 trace，共用一个堆，吞吐量按
+ * 全部线程的操作数计；此时 mm.c 必须以 -DMM_THREADS 编译。多线程的在用载荷是各线程
+ * 之和，释放前先扣除、分配返回后才计入，所以只会偏低。
+ *
+ * 在解开的 malloclab-handout 目录中编译（memlib.c 与 mm.h 来自 handout）：
+ *
+ *   gcc -O2 -g -DDRIVER -std=gnu99 -pthread mmbench.c mm.c memlib.c -lm -o mmbench
+ *
+ * 这样编出的 mm.c 与 mdriver 测的相同：-DDRIVER 把 MMAP_THRESHOLD、TRIM_THRESHOLD 置 0，
+ * 所有请求都在模拟堆内，不走大块 mmap/mremap 和堆顶归还，利用率可与 mdriver 对照。
+ * 要测这两条路径，另编一份恢复默认阈值的版本：
+ *
+ *   gcc -O2 -g -DDRIVER -DMMAP_THRESHOLD='(128*1024)' -DTRIM_THRESHOLD='(128*1024)' \
+ *       -std=gnu99 -pthread mmbench.c mm.c memlib.c -lm -o mmbench-mmap
+ *
+ * 此时映射块不在模拟堆内，利用率只统计堆内的载荷。
+ *
+ * 加 -DMM_THREADS 得到可多线程回放的版本，加 -DMM_PROFILE 后可用 -p 打印分配统计。
+ *
+ * 用法：mmbench [-t 线程数] [-r 次数] [-n 操作数] [-s 种子] [-g 类型]... [-w 文件] [-p] [trace.rep ...]
+ */
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "mm.h"
+#include "mm_ext.h"
+#include "memlib.h"
+
+#define ZIPF_RANKS 512       /* Zipf 尺寸的档数，第 k 档为 16k 字节 */
+#define ZIPF_S 1.1           /* Zipf 指数 */
+#define ZIPF_LIVE 4096       /* zipf trace 的目标存活对象数 */
+#define QUEUE_DEPTH 2048     /* prodcons trace 的队列上限 */
+#define BURST 32             /* prodcons 单批的最大对象数 */
+#define GROW_BUFS 64         /* realloc trace 同时增长的缓冲区数 */
+#define GROW_MAX (256 << 10) /* 缓冲区增长上限的最大值 */
+#define SMALL_LIVE 1024      /* realloc trace 中穿插的小对象数 */
+
+enum { OP_ALLOC, OP_FREE, OP_REALLOC, OP_KINDS };
+
+typedef struct
+{
+    int type;
+    int id;
+    size_t size;
+} op_t;
+
+typedef struct
+{
+    char name[64];
+    op_t *ops;
+    int nops, cap;
+    int nids;
+} trace_t;
+
+/* 每个回放线程的参数与结果 */
+typedef struct
+{
+    const trace_t *trace;
+    int instrument;
+    double start, end;           /* 线程自己计时，主线程放行后未必先于它们运行 */
+    uint64_t cycles[OP_KINDS];
+    uint64_t count[OP_KINDS];
+} worker_t;
+
+static pthread_barrier_t start_line;
+static size_t live_bytes, peak_bytes;  /* 插桩回放时全部线程的在用载荷 */
+static uint64_t tsc_overhead;          /* 一对空计时的周期数，从每次测量中扣除 */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+static double zipf_cdf[ZIPF_RANKS];
+
+/* 周期计数器；非 x86 平台退化为纳秒 */
+static inline uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift64* */
+static uint64_t rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static double rnd01(void)
+{
+    return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size); /* 基准自身的内存取自 libc，被测分配器只经 mm_malloc 等调用 */
+    if (p == NULL)
+    {
+        fprintf(stderr, "mmbench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* === trace 的读取、生成与保存 === */
+
+static void push_op(trace_t *t, int type, int id, size_t size)
+{
+    if (t->nops == t->cap)
+    {
+        t->cap = t->cap ? t->cap * 2 : 1024;
+        op_t *ops = xmalloc(t->cap * sizeof(op_t));
+        if (t->ops != NULL)
+        {
+            memcpy(ops, t->ops, t->nops * sizeof(op_t));
+            free(t->ops);
+        }
+        t->ops = ops;
+    }
+    t->ops[t->nops].type = type;
+    t->ops[t->nops].id = id;
+    t->ops[t->nops].size = size;
+    t->nops++;
+    if (id >= t->nids)
+    {
+        t->nids = id + 1;
+    }
+}
+
+static int read_trace(const char *path, trace_t *t)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+
+    if (f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    const char *base = strrchr(path, '/');
+    snprintf(t->name, sizeof(t->name), "%s", base ? base + 1 : path);
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        char c;
+        int id;
+        size_t size = 0;
+
+        /* 与 trace-freq.py 一致：忽略非字母开头的行 */
+        if (!((line[0] >= 'a' && line[0] <= 'z') || (line[0] >= 'A' && line[0] <= 'Z')))
+        {
+            continue;
+        }
+        if (sscanf(line, "%c %d %zu", &c, &id, &size) < 2 || id < 0)
+        {
+            continue;
+        }
+        if (c == 'a')
+        {
+            push_op(t, OP_ALLOC, id, size);
+        }
+        else if (c == 'f')
+        {
+            push_op(t, OP_FREE, id, 0);
+        }
+        else if (c == 'r')
+        {
+            push_op(t, OP_REALLOC, id, size);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static void write_trace(const char *path, const trace_t *t)
+{
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL)
+    {
+        perror(path);
+        return;
+    }
+    fprintf(f, "0\n%d\n%d\n1\n", t->nids, t->nops); /* 堆大小建议、id 数、操作数、权重 */
+    for (int i = 0; i < t->nops; i++)
+    {
+        const op_t *op = &t->ops[i];
+        if (op->type == OP_FREE)
+        {
+            fprintf(f, "f %d\n", op->id);
+        }
+        else
+        {
+            fprintf(f, "%c %d %zu\n", op->type == OP_ALLOC ? 'a' : 'r', op->id, op->size);
+        }
+    }
+    fclose(f);
+}
+
+static void zipf_init(void)
+{
+    double sum = 0;
+
+    for (int k = 0; k < ZIPF_RANKS; k++)
+    {
+        sum += 1.0 / pow(k + 1, ZIPF_S);
+        zipf_cdf[k] = sum;
+    }
+    for (int k = 0; k < ZIPF_RANKS; k++)
+    {
+        zipf_cdf[k] /= sum;
+    }
+}
+
+static size_t zipf_size(void)
+{
+    double u = rnd01();
+    int lo = 0, hi = ZIPF_RANKS - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (size_t)(lo + 1) * 16;
+}
+
+/* 存活集随机增减，空出的 id 复用 */
+static void gen_zipf(trace_t *t, int nops)
+{
+    int *ids = xmalloc(ZIPF_LIVE * sizeof(int)); /* 前 nlive 个在用，其余空闲 */
+    int nlive = 0;
+
+    for (int i = 0; i < ZIPF_LIVE; i++)
+    {
+        ids[i] = i;
+    }
+    for (int i = 0; i < nops; i++)
+    {
+        if (nlive == 0 || (nlive < ZIPF_LIVE && rnd01() < 0.55))
+        {
+            push_op(t, OP_ALLOC, ids[nlive++], zipf_size());
+        }
+        else
+        {
+            int k = rnd() % nlive;
+            int id = ids[k];
+            push_op(t, OP_FREE, id, 0);
+            ids[k] = ids[--nlive];
+            ids[nlive] = id;
+        }
+    }
+    while (nlive > 0)
+    {
+        push_op(t, OP_FREE, ids[--nlive], 0);
+    }
+    free(ids);
+}
+
+/* 环形队列：队尾成批分配，队首成批释放 */
+static void gen_prodcons(trace_t *t, int nops)
+{
+    int head = 0, tail = 0; /* 队首与队尾的序号，id 为序号对队列深度取模 */
+
+    while (t->nops < nops)
+    {
+        int n = 1 + rnd() % BURST;
+        if (rnd() & 1)
+        {
+            for (; n > 0 && tail - head < QUEUE_DEPTH; n--, tail++)
+            {
+                push_op(t, OP_ALLOC, tail % QUEUE_DEPTH, zipf_size());
+            }
+        }
+        else
+        {
+            for (; n > 0 && head < tail; n--, head++)
+            {
+                push_op(t, OP_FREE, head % QUEUE_DEPTH, 0);
+            }
+        }
+    }
+    for (; head < tail; head++)
+    {
+        push_op(t, OP_FREE, head % QUEUE_DEPTH, 0);
+    }
+}
+
+/* 缓冲区占 id 0..GROW_BUFS-1，小对象占其后的 SMALL_LIVE 个 id */
+static void gen_realloc(trace_t *t, int nops)
+{
+    size_t size[GROW_BUFS], limit[GROW_BUFS];
+    char small[SMALL_LIVE];
+
+    memset(size, 0, sizeof(size));
+    memset(small, 0, sizeof(small));
+    while (t->nops < nops)
+    {
+        if (rnd01() < 0.3)
+        {
+            int k = rnd() % SMALL_LIVE;
+            push_op(t, small[k] ? OP_FREE : OP_ALLOC, GROW_BUFS + k, small[k] ? 0 : zipf_size());
+            small[k] = !small[k];
+            continue;
+        }
+
+        int b = rnd() % GROW_BUFS;
+        if (size[b] == 0)
+        {
+            size[b] = 16 + rnd() % 240;
+            limit[b] = 1024 + rnd() % GROW_MAX;
+            push_op(t, OP_ALLOC, b, size[b]);
+        }
+        else if (size[b] >= limit[b])
+        {
+            push_op(t, OP_FREE, b, 0);
+            size[b] = 0;
+        }
+        else
+        {
+            /* 一半按 1.5 倍扩容（向量），一半小步追加（字符串拼接） */
+            size[b] = (rnd() & 1) ? size[b] * 3 / 2 : size[b] + 1 + rnd() % 64;
+            push_op(t, OP_REALLOC, b, size[b]);
+        }
+    }
+    for (int b = 0; b < GROW_BUFS; b++)
+    {
+        if (size[b] != 0)
+        {
+            push_op(t, OP_FREE, b, 0);
+        }
+    }
+    for (int k = 0; k < SMALL_LIVE; k++)
+    {
+        if (small[k])
+        {
+            push_op(t, OP_FREE, GROW_BUFS + k, 0);
+        }
+    }
+}
+
+static int generate(const char *kind, int nops, trace_t *t)
+{
+    snprintf(t->name, sizeof(t->name), "%s (synthetic)", kind);
+    if (strcmp(kind, "zipf") == 0)
+    {
+        gen_zipf(t, nops);
+    }
+    else if (strcmp(kind, "prodcons") == 0)
+    {
+        gen_prodcons(t, nops);
+    }
+    else if (strcmp(kind, "realloc") == 0)
+    {
+        gen_realloc(t, nops);
+    }
+    else
+    {
+        fprintf(stderr, "mmbench: unknown trace kind '%s' (zipf, prodcons, realloc)\n", kind);
+        return -1;
+    }
+    return 0;
+}
+
+/* === 回放 === */
+
+/* 载荷是否在模拟堆内；单独映射的大块不计入利用率 */
+static inline int in_heap(const char *p)
+{
+    return p != NULL && p >= (char *)mem_heap_lo() && p <= (char *)mem_heap_hi();
+}
+
+static inline void track_live(size_t add, size_t sub)
+{
+    size_t v = __atomic_add_fetch(&live_bytes, add - sub, __ATOMIC_RELAXED);
+    size_t old = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(&peak_bytes, &old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void *replay(void *arg)
+{
+    worker_t *w = arg;
+    const trace_t *t = w->trace;
+    char **ptr = xmalloc(t->nids * sizeof(char *));
+    size_t *size = xmalloc(t->nids * sizeof(size_t));
+
+    memset(ptr, 0, t->nids * sizeof(char *));
+    memset(size, 0, t->nids * sizeof(size_t));
+    pthread_barrier_wait(&start_line);
+    w->start = now();
+
+    for (int i = 0; i < t->nops; i++)
+    {
+        const op_t *op = &t->ops[i];
+        int id = op->id;
+
+        /*
+         * 旧尺寸在调用前扣除、新尺寸在返回后计入：块一释放就可能被别的线程复用并先计入，
+         * 这样共享计数只会偏低，多线程时利用率不会超过 100%
+         */
+        if (w->instrument && op->type != OP_ALLOC && size[id] != 0)
+        {
+            track_live(0, size[id]);
+            size[id] = 0;
+        }
+        uint64_t c0 = w->instrument ? cycles() : 0;
+
+        switch (op->type)
+        {
+        case OP_ALLOC:
+            if (ptr[id] != NULL)
+            {
+                continue; /* trace 中重复分配同一 id，视为无效操作 */
+            }
+            ptr[id] = mm_malloc(op->size);
+            break;
+        case OP_FREE:
+            if (ptr[id] == NULL)
+            {
+                continue;
+            }
+            mm_free(ptr[id]);
+            ptr[id] = NULL;
+            break;
+        default:
+            ptr[id] = mm_realloc(ptr[id], op->size);
+            break;
+        }
+
+        if (w->instrument)
+        {
+            uint64_t c = cycles() - c0;
+            w->cycles[op->type] += c > tsc_overhead ? c - tsc_overhead : 0;
+            w->count[op->type]++;
+            size[id] = in_heap(ptr[id]) ? op->size : 0;
+            track_live(size[id], 0);
+        }
+        if (ptr[id] != NULL && op->size != 0)
+        {
+            ptr[id][0] = (char)id; /* 触及载荷，让缺页计入分配成本 */
+        }
+    }
+
+    /* 收尾释放同样先扣除：其他线程可能还在回放，会复用这些块 */
+    for (int id = 0; id < t->nids; id++)
+    {
+        if (ptr[id] != NULL)
+        {
+            if (w->instrument)
+            {
+                track_live(0, size[id]);
+            }
+            mm_free(ptr[id]);
+        }
+    }
+    w->end = now();
+    free(ptr);
+    free(size);
+    return NULL;
+}
+
+/* 在新堆上用 nthreads 个线程回放一遍，返回从最早开始到最晚结束的秒数 */
+static double run(const trace_t *t, int nthreads, int instrument, worker_t *w)
+{
+    pthread_t tid[nthreads];
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+    {
+        fprintf(stderr, "mmbench: mm_init failed\n");
+        exit(1);
+    }
+    live_bytes = peak_bytes = 0;
+    pthread_barrier_init(&start_line, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; i++)
+    {
+        memset(&w[i], 0, sizeof(worker_t));
+        w[i].trace = t;
+        w[i].instrument = instrument;
+        pthread_create(&tid[i], NULL, replay, &w[i]);
+    }
+    pthread_barrier_wait(&start_line);
+    double start = 0, end = 0;
+    for (int i = 0; i < nthreads; i++)
+    {
+        pthread_join(tid[i], NULL);
+        start = (i == 0 || w[i].start < start) ? w[i].start : start;
+        end = w[i].end > end ? w[i].end : end;
+    }
+    pthread_barrier_destroy(&start_line);
+    return end - start;
+}
+
+static void bench(const trace_t *t, int nthreads, int reps, int profile)
+{
+    worker_t w[nthreads];
+    double best = 0;
+    uint64_t cyc[OP_KINDS] = {0}, cnt[OP_KINDS] = {0};
+
+    for (int r = 0; r < reps; r++)
+    {
+        double s = run(t, nthreads, 0, w);
+        if (r == 0 || s < best)
+        {
+            best = s;
+        }
+    }
+
+    /* 插桩回放在最后，使 -p 的统计与利用率对应同一次回放 */
+    run(t, nthreads, 1, w);
+    for (int i = 0; i < nthreads; i++)
+    {
+        for (int k = 0; k < OP_KINDS; k++)
+        {
+            cyc[k] += w[i].cycles[k];
+            cnt[k] += w[i].count[k];
+        }
+    }
+
+    double util = mem_heapsize() ? 100.0 * peak_bytes / mem_heapsize() : 0;
+    printf("%-24s %9d %3d %10.2f %7.1f%%", t->name, t->nops, nthreads,
+           (double)t->nops * nthreads / best / 1e6, util);
+    for (int k = 0; k < OP_KINDS; k++)
+    {
+        if (cnt[k] != 0)
+        {
+            printf(" %9.0f", (double)cyc[k] / cnt[k]);
+        }
+        else
+        {
+            printf(" %9s", "-");
+        }
+    }
+    printf("\n");
+    if (profile)
+    {
+        mm_profile_dump(stdout);
+    }
+}
+
+static void calibrate(void)
+{
+    tsc_overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t c0 = cycles();
+        uint64_t c = cycles() - c0;
+        if (c < tsc_overhead)
+        {
+            tsc_overhead = c;
+        }
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: mmbench [-t threads] [-r reps] [-n ops] [-s seed] [-g kind]... [-w file] [-p] [trace.rep ...]\n"
+            "  -t N      replay with N threads sharing the heap (mm.c needs -DMM_THREADS)\n"
+            "  -r N      timed replays per trace, best one counts (default 3)\n"
+            "  -g KIND   add a synthetic trace: zipf, prodcons or realloc\n"
+            "  -n N      operations per synthetic trace (default 100000)\n"
+            "  -s SEED   seed for synthetic traces\n"
+            "  -w FILE   save the last synthetic trace to FILE in .rep format\n"
+            "  -p        print mm_profile_dump after each trace (mm.c needs -DMM_PROFILE)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int nthreads = 1, reps = 3, nops = 100000, profile = 0, ntraces = 0, c;
+    const char *kinds[16], *save = NULL;
+    int nkinds = 0;
+
+    while ((c = getopt(argc, argv, "t:r:n:s:g:w:p")) != -1)
+    {
+        switch (c)
+        {
+        case 't': nthreads = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        case 'n': nops = atoi(optarg); break;
+        case 's': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+        case 'g':
+            if (nkinds == (int)(sizeof(kinds) / sizeof(kinds[0])))
+            {
+                usage();
+            }
+            kinds[nkinds++] = optarg;
+            break;
+        case 'w': save = optarg; break;
+        case 'p': profile = 1; break;
+        default: usage();
+        }
+    }
+    if (nthreads < 1 || reps < 1 || nops < 1 || (nkinds == 0 && optind == argc))
+    {
+        usage();
+    }
+
+    trace_t *traces = xmalloc((nkinds + argc - optind) * sizeof(trace_t));
+    memset(traces, 0, (nkinds + argc - optind) * sizeof(trace_t));
+    zipf_init();
+    for (int i = 0; i < nkinds; i++)
+    {
+        if (generate(kinds[i], nops, &traces[ntraces]) < 0)
+        {
+            return 1;
+        }
+        if (save != NULL && i == nkinds - 1)
+        {
+            write_trace(save, &traces[ntraces]);
+        }
+        ntraces++;
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        if (read_trace(argv[i], &traces[ntraces]) == 0)
+        {
+            ntraces++;
+        }
+    }
+
+    mem_init();
+    calibrate();
+    printf("%-24s %9s %3s %10s %8s %9s %9s %9s\n", "trace", "ops", "thr", "Mops/s", "util",
+           "malloc", "free", "realloc");
+    printf("%-24s %9s %3s %10s %8s %29s\n", "", "", "", "", "", "(cycles per call)");
+    for (int i = 0; i < ntraces; i++)
+    {
+        bench(&traces[i], nthreads, reps, profile);
+    }
+    return 0;
+}
@@ -1,125 +1,299 @@
 #include "cache.h"
+#include "disk.h"
+#include "policy.h"
+#include "sketch.h"
+#include "stats.h"
 
 static Cache cache;
-static int read_cnt;
-static sem_t mutex, w;
+static int max_entries = DEFAULT_CACHE_ENTRIES;
+static long max_bytes = DEFAULT_CACHE_SIZE;
+static int max_workers = 1;
+static Policy *policy = &policy_clock;
+static int admit_filter = 0; /* gate inserts on the frequency sketch */
+static int use_sketch = 0;   /* admission or GDSF reads the sketch */
+
+/*
+ * Set the total entry and byte budget and how many threads may use the
+ * cache at once; call before cache_init()
+ */
+void cache_config(int entries, long bytes, int workers) {
+    if (entries > 0) max_entries = entries;
+    if (bytes > 0) max_bytes = bytes;
+    if (workers > 0) max_workers = workers;
+}
+
+/*
+ * Pick the eviction policy by name and whether new objects must be
+ * accessed at least as often as the block they would evict to get in.
+ * Returns -1 for an unknown policy. Call before cache_init().
+ */
+int cache_policy(char *name, int admit) {
+    Policy *p = policy_find(name);
+
+    if (p == NULL) return -1;
+    policy = p;
+    admit_filter = admit;
+    return 0;
+}
+
+/* FNV-1a; the low bits pick the bucket, the high bits pick the shard */
+static unsigned int hash_uri(char *url) {
+    unsigned int h = 2166136261u;
+    while (*url) {
+        h ^= (unsigned char)*url++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static Shard *shard_of(unsigned int hash) {
+    return &cache.shards[(hash >> 24) & (cache.nshards - 1)];
+}
 
 void cache_init() {
-    cache.num = 0;
-    read_cnt = 0;
-    Sem_init(&mutex, 0, 1);
-    Sem_init(&w, 0, 1);
-    for (int i = 0; i < MAX_CACHE; i++) {
-        cache.data[i].isEmpty = 1;
-        cache.data[i].lru_cnt = 0;
+    int n = 1;
+
+    /*
+     * Give every worker two stripes to spread over, as long as each shard
+     * can still hold one maximum-size object; past that, use as many as
+     * the budget allows while every shard holds a few of them and a few
+     * entries. So the default 1 MiB budget is striped too, at the cost of
+     * a shard holding only one or two of the largest objects.
+     */
+    while (n < MAX_SHARDS &&
+           max_bytes / (n * 2) >= MAX_OBJECT_SIZE &&
+           max_entries / (n * 2) >= 1 &&
+           (n < 2 * max_workers ||
+            (max_bytes / (n * 2) >= 4L * MAX_OBJECT_SIZE &&
+             max_entries / (n * 2) >= 4))) {
+        n *= 2;
+    }
+    cache.nshards = n;
+
+    for (int i = 0; i < n; i++) {
+        Shard *s = &cache.shards[i];
+        unsigned int nbuckets = 1;
+
+        s->max_num = max_entries / n;
+        s->max_bytes = max_bytes / n;
+        while (nbuckets < (unsigned int)s->max_num) {
+            nbuckets <<= 1;
+        }
+        s->buckets = Calloc(nbuckets, sizeof(Block *));
+        s->mask = nbuckets - 1;
+        s->num = 0;
+        s->bytes = 0;
+        s->read_cnt = 0;
+        Sem_init(&s->mutex, 0, 1);
+        Sem_init(&s->w, 0, 1);
+        Sem_init(&s->hit_mutex, 0, 1);
+        policy->init(s);
+    }
+    use_sketch = admit_filter || policy == &policy_gdsf;
+    if (use_sketch) {
+        sketch_init(max_entries);
     }
 }
 
-static void reader_lock() {
-    P(&mutex);
-    read_cnt++;
-    if (read_cnt == 1) {
-        P(&w);
+static void reader_lock(Shard *s) {
+    P(&s->mutex);
+    s->read_cnt++;
+    if (s->read_cnt == 1) {
+        P(&s->w);
     }
-    V(&mutex);
+    V(&s->mutex);
 }
 
-static void reader_unlock() {
-    P(&mutex);
-    read_cnt--;
-    if (read_cnt == 0) {
-        V(&w);
+static void reader_unlock(Shard *s) {
+    P(&s->mutex);
+    s->read_cnt--;
+    if (s->read_cnt == 0) {
+        V(&s->w);
     }
-    V(&mutex);
+    V(&s->mutex);
 }
 
-static void writer_lock() {
-    P(&w);
+static void writer_lock(Shard *s) {
+    P(&s->w);
 }
 
-static void writer_unlock() {
-    V(&w);
+static void writer_unlock(Shard *s) {
+    V(&s->w);
 }
 
-int cache_find(char *url, char *buf, int *size) {
-    int found = 0;
-    reader_lock();
-    for (int i = 0; i < MAX_CACHE; i++) {
-        if (!cache.data[i].isEmpty && strcmp(cache.data[i].uri, url) == 0) {
-            memcpy(buf, cache.data[i].obj, cache.data[i].size);
-            *size = cache.data[i].size;
-            found = 1;
-            break;
-        }
+static Block **lookup(Shard *s, char *url, unsigned int hash) {
+    Block **pp = &s->buckets[hash & s->mask];
+    while (*pp && ((*pp)->hash != hash || strcmp((*pp)->uri, url) != 0)) {
+        pp = &(*pp)->next;
     }
-    reader_unlock();
-    
-    if (found) {
-        // Update LRU - this is a write operation on metadata
-        writer_lock();
-        // Re-find the index because state might have changed (though unlikely to be evicted that fast)
-        // But to be safe and simple, we just iterate again.
-        for (int i = 0; i < MAX_CACHE; i++) {
-             if (!cache.data[i].isEmpty && strcmp(cache.data[i].uri, url) == 0) {
-                 cache.data[i].lru_cnt = 0;
-                 for(int j = 0; j < MAX_CACHE; j++) {
-                    if(j != i && !cache.data[j].isEmpty) {
-                        cache.data[j].lru_cnt++;
-                    }
-                 }
-                 break;
-             }
-        }
-        writer_unlock();
-        return 1;
+    return pp;
+}
+
+void cache_release(Object *obj) {
+    if (__atomic_sub_fetch(&obj->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        Free(obj);
     }
-    
-    return 0;
 }
 
-void cache_add(char *url, char *buf, int size) {
-    if (size > MAX_OBJECT_SIZE) return;
+static Block *unlink_block(Shard *s, Block **pp) {
+    Block *b = *pp;
+    *pp = b->next;
+    policy->remove(s, b);
+    s->num--;
+    s->bytes -= b->size;
+    return b;
+}
 
-    writer_lock();
+static void free_block(Block *b) {
+    cache_release(b->obj);
+    Free(b->uri);
+    Free(b);
+}
 
-    int victim = -1;
-    int max_lru = -1;
+static Block *evict(Shard *s) {
+    Block *b = policy->victim(s);
 
-    if (cache.num < MAX_CACHE) {
-        for (int i = 0; i < MAX_CACHE; i++) {
-            if (cache.data[i].isEmpty) {
-                victim = i;
-                break;
-            }
-        }
+    stats_count(CTR_EVICTIONS, 1);
+    return unlink_block(s, lookup(s, b->uri, b->hash));
+}
+
+/*
+ * TinyLFU admission: an object that forces evictions gets in only if it
+ * is requested at least as often as each block it would replace, so a
+ * scan of one-off objects can't flush the hot set, nor can one large
+ * object push out several hotter small ones. Ties admit.
+ */
+static int admit(Shard *s, unsigned int hash) {
+    return sketch_estimate(hash) >= sketch_estimate(policy->peek(s)->hash);
+}
+
+/* Spill evicted blocks to the disk tier, outside the shard lock */
+static void spill_all(Block *spill) {
+    Block *b;
+
+    for (; spill; spill = b) {
+        b = spill->next;
+        disk_put(spill->uri, spill->hash, spill->obj->data, spill->size);
+        free_block(spill);
     }
+}
 
-    if (victim == -1) {
-        for (int i = 0; i < MAX_CACHE; i++) {
-            if (!cache.data[i].isEmpty && cache.data[i].lru_cnt > max_lru) {
-                max_lru = cache.data[i].lru_cnt;
-                victim = i;
-            }
-        }
+/*
+ * Link obj, whose reference the cache takes over, under url. A fresh
+ * object replaces an older copy; one promoted from disk yields to it.
+ * Evicted blocks are spilled to the disk tier once the lock is dropped,
+ * including those evicted before admission turned obj away.
+ */
+static void insert(char *url, unsigned int hash, Object *obj, int replace) {
+    Shard *s = shard_of(hash);
+    Block **pp, *b, *spill = NULL;
+    int filter = admit_filter;
+
+    if (obj->size > s->max_bytes) {
+        cache_release(obj);
+        return;
     }
 
-    if (victim != -1) {
-        if (cache.data[victim].isEmpty) {
-            cache.num++; 
+    writer_lock(s);
+
+    /* Another request may have filled the same URI meanwhile */
+    if (*(pp = lookup(s, url, hash)) != NULL) {
+        if (!replace) {
+            writer_unlock(s);
+            cache_release(obj);
+            return;
         }
+        free_block(unlink_block(s, pp));
+        filter = 0;
+    }
 
-        strcpy(cache.data[victim].uri, url);
-        memcpy(cache.data[victim].obj, buf, size);
-        cache.data[victim].size = size;
-        cache.data[victim].isEmpty = 0;
-        cache.data[victim].lru_cnt = 0;
-        
-        for(int j = 0; j < MAX_CACHE; j++) {
-            if(j != victim && !cache.data[j].isEmpty) {
-                cache.data[j].lru_cnt++;
-            }
+    while (s->num > 0 && (s->num >= s->max_num || s->bytes + obj->size > s->max_bytes)) {
+        if (filter && !admit(s, hash)) {
+            writer_unlock(s);
+            stats_count(CTR_REJECTED, 1);
+            cache_release(obj);
+            spill_all(spill);
+            return;
         }
+        b = evict(s);
+        b->next = spill;
+        spill = b;
+    }
+
+    b = Malloc(sizeof(Block));
+    b->obj = obj;
+    b->uri = Malloc(strlen(url) + 1);
+    strcpy(b->uri, url);
+    b->size = obj->size;
+    b->hash = hash;
+
+    pp = &s->buckets[hash & s->mask];
+    b->next = *pp;
+    *pp = b;
+    policy->insert(s, b);
+    s->num++;
+    s->bytes += obj->size;
+
+    writer_unlock(s);
+
+    spill_all(spill);
+}
+
+/*
+ * Return the cached object for url pinned for the caller, or NULL on a
+ * miss in both tiers. The caller writes straight from obj->data and must
+ * hand the object back with cache_release().
+ */
+Object *cache_find(char *url) {
+    unsigned int hash = hash_uri(url);
+    Shard *s = shard_of(hash);
+    Block *b;
+    Object *obj = NULL;
+
+    /* Only count accesses someone reads, the rows are shared by all hits */
+    if (use_sketch) {
+        sketch_add(hash);
+    }
+
+    reader_lock(s);
+    if ((b = *lookup(s, url, hash)) != NULL) {
+        obj = b->obj;
+        /* Pinning under the reader lock keeps unlink_block() out */
+        __atomic_add_fetch(&obj->refcnt, 1, __ATOMIC_RELAXED);
+        policy->hit(s, b);
+    }
+    reader_unlock(s);
+
+    if (obj == NULL && (obj = disk_get(url, hash)) != NULL) {
+        /* Promote the disk copy; the memory tier takes a second reference */
+        stats_count(CTR_DISK_HITS, 1);
+        obj->refcnt = 2;
+        insert(url, hash, obj, 0);
+    }
+    return obj;
+}
+
+void cache_add(char *url, char *buf, int size) {
+    unsigned int hash = hash_uri(url);
+    Object *obj;
+
+    if (size > MAX_OBJECT_SIZE || size > shard_of(hash)->max_bytes) return;
+
+    /* Whatever the disk tier holds for url is now stale */
+    disk_drop(url, hash);
+
+    obj = Malloc(sizeof(Object) + size);
+    obj->refcnt = 1;
+    obj->size = size;
+    memcpy(obj->data, buf, size);
+    insert(url, hash, obj, 1);
+}
+
+/* Objects and bytes held in memory; read without locks, so approximate */
+void cache_usage(long *entries, long *bytes) {
+    *entries = *bytes = 0;
+    for (int i = 0; i < cache.nshards; i++) {
+        *entries += cache.shards[i].num;
+        *bytes += cache.shards[i].bytes;
     }
-    
-    writer_unlock();
 }
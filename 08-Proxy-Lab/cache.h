@@ -3,28 +3,90 @@
 
 #include "csapp.h"
 
-#define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
-#define MAX_CACHE 10
 
+/* Defaults for the runtime limits set through cache_config() */
+#define DEFAULT_CACHE_SIZE 1049000
+#define DEFAULT_CACHE_ENTRIES 1024
+
+#define MAX_SHARDS 64
+
+/*
+ * Immutable, exactly sized object body. The cache holds one reference
+ * and every cache_find() caller holds another until cache_release(), so
+ * an evicted object stays readable until the last writer is done.
+ */
 typedef struct
 {
-    char obj[MAX_OBJECT_SIZE];
-    char uri[MAXLINE];
-    int lru_cnt;
-    int isEmpty;
+    int refcnt;
+    int size;
+    char data[];
+} Object;
+
+typedef struct Block
+{
+    Object *obj;
+    char *uri;
+    unsigned int hash;
     int size;
+    int referenced;          /* CLOCK bit, set by hits under the reader lock */
+    int freq;                /* GDSF: hits plus the sketch estimate at insert */
+    int heap_pos;            /* GDSF: index in the shard's heap */
+    double prio;             /* GDSF: clock + freq / size */
+    struct Block *next;      /* hash chain */
+    struct Block *ring_prev; /* CLOCK ring or LRU list, oldest at the hand */
+    struct Block *ring_next;
 
 } Block;
 
+/*
+ * One lock stripe: a chained hash table under its own reader/writer lock,
+ * with all blocks also tracked by the eviction policy
+ */
+typedef struct
+{
+    Block **buckets;
+    unsigned int mask;
+    Block *hand;             /* CLOCK hand, or the least recent LRU block */
+    Block **heap;            /* GDSF min-heap on prio */
+    double clock;            /* GDSF inflation: prio of the last victim */
+    int num, max_num;
+    long bytes, max_bytes;
+    int read_cnt;
+    sem_t mutex, w;
+    sem_t hit_mutex;         /* serializes policy updates made by readers */
+} Shard;
+
+/*
+ * Eviction policy, chosen once at startup. hit() runs under the reader
+ * lock, concurrently with other hits; the rest run under the writer lock.
+ * victim() names the block to evict next without unlinking it, and may
+ * update policy state on the way (the CLOCK hand, the GDSF clock); peek()
+ * names the same block and changes nothing.
+ */
+typedef struct
+{
+    char *name;
+    void (*init)(Shard *s);
+    void (*hit)(Shard *s, Block *b);
+    void (*insert)(Shard *s, Block *b);
+    void (*remove)(Shard *s, Block *b);
+    Block *(*victim)(Shard *s);
+    Block *(*peek)(Shard *s);
+} Policy;
+
 typedef struct
 {
-    Block data[MAX_CACHE];
-    int num;
+    Shard shards[MAX_SHARDS];
+    int nshards;
 } Cache;
 
+void cache_config(int max_entries, long max_bytes, int workers);
+int cache_policy(char *name, int admit);
 void cache_init();
-int cache_find(char *url, char *buf, int *size);
+Object *cache_find(char *url);
+void cache_release(Object *obj);
 void cache_add(char *url, char *buf, int size);
+void cache_usage(long *entries, long *bytes);
 
 #endif
@@ -0,0 +1,253 @@
+#include "disk.h"
+
+static char *base; /* the mapping; NULL while the tier is disabled */
+static Super *sb;
+static Extent **extents;
+static unsigned int mask;
+static long nextents;
+static sem_t mutex;
+
+static uint64_t rec_len(uint32_t uri_len, uint32_t size) {
+    return (sizeof(Record) + uri_len + size + 7) & ~(uint64_t)7;
+}
+
+static Record *rec_at(uint64_t off) {
+    return (Record *)(base + off);
+}
+
+/* Whether a whole record starts at off; anything else is the wrap point */
+static int rec_valid(uint64_t off) {
+    Record *r;
+
+    if (off + sizeof(Record) > sb->size) return 0;
+    r = rec_at(off);
+    return (r->magic == DISK_MAGIC || r->magic == DISK_DEAD) &&
+           r->uri_len > 0 && r->size <= MAX_OBJECT_SIZE &&
+           off + rec_len(r->uri_len, r->size) <= sb->size;
+}
+
+static Extent **find(char *url, unsigned int hash) {
+    Extent **pp = &extents[hash & mask];
+    while (*pp && ((*pp)->hash != hash || strcmp((*pp)->uri, url))) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+/* Index the live record at off, superseding any older copy of its URI */
+static void index_add(uint64_t off) {
+    Record *r = rec_at(off);
+    char *uri = (char *)(r + 1);
+    Extent **pp = find(uri, r->hash), *e;
+
+    if ((e = *pp) != NULL) {
+        rec_at(e->off)->magic = DISK_DEAD;
+    } else {
+        e = Malloc(sizeof(Extent));
+        e->hash = r->hash;
+        e->next = NULL;
+        *pp = e;
+        nextents++;
+    }
+    e->uri = uri;
+    e->off = off;
+}
+
+static void index_drop(Extent **pp) {
+    Extent *e = *pp;
+    *pp = e->next;
+    Free(e);
+    nextents--;
+}
+
+/* Drop the oldest record, or step over the point where the log wrapped */
+static void drop_tail() {
+    Record *r;
+    Extent **pp;
+    uint64_t len;
+
+    if (!rec_valid(sb->tail)) {
+        if (sb->tail == DISK_DATA) {
+            sb->used = 0; /* damaged log: give up on what is left */
+            sb->tail = sb->head;
+        } else {
+            sb->tail = DISK_DATA;
+        }
+        return;
+    }
+    r = rec_at(sb->tail);
+    len = rec_len(r->uri_len, r->size);
+    if (r->magic == DISK_MAGIC && *(pp = find((char *)(r + 1), r->hash)) &&
+        (*pp)->off == sb->tail) {
+        index_drop(pp);
+    }
+    sb->tail += len;
+    sb->used -= len;
+}
+
+/* Free [head, head + len) for the next record, wrapping if it won't fit */
+static void make_room(uint64_t len) {
+    if (sb->head + len > sb->size) {
+        while (sb->used > 0 && sb->tail >= sb->head) drop_tail();
+        if (sb->head + sizeof(Record) <= sb->size) rec_at(sb->head)->magic = 0;
+        sb->head = DISK_DATA;
+    }
+    while (sb->used > 0 && sb->tail >= sb->head && sb->tail < sb->head + len) drop_tail();
+    if (sb->used == 0) sb->tail = sb->head;
+}
+
+/* Start an empty log */
+static void format(uint64_t size) {
+    for (unsigned int i = 0; i <= mask; i++) {
+        while (extents[i]) index_drop(&extents[i]);
+    }
+    sb->magic = DISK_MAGIC;
+    sb->size = size;
+    sb->head = sb->tail = DISK_DATA;
+    sb->used = 0;
+}
+
+/* Index every live record from tail to head; 0 if the log is damaged */
+static int rebuild() {
+    uint64_t off = sb->tail, left = sb->used, len;
+    Record *r;
+
+    if (sb->head < DISK_DATA || sb->head > sb->size ||
+        sb->tail < DISK_DATA || sb->tail > sb->size ||
+        sb->used > sb->size - DISK_DATA) {
+        return 0;
+    }
+    while (left > 0) {
+        if (!rec_valid(off)) {
+            if (off == DISK_DATA) return 0;
+            off = DISK_DATA;
+            continue;
+        }
+        r = rec_at(off);
+        if ((len = rec_len(r->uri_len, r->size)) > left) return 0;
+        if (r->magic == DISK_MAGIC) index_add(off);
+        off += len;
+        left -= len;
+    }
+    return off == sb->head;
+}
+
+/*
+ * Map the segment file at path, creating or resizing it as needed, and
+ * index what a previous run left in it. Without a path the tier is off.
+ */
+void disk_init(char *path, long size) {
+    struct stat st;
+    unsigned int nbuckets = 1;
+    int fd;
+
+    Sem_init(&mutex, 0, 1);
+    if (path == NULL) return;
+    if (size <= 0) size = DEFAULT_DISK_SIZE;
+    if (size < DISK_DATA + 4L * MAX_OBJECT_SIZE) size = DISK_DATA + 4L * MAX_OBJECT_SIZE;
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) < 0) {
+        unix_error("disk cache open error");
+        if (fd >= 0) Close(fd);
+        return;
+    }
+    if (st.st_size != size && ftruncate(fd, size) < 0) {
+        unix_error("disk cache ftruncate error");
+        Close(fd);
+        return;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Close(fd);
+    if (base == MAP_FAILED) {
+        unix_error("disk cache mmap error");
+        base = NULL;
+        return;
+    }
+
+    sb = (Super *)base;
+    while (nbuckets < size / 8192) nbuckets <<= 1;
+    extents = Calloc(nbuckets, sizeof(Extent *));
+    mask = nbuckets - 1;
+    if (sb->magic != DISK_MAGIC || sb->size != (uint64_t)size || !rebuild()) {
+        format(size);
+    }
+}
+
+/* Return a private copy of the object stored for url, or NULL */
+Object *disk_get(char *url, unsigned int hash) {
+    Extent *e;
+    Record *r;
+    Object *obj = NULL;
+
+    if (!base) return NULL;
+
+    P(&mutex);
+    if ((e = *find(url, hash)) != NULL) {
+        r = rec_at(e->off);
+        obj = Malloc(sizeof(Object) + r->size);
+        obj->refcnt = 1;
+        obj->size = r->size;
+        memcpy(obj->data, (char *)(r + 1) + r->uri_len, r->size);
+    }
+    V(&mutex);
+
+    return obj;
+}
+
+/*
+ * Append an object evicted from memory, superseding any older copy of url:
+ * a spill can land after newer content was cached. A copy with the same
+ * bytes, as a promoted object leaves behind, is kept instead.
+ */
+void disk_put(char *url, unsigned int hash, char *data, int size) {
+    uint32_t uri_len = strlen(url) + 1;
+    uint64_t len = rec_len(uri_len, size), off;
+    Extent *e;
+    Record *r;
+
+    if (!base || len > sb->size - DISK_DATA) return;
+
+    P(&mutex);
+    if ((e = *find(url, hash)) != NULL) {
+        r = rec_at(e->off);
+        if (r->size == (uint32_t)size && !memcmp((char *)(r + 1) + r->uri_len, data, size)) {
+            V(&mutex);
+            return;
+        }
+    }
+    make_room(len);
+    off = sb->head;
+    r = rec_at(off);
+    r->magic = 0;
+    r->hash = hash;
+    r->uri_len = uri_len;
+    r->size = size;
+    memcpy(r + 1, url, uri_len);
+    memcpy((char *)(r + 1) + uri_len, data, size);
+    r->magic = DISK_MAGIC;
+    /* The superblock covers the record only once it is complete */
+    sb->head += len;
+    sb->used += len;
+    index_add(off); /* marks the older copy, if any, dead */
+    V(&mutex);
+}
+
+/* Forget the stored copy of url, which newer content supersedes */
+void disk_drop(char *url, unsigned int hash) {
+    Extent **pp;
+
+    if (!base) return;
+
+    P(&mutex);
+    if (*(pp = find(url, hash)) != NULL) {
+        rec_at((*pp)->off)->magic = DISK_DEAD;
+        index_drop(pp);
+    }
+    V(&mutex);
+}
+
+/* Live objects and log bytes in the segment file */
+void disk_usage(long *entries, long *bytes) {
+    *entries = base ? nextents : 0;
+    *bytes = base ? (long)sb->used : 0;
+}
@@ -0,0 +1,58 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <stdint.h>
+#include "csapp.h"
+#include "cache.h"
+
+#define DEFAULT_DISK_SIZE (64L << 20) /* segment file size */
+#define DISK_MAGIC 0x50584332u       /* "PXC2": superblock and live records */
+#define DISK_DEAD 0x50584330u        /* record superseded by newer content */
+#define DISK_DATA 4096               /* records start after the superblock page */
+
+/*
+ * Second cache tier: one memory-mapped segment file used as a circular
+ * log. Objects evicted from memory are appended at head; the oldest
+ * records at tail are dropped to make room. head, tail and the live
+ * byte count sit in the superblock, so a restart rebuilds the index by
+ * walking the record headers from tail, without reading any bodies.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t size;        /* file size the log was laid out for */
+    uint64_t head;        /* where the next record goes */
+    uint64_t tail;        /* oldest live record */
+    uint64_t used;        /* bytes of records between tail and head */
+} Super;
+
+/*
+ * Record header, followed by the NUL-terminated URI and the body, padded
+ * to 8 bytes. A header whose magic is neither DISK_MAGIC nor DISK_DEAD,
+ * or no room for a header, marks where the log wrapped to DISK_DATA.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t hash;
+    uint32_t uri_len;     /* including the NUL */
+    uint32_t size;
+} Record;
+
+/* Index entry; uri points into the mapping */
+typedef struct Extent
+{
+    char *uri;
+    unsigned int hash;
+    uint64_t off;
+    struct Extent *next;
+} Extent;
+
+void disk_init(char *path, long size);
+Object *disk_get(char *url, unsigned int hash);
+void disk_put(char *url, unsigned int hash, char *data, int size);
+void disk_drop(char *url, unsigned int hash);
+void disk_usage(long *entries, long *bytes);
+
+#endif
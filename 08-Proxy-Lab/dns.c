@@ -0,0 +1,196 @@
+#include "dns.h"
+
+static Name *names[DNS_BUCKETS];
+static Name *job_head, *job_tail; /* names waiting for a resolver thread */
+static int ttl = DEFAULT_DNS_TTL;
+static int neg_ttl = DEFAULT_DNS_NEG_TTL;
+static time_t last_sweep;
+static sem_t mutex, jobs;
+
+static void *resolver(void *vargp);
+
+void dns_init(int pos_ttl, int fail_ttl) {
+    pthread_t tid;
+
+    if (pos_ttl > 0) ttl = pos_ttl;
+    if (fail_ttl > 0) neg_ttl = fail_ttl;
+    last_sweep = time(NULL);
+    Sem_init(&mutex, 0, 1);
+    Sem_init(&jobs, 0, 0);
+    for (int i = 0; i < DNS_THREADS; i++) {
+        Pthread_create(&tid, NULL, resolver, NULL);
+    }
+}
+
+static Name **lookup(char *hostname, char *port) {
+    unsigned int h = 2166136261u;
+    char *p;
+
+    for (p = hostname; *p; p++) h = (h ^ (unsigned char)tolower(*p)) * 16777619u;
+    for (p = port; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+
+    Name **pp = &names[h % DNS_BUCKETS];
+    while (*pp && (strcasecmp((*pp)->host, hostname) || strcmp((*pp)->port, port))) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+void dns_release(Addrs *addrs) {
+    if (__atomic_sub_fetch(&addrs->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        freeaddrinfo(addrs->list);
+        Free(addrs);
+    }
+}
+
+/* At most once a second, drop expired names nobody is resolving */
+static void sweep(time_t now) {
+    Name **pp, *n;
+
+    if (now == last_sweep) return;
+    last_sweep = now;
+    for (int i = 0; i < DNS_BUCKETS; i++) {
+        for (pp = &names[i]; (n = *pp) != NULL;) {
+            if (n->resolving || now < n->expires) {
+                pp = &n->next;
+                continue;
+            }
+            *pp = n->next;
+            if (n->addrs) dns_release(n->addrs);
+            Free(n->host);
+            Free(n->port);
+            Free(n);
+        }
+    }
+}
+
+/*
+ * Look up hostname:port in the cache. Returns 0 with *addrs pinned (call
+ * dns_release() when done) or -1 if the name recently failed to resolve.
+ * Otherwise returns 1: the lookup is queued, or joins one already in
+ * progress, and cb(arg) runs on a resolver thread once it finishes; the
+ * caller then calls dns_lookup() again.
+ */
+int dns_lookup(char *hostname, char *port, Addrs **addrs, dns_cb *cb, void *arg) {
+    Name **pp, *n;
+    DnsWaiter *w;
+    time_t now = time(NULL);
+    int rc;
+
+    P(&mutex);
+    sweep(now);
+    if ((n = *(pp = lookup(hostname, port))) == NULL) {
+        n = Malloc(sizeof(Name));
+        n->host = Malloc(strlen(hostname) + 1);
+        strcpy(n->host, hostname);
+        n->port = Malloc(strlen(port) + 1);
+        strcpy(n->port, port);
+        n->addrs = NULL;
+        n->resolving = 0;
+        n->expires = 0;
+        n->waiters = NULL;
+        n->next = NULL;
+        *pp = n;
+    }
+    if (!n->resolving && now < n->expires) {
+        if ((*addrs = n->addrs) != NULL) {
+            __atomic_add_fetch(&n->addrs->refcnt, 1, __ATOMIC_RELAXED);
+            rc = 0;
+        } else {
+            rc = -1;
+        }
+        V(&mutex);
+        return rc;
+    }
+
+    w = Malloc(sizeof(DnsWaiter));
+    w->cb = cb;
+    w->arg = arg;
+    w->next = n->waiters;
+    n->waiters = w;
+    if (!n->resolving) {
+        n->resolving = 1;
+        n->job_next = NULL;
+        if (job_tail)
+            job_tail->job_next = n;
+        else
+            job_head = n;
+        job_tail = n;
+        V(&jobs);
+    }
+    V(&mutex);
+    return 1;
+}
+
+/* Run queued getaddrinfo calls off the serving threads */
+static void *resolver(void *vargp) {
+    struct addrinfo hints, *list;
+    DnsWaiter *w, *next;
+    Addrs *addrs;
+    Name *n;
+
+    Pthread_detach(pthread_self());
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+
+    while (1) {
+        P(&jobs);
+        P(&mutex);
+        n = job_head;
+        if ((job_head = n->job_next) == NULL) job_tail = NULL;
+        V(&mutex);
+
+        /* Resolving names are never swept, and host and port never change */
+        addrs = NULL;
+        if (getaddrinfo(n->host, n->port, &hints, &list) == 0) {
+            addrs = Malloc(sizeof(Addrs));
+            addrs->refcnt = 1;
+            addrs->list = list;
+        }
+
+        P(&mutex);
+        if (n->addrs) dns_release(n->addrs);
+        n->addrs = addrs;
+        n->expires = time(NULL) + (addrs ? ttl : neg_ttl);
+        n->resolving = 0;
+        w = n->waiters;
+        n->waiters = NULL;
+        V(&mutex);
+
+        for (; w; w = next) {
+            next = w->next;
+            w->cb(w->arg);
+            Free(w);
+        }
+    }
+    return NULL;
+}
+
+static void wake(void *arg) {
+    V((sem_t *)arg);
+}
+
+/* open_clientfd() over the cached addresses, blocking until resolved */
+int dns_open_clientfd(char *hostname, char *port) {
+    struct addrinfo *p;
+    Addrs *addrs;
+    sem_t done;
+    int fd = -1, rc;
+
+    Sem_init(&done, 0, 0);
+    while ((rc = dns_lookup(hostname, port, &addrs, wake, &done)) == 1) {
+        P(&done);
+    }
+    if (rc < 0) return -1;
+
+    for (p = addrs->list; p; p = p->ai_next) {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) != -1)
+            break;
+        Close(fd);
+    }
+    dns_release(addrs);
+    return p ? fd : -1;
+}
@@ -0,0 +1,49 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include "csapp.h"
+
+#define DEFAULT_DNS_TTL 60    /* seconds a resolved name is reused */
+#define DEFAULT_DNS_NEG_TTL 5 /* seconds a failed lookup is remembered */
+#define DNS_BUCKETS 256
+#define DNS_THREADS 4         /* resolver threads running getaddrinfo */
+
+/*
+ * Addresses of one (host, port), shared by every connection using them.
+ * A refresh installs a new list; the old one lives until its last user
+ * calls dns_release().
+ */
+typedef struct Addrs
+{
+    int refcnt;
+    struct addrinfo *list;
+} Addrs;
+
+typedef void dns_cb(void *arg);
+
+typedef struct DnsWaiter
+{
+    dns_cb *cb;
+    void *arg;
+    struct DnsWaiter *next;
+} DnsWaiter;
+
+/* A cached name: resolved, failed, or being looked up */
+typedef struct Name
+{
+    char *host;
+    char *port;
+    Addrs *addrs;         /* NULL if the lookup failed */
+    int resolving;        /* queued for or held by a resolver thread */
+    time_t expires;
+    DnsWaiter *waiters;   /* lookups sharing the one in progress */
+    struct Name *next;
+    struct Name *job_next;
+} Name;
+
+void dns_init(int ttl, int neg_ttl);
+int dns_lookup(char *hostname, char *port, Addrs **addrs, dns_cb *cb, void *arg);
+void dns_release(Addrs *addrs);
+int dns_open_clientfd(char *hostname, char *port);
+
+#endif
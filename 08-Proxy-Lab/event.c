@@ -0,0 +1,962 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "proxy.h"
+#include "cache.h"
+#include "event.h"
+#include "http.h"
+#include "pool.h"
+#include "flight.h"
+#include "splice.h"
+#include "dns.h"
+#include "stats.h"
+
+#define MAX_EVENTS 256
+#define ACCEPT_PAUSE 1 /* seconds the listener sleeps after accept keeps failing */
+
+/* Connection states, in the order doit() walks through them */
+typedef enum {
+    ST_REQUEST, /* reading request line and headers from the client */
+    ST_WAIT,    /* parked until a concurrent miss on the same URI is done */
+    ST_RESOLVE, /* parked until a resolver thread has looked up the origin */
+    ST_CONNECT, /* non-blocking connect to the upstream server */
+    ST_SEND,    /* writing the rebuilt request to the server */
+    ST_RELAY,   /* relaying the response from server to client */
+    ST_FLUSH    /* writing a cached object or error, then closing */
+} conn_state;
+
+typedef struct conn conn_t;
+typedef struct worker worker_t;
+
+/* One end of a connection; the epoll data pointer refers to this */
+typedef struct {
+    int fd;
+    int events;   /* interest set currently registered, 0 if none */
+    conn_t *conn;
+} endpoint_t;
+
+struct conn {
+    conn_state state;
+    worker_t *owner;
+    endpoint_t client;
+    endpoint_t server;
+    Addrs *addrs;             /* pinned DNS result, released on close */
+    struct addrinfo *ai;      /* next address to try */
+    int in_len;
+    int req_off, req_len;     /* rebuilt request, kept in buf for retries */
+    int keep_alive;           /* client wants the connection kept open */
+    int reused;               /* server fd came from the pool */
+    int leading;              /* we lead the fetch others coalesced on */
+    conn_t *wake_next;        /* on the owner's wake list */
+    int clean;                /* response ended exactly at a boundary */
+    char *chunk;              /* response bytes read but not yet written */
+    int buf_off, buf_len;
+    char *relay;              /* copy buffer once the object can't be cached */
+    int pipefd[2];            /* splice pipe, -1 until first needed */
+    int piped;                /* bytes sitting in the pipe */
+    struct iovec out[3];      /* ST_FLUSH payload, or response headers */
+    int out_cnt;              /* entries of out still to write */
+    Object *hit;              /* pinned cache object being flushed */
+    char *cache_buf;          /* object accumulated for cache_add */
+    int obj_size;
+    int held;                 /* response headers waiting in cache_buf */
+    int rewritten;            /* headers went out rewritten for the client */
+    int server_eof;
+    int idle;                 /* on the worker's idle list */
+    time_t idle_since;        /* when the connection began waiting for a request */
+    conn_t *idle_prev, *idle_next;
+    ReqStats rs;              /* the request being served */
+    long t_phase;             /* when the upstream connect or send began */
+    /* Buffers last, so setup only has to clear the fields above */
+    char url_key[MAXLINE];
+    http_resp_t resp;
+    char in[MAXLINE];         /* client bytes; pipelined requests stay here */
+    char buf[MAXBUF];         /* rebuilt request or error reply */
+};
+
+struct worker {
+    int epfd;
+    int listenfd;
+    endpoint_t listener;
+    int reserve;                   /* spare fd given up to shed a connection at EMFILE */
+    time_t accept_paused;          /* when the listener was dropped, 0 if watched */
+    conn_t *idle_head, *idle_tail; /* ST_REQUEST connections, oldest first */
+    endpoint_t waker;              /* eventfd other workers post wakeups on */
+    conn_t *wake_list;             /* parked connections ready to resume */
+    sem_t wake_mutex;
+};
+
+static int set_nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Register, modify or drop the interest set of one endpoint */
+static void watch(worker_t *w, endpoint_t *ep, int events)
+{
+    struct epoll_event ev;
+
+    if (ep->events == events)
+        return;
+    ev.events = events;
+    ev.data.ptr = ep;
+    if (events == 0)
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, ep->fd, &ev);
+    else if (ep->events == 0)
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, ep->fd, &ev);
+    else
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, ep->fd, &ev);
+    ep->events = events;
+}
+
+/* Host and port of the request, which url_key still holds in full */
+static void conn_target(conn_t *c, char *hostname, char *port)
+{
+    char uri[MAXLINE], path[MAXLINE];
+
+    strcpy(uri, c->url_key);
+    parse_uri(uri, hostname, path, port);
+}
+
+/*
+ * Connections waiting for a request sit on a per-worker list in arrival
+ * order, so expiring them only looks at the head. A request has to arrive
+ * in full within CLIENT_IDLE_TIMEOUT; partial reads do not extend it.
+ */
+static void idle_add(worker_t *w, conn_t *c)
+{
+    c->idle = 1;
+    c->idle_since = time(NULL);
+    c->idle_next = NULL;
+    c->idle_prev = w->idle_tail;
+    if (w->idle_tail)
+        w->idle_tail->idle_next = c;
+    else
+        w->idle_head = c;
+    w->idle_tail = c;
+}
+
+static void idle_remove(worker_t *w, conn_t *c)
+{
+    if (!c->idle)
+        return;
+    c->idle = 0;
+    if (c->idle_prev)
+        c->idle_prev->idle_next = c->idle_next;
+    else
+        w->idle_head = c->idle_next;
+    if (c->idle_next)
+        c->idle_next->idle_prev = c->idle_prev;
+    else
+        w->idle_tail = c->idle_prev;
+}
+
+/* Release requests coalesced on our miss, once there is no more to wait for */
+static void lead_done(conn_t *c)
+{
+    if (c->leading) {
+        flight_finish(c->url_key);
+        c->leading = 0;
+    }
+}
+
+/* Drop the per-response relay resources */
+static void relay_free(conn_t *c)
+{
+    if (c->relay) {
+        Free(c->relay);
+        c->relay = NULL;
+    }
+    if (c->pipefd[0] >= 0) {
+        close(c->pipefd[0]);
+        close(c->pipefd[1]);
+        c->pipefd[0] = c->pipefd[1] = -1;
+    }
+    c->piped = 0;
+}
+
+/* Account for the request in progress, once, however it ended */
+static void request_done(conn_t *c)
+{
+    if (c->state != ST_REQUEST) {
+        stats_done(&c->rs, c->url_key);
+        c->state = ST_REQUEST;
+    }
+}
+
+static void conn_close(worker_t *w, conn_t *c)
+{
+    request_done(c);
+    idle_remove(w, c);
+    lead_done(c);
+    relay_free(c);
+    if (c->server.fd >= 0) {
+        watch(w, &c->server, 0);
+        close(c->server.fd);
+    }
+    watch(w, &c->client, 0);
+    close(c->client.fd);
+    if (c->addrs)
+        dns_release(c->addrs);
+    if (c->hit)
+        cache_release(c->hit);
+    if (c->cache_buf)
+        Free(c->cache_buf);
+    Free(c);
+}
+
+/* Queue a fixed reply (metrics or error) and close once written */
+static void conn_flush(worker_t *w, conn_t *c, char *data, int len)
+{
+    c->state = ST_FLUSH;
+    c->out[0].iov_base = data;
+    c->out[0].iov_len = len;
+    c->out_cnt = 1;
+    watch(w, &c->client, EPOLLOUT);
+}
+
+/* Queue the pinned c->hit, keeping the connection open if it can be */
+static void conn_flush_hit(worker_t *w, conn_t *c)
+{
+    c->keep_alive = c->keep_alive && http_object_persistent(c->hit->data, c->hit->size);
+    c->state = ST_FLUSH;
+    c->out_cnt = http_conn_iov(c->out, c->hit->data, c->hit->size, c->keep_alive);
+    watch(w, &c->client, EPOLLOUT);
+}
+
+static void conn_error(worker_t *w, conn_t *c, char *status, char *body)
+{
+    int len = snprintf(c->buf, sizeof(c->buf),
+                       "HTTP/1.0 %s\r\n"
+                       "Connection: close\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n\r\n%s",
+                       status, strlen(body), body);
+    c->rs.status = atoi(status);
+    stats_count(CTR_ERRORS, 1);
+    conn_flush(w, c, c->buf, len);
+}
+
+/* Try the remaining upstream addresses until a connect is in flight */
+static int start_connect(worker_t *w, conn_t *c)
+{
+    int fd;
+
+    for (; c->ai; c->ai = c->ai->ai_next) {
+        fd = socket(c->ai->ai_family, c->ai->ai_socktype | SOCK_NONBLOCK,
+                    c->ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, c->ai->ai_addr, c->ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+            c->ai = c->ai->ai_next;
+            c->server.fd = fd;
+            c->server.events = 0;
+            c->state = ST_CONNECT;
+            watch(w, &c->server, EPOLLOUT);
+            return 0;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static void conn_wake(void *arg);
+
+/*
+ * Resolve the origin and start a fresh connection to it. A name that is
+ * not cached parks the connection in ST_RESOLVE; it comes back through
+ * on_wake() and retries here once a resolver thread has looked it up.
+ */
+static int connect_upstream(worker_t *w, conn_t *c)
+{
+    char hostname[MAXLINE], port[MAXLINE];
+    int rc;
+
+    conn_target(c, hostname, port);
+    if (c->addrs) {
+        dns_release(c->addrs);
+        c->addrs = NULL;
+    }
+    if ((rc = dns_lookup(hostname, port, &c->addrs, conn_wake, c)) == 1) {
+        c->state = ST_RESOLVE;
+        return 0;
+    }
+    if (rc < 0)
+        return -1;
+    c->ai = c->addrs->list;
+    return start_connect(w, c);
+}
+
+static void serve_miss(worker_t *w, conn_t *c);
+
+/*
+ * Runs on the thread that unparks us, the leader of a coalesced miss or a
+ * resolver: queue the connection to its worker.
+ */
+static void conn_wake(void *arg)
+{
+    conn_t *c = arg;
+    worker_t *w = c->owner;
+    uint64_t one = 1;
+
+    P(&w->wake_mutex);
+    c->wake_next = w->wake_list;
+    w->wake_list = c;
+    V(&w->wake_mutex);
+    if (write(w->waker.fd, &one, sizeof(one)) < 0)
+        unix_error("eventfd write error");
+}
+
+/* Resume connections whose coalesced miss or name lookup has finished */
+static void on_wake(worker_t *w)
+{
+    uint64_t cnt;
+    conn_t *c, *next;
+
+    if (read(w->waker.fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        unix_error("eventfd read error");
+    P(&w->wake_mutex);
+    c = w->wake_list;
+    w->wake_list = NULL;
+    V(&w->wake_mutex);
+
+    for (; c; c = next) {
+        next = c->wake_next;
+        if (c->state == ST_RESOLVE) {
+            if (connect_upstream(w, c) < 0)
+                conn_error(w, c, "502 Bad Gateway", "Connection failed\n");
+        } else if ((c->hit = cache_find(c->url_key)) != NULL) {
+            conn_flush_hit(w, c);
+        } else {
+            serve_miss(w, c); /* not cacheable: fetch it ourselves */
+        }
+    }
+}
+
+/* Drop the request just parsed from in[], keeping pipelined bytes */
+static void consume_request(conn_t *c, int len)
+{
+    c->in_len -= len;
+    memmove(c->in, c->in + len, c->in_len);
+    c->in[c->in_len] = '\0';
+}
+
+/* A full header block is in c->in: parse it and start serving */
+static void handle_request(worker_t *w, conn_t *c, char *hdr_end)
+{
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char hostname[MAXLINE], path[MAXLINE], port[MAXLINE];
+    char *headers;
+    int len = hdr_end + 2 - c->in;
+
+    idle_remove(w, c);
+    stats_begin(&c->rs, c->rs.start);
+    *hdr_end = '\0';
+    headers = strstr(c->in, "\r\n");
+    if (!headers || sscanf(c->in, "%s %s %s", method, uri, version) != 3) {
+        conn_close(w, c);
+        return;
+    }
+    headers += 2;
+    strncpy(c->url_key, uri, MAXLINE - 1);
+    c->url_key[MAXLINE - 1] = '\0';
+    if (strcasecmp(method, "GET")) {
+        conn_error(w, c, "501 Not Implemented", "Proxy does not implement the method\n");
+        return;
+    }
+    /* Not a proxy request but one for us: report the metrics */
+    if (!strcmp(uri, METRICS_PATH)) {
+        consume_request(c, len);
+        c->rs.status = 200;
+        conn_flush(w, c, c->buf, stats_reply(c->buf, sizeof(c->buf)));
+        return;
+    }
+
+    parse_uri(uri, hostname, path, port);
+    c->keep_alive = build_http_header_buf(c->buf, hostname, path, version, headers);
+    c->req_off = 0;
+    c->req_len = strlen(c->buf);
+    consume_request(c, len);
+
+    if ((c->hit = cache_find(c->url_key)) != NULL) {
+        conn_flush_hit(w, c);
+        return;
+    }
+    if (!flight_start(c->url_key, conn_wake, c)) {
+        c->state = ST_WAIT;
+        watch(w, &c->client, 0);
+        return;
+    }
+    /* The previous leader may have finished between the two calls */
+    if ((c->hit = cache_find(c->url_key)) != NULL) {
+        flight_finish(c->url_key);
+        conn_flush_hit(w, c);
+        return;
+    }
+    c->leading = 1;
+    serve_miss(w, c);
+}
+
+/* Fetch the request built in c->buf from upstream */
+static void serve_miss(worker_t *w, conn_t *c)
+{
+    char hostname[MAXLINE], port[MAXLINE];
+    int fd;
+
+    stats_count(CTR_MISSES, 1);
+    c->cache_buf = Malloc(MAX_OBJECT_SIZE);
+    c->t_phase = stats_now();
+    http_resp_init(&c->resp);
+    watch(w, &c->client, 0);
+    conn_target(c, hostname, port);
+    if ((fd = pool_get(hostname, port)) >= 0 && set_nonblock(fd) == 0) {
+        c->reused = 1;
+        c->server.fd = fd;
+        c->server.events = 0;
+        c->state = ST_SEND;
+        watch(w, &c->server, EPOLLOUT);
+        return;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (connect_upstream(w, c) < 0)
+        conn_error(w, c, "502 Bad Gateway", "Connection failed\n");
+}
+
+/* Serve the next request if its headers are complete in in[] */
+static int request_ready(worker_t *w, conn_t *c)
+{
+    char *end;
+
+    if ((end = strstr(c->in, "\r\n\r\n")) == NULL)
+        return 0;
+    handle_request(w, c, end + 2);
+    return 1;
+}
+
+/*
+ * in[] is full and still holds no complete request: refuse it rather than
+ * read into no room, where a 0-byte read would pass for the client's EOF.
+ */
+static int request_overflow(worker_t *w, conn_t *c)
+{
+    if (c->in_len < (int)sizeof(c->in) - 1)
+        return 0;
+    idle_remove(w, c);
+    stats_begin(&c->rs, c->rs.start);
+    if (!strchr(c->in, '\n'))
+        conn_error(w, c, "414 Request-URI Too Long", "URI too long\n");
+    else
+        conn_error(w, c, "431 Request Header Fields Too Large", "Request headers too long\n");
+    return 1;
+}
+
+static void on_request(worker_t *w, conn_t *c)
+{
+    ssize_t n;
+
+    if (request_overflow(w, c))
+        return;
+    n = read(c->client.fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        conn_close(w, c);
+        return;
+    }
+    c->in_len += n;
+    c->in[c->in_len] = '\0';
+    if (c->rs.start == 0)
+        c->rs.start = stats_now();
+
+    if (!request_ready(w, c))
+        request_overflow(w, c);
+}
+
+static void on_connect(worker_t *w, conn_t *c)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(c->server.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        watch(w, &c->server, 0);
+        close(c->server.fd);
+        c->server.fd = -1;
+        if (start_connect(w, c) < 0)
+            conn_error(w, c, "502 Bad Gateway", "Connection failed\n");
+        return;
+    }
+    stats_record(HIST_CONNECT, stats_now() - c->t_phase);
+    stats_count(CTR_CONNECTS, 1);
+    c->state = ST_SEND;
+}
+
+/*
+ * A pooled connection failed before the origin sent a byte, most likely
+ * because it timed out the idle socket: replay the request on a new one.
+ */
+static int retry_fresh(worker_t *w, conn_t *c)
+{
+    if (!c->reused || c->resp.total > 0)
+        return -1;
+    watch(w, &c->server, 0);
+    close(c->server.fd);
+    c->server.fd = -1;
+    c->reused = 0;
+    c->req_off = 0;
+    c->t_phase = stats_now();
+    if (connect_upstream(w, c) < 0) {
+        conn_error(w, c, "502 Bad Gateway", "Connection failed\n");
+    }
+    return 0;
+}
+
+static void on_send(worker_t *w, conn_t *c)
+{
+    ssize_t n = write(c->server.fd, c->buf + c->req_off, c->req_len - c->req_off);
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR && retry_fresh(w, c) < 0)
+            conn_close(w, c);
+        return;
+    }
+    c->req_off += n;
+    if (c->req_off == c->req_len) {
+        c->t_phase = stats_now();
+        c->buf_off = c->buf_len = 0;
+        c->state = ST_RELAY;
+        watch(w, &c->server, EPOLLIN);
+    }
+}
+
+/*
+ * The response went out in full and its framing lets the client send
+ * another request: reset the connection and serve anything pipelined.
+ */
+static void conn_next(worker_t *w, conn_t *c)
+{
+    if (c->server.fd >= 0) {
+        watch(w, &c->server, 0);
+        close(c->server.fd);
+        c->server.fd = -1;
+    }
+    if (c->addrs) {
+        dns_release(c->addrs);
+        c->addrs = NULL;
+    }
+    if (c->hit) {
+        cache_release(c->hit);
+        c->hit = NULL;
+    }
+    if (c->cache_buf) {
+        Free(c->cache_buf);
+        c->cache_buf = NULL;
+    }
+    relay_free(c);
+    c->reused = c->clean = c->server_eof = 0;
+    c->obj_size = c->held = c->rewritten = 0;
+    c->buf_off = c->buf_len = 0;
+    c->url_key[0] = '\0';
+    c->rs.start = c->in_len ? stats_now() : 0; /* pipelined: already here */
+    c->state = ST_REQUEST;
+    idle_add(w, c);
+    watch(w, &c->client, EPOLLIN);
+    request_ready(w, c);
+}
+
+static void relay_done(worker_t *w, conn_t *c)
+{
+    char hostname[MAXLINE], port[MAXLINE];
+
+    if (!c->rewritten && c->resp.hdr_end != 0)
+        c->obj_size = -1; /* the origin's Connection header is in it */
+    if (c->resp.done && c->obj_size >= 0)
+        cache_add(c->url_key, c->cache_buf, c->obj_size);
+    lead_done(c);
+    c->rs.status = c->resp.status;
+    if (!c->resp.done)
+        stats_count(CTR_ERRORS, 1);
+    request_done(c);
+    if (c->clean && http_resp_reusable(&c->resp)) {
+        watch(w, &c->server, 0);
+        conn_target(c, hostname, port);
+        pool_put(hostname, port, c->server.fd);
+        c->server.fd = -1;
+    }
+    if (c->keep_alive && c->rewritten && http_resp_framed(&c->resp))
+        conn_next(w, c);
+    else
+        conn_close(w, c);
+}
+
+/* Push buffered response bytes to the client, throttling the server side */
+static void relay_write(worker_t *w, conn_t *c)
+{
+    ssize_t n;
+
+    while (c->out_cnt > 0 || c->piped > 0 || c->buf_off < c->buf_len) {
+        if (c->out_cnt > 0)
+            n = writev(c->client.fd, c->out, c->out_cnt);
+        else if (c->piped > 0)
+            n = relay_splice(c->pipefd[0], c->client.fd, c->piped, 1);
+        else
+            n = write(c->client.fd, c->chunk + c->buf_off, c->buf_len - c->buf_off);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN) {
+                watch(w, &c->server, 0);
+                watch(w, &c->client, EPOLLOUT);
+                return;
+            }
+            conn_close(w, c);
+            return;
+        }
+        if (c->out_cnt > 0)
+            http_iov_advance(c->out, &c->out_cnt, n);
+        else if (c->piped > 0)
+            c->piped -= n;
+        else
+            c->buf_off += n;
+        stats_sent(&c->rs, n);
+    }
+    c->buf_off = c->buf_len = 0;
+    if (c->server_eof) {
+        relay_done(w, c);
+        return;
+    }
+    watch(w, &c->client, 0);
+    watch(w, &c->server, EPOLLIN);
+}
+
+/* The server closed or failed before the framer saw the response end */
+static void relay_eof(worker_t *w, conn_t *c, ssize_t n)
+{
+    if (retry_fresh(w, c) == 0)
+        return;
+    if (n == 0)
+        http_resp_eof(&c->resp);
+    c->server_eof = 1;
+    relay_done(w, c);
+}
+
+/*
+ * While the object may still be cached, read straight into the cache
+ * buffer and relay from there; the headers wait there until complete and
+ * go out with their hop-by-hop lines rewritten. Once it can't be, opaque
+ * body bytes are spliced server -> pipe -> client; framing and anything
+ * splice can't take goes through the relay buffer.
+ */
+static void relay_read(worker_t *w, conn_t *c)
+{
+    long raw = http_resp_raw(&c->resp);
+    size_t room = 0;
+    ssize_t n, used, out;
+
+    if (c->obj_size >= 0) {
+        room = MAX_OBJECT_SIZE - c->obj_size;
+        if (room == 0 || (raw != LONG_MAX && raw > (long)room)) {
+            c->obj_size = -1; /* mark as too large to cache */
+            lead_done(c);
+            if (c->held > 0) {
+                /* Headers too long to hold can't be rewritten: refuse them */
+                watch(w, &c->server, 0);
+                close(c->server.fd);
+                c->server.fd = -1;
+                conn_error(w, c, "502 Bad Gateway", "Response headers too long\n");
+                return;
+            }
+        }
+    }
+
+    if (c->obj_size < 0 && raw > 0 && relay_use_splice &&
+        (c->pipefd[0] >= 0 || relay_pipe(c->pipefd) == 0)) {
+        n = relay_splice(c->server.fd, c->pipefd[1],
+                         raw < relay_bufsize ? raw : relay_bufsize, 1);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (n <= 0) {
+            relay_eof(w, c, n);
+            return;
+        }
+        stats_count(CTR_BYTES_UPSTREAM, n);
+        http_resp_skip(&c->resp, n);
+        if (c->resp.done)
+            c->server_eof = c->clean = 1;
+        c->piped = n;
+        relay_write(w, c);
+        return;
+    }
+
+    if (c->obj_size >= 0) {
+        c->chunk = c->cache_buf + c->obj_size;
+    } else {
+        if (c->relay == NULL)
+            c->relay = Malloc(relay_bufsize);
+        c->chunk = c->relay;
+        room = relay_bufsize;
+    }
+    n = read(c->server.fd, c->chunk, room);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        relay_eof(w, c, n);
+        return;
+    }
+    if (c->t_phase) {
+        stats_record(HIST_TTFB, stats_now() - c->t_phase);
+        c->t_phase = 0;
+    }
+    stats_count(CTR_BYTES_UPSTREAM, n);
+
+    used = http_resp_feed(&c->resp, c->chunk, n);
+    if (c->resp.done) {
+        c->server_eof = 1;
+        c->clean = (used == n); /* stray bytes past the response */
+    }
+    if (c->obj_size == c->held && !c->rewritten && c->resp.hdr_end != 0) {
+        c->held += used;
+        c->obj_size += used;
+        if (c->resp.hdr_end < 0)
+            return;
+        out = http_resp_rewrite(&c->resp, c->cache_buf, c->held);
+        c->rewritten = 1;
+        c->obj_size = out;
+        c->held = 0;
+        if (c->resp.chunked) {
+            /* Framed for this client's version, not for any other */
+            c->obj_size = -1;
+            lead_done(c);
+        }
+        c->out_cnt = http_conn_iov(c->out, c->cache_buf, out,
+                                   c->keep_alive && c->resp.framed);
+        used = 0;
+    } else if (c->obj_size >= 0) {
+        c->obj_size += used;
+    }
+    c->buf_off = 0;
+    c->buf_len = used;
+    relay_write(w, c);
+}
+
+static void on_flush(worker_t *w, conn_t *c)
+{
+    ssize_t n;
+
+    while (c->out_cnt > 0) {
+        n = writev(c->client.fd, c->out, c->out_cnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                conn_close(w, c);
+            return;
+        }
+        http_iov_advance(c->out, &c->out_cnt, n);
+        stats_sent(&c->rs, n);
+    }
+    if (c->hit) {
+        stats_count(CTR_HITS, 1);
+        c->rs.hit = 1;
+        c->rs.status = http_status(c->hit->data, c->hit->size);
+    }
+    request_done(c);
+    if (c->hit && c->keep_alive)
+        conn_next(w, c);
+    else
+        conn_close(w, c);
+}
+
+/*
+ * Out of descriptors: give up the spare one to accept the next pending
+ * connection and close it at once, so the client is refused instead of
+ * sitting in the backlog and the level-triggered listener stops firing.
+ * Returns -1 with errno from accept() if nothing was shed, EAGAIN meaning
+ * the queue is empty (accept() reports EMFILE before it looks).
+ */
+static int shed_connection(worker_t *w)
+{
+    int fd, err;
+
+    if (w->reserve < 0)
+        return -1;
+    close(w->reserve);
+    fd = accept(w->listenfd, NULL, NULL);
+    err = errno;
+    if (fd >= 0)
+        close(fd);
+    w->reserve = open("/dev/null", O_RDONLY);
+    errno = err;
+    return fd >= 0 ? 0 : -1;
+}
+
+/* Stop watching the listener for ACCEPT_PAUSE; worker() resumes it */
+static void pause_accept(worker_t *w)
+{
+    watch(w, &w->listener, 0);
+    w->accept_paused = time(NULL);
+}
+
+static void on_accept(worker_t *w)
+{
+    int connfd;
+    conn_t *c;
+
+    while (1) {
+        if ((connfd = accept(w->listenfd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (shed_connection(w) == 0)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+            }
+            /* Retrying now would only spin on the same error */
+            unix_error("accept error");
+            pause_accept(w);
+            return;
+        }
+        if (set_nonblock(connfd) < 0) {
+            close(connfd);
+            continue;
+        }
+        c = Malloc(sizeof(conn_t));
+        memset(c, 0, offsetof(conn_t, url_key));
+        c->state = ST_REQUEST;
+        c->owner = w;
+        c->client.fd = connfd;
+        c->client.conn = c;
+        c->server.fd = -1;
+        c->server.conn = c;
+        c->pipefd[0] = c->pipefd[1] = -1;
+        c->rs.start = stats_now();
+        c->url_key[0] = '\0';
+        idle_add(w, c);
+        watch(w, &c->client, EPOLLIN);
+    }
+}
+
+static void dispatch(worker_t *w, endpoint_t *ep)
+{
+    conn_t *c = ep->conn;
+    int is_client = (ep == &c->client);
+
+    switch (c->state) {
+    case ST_REQUEST:
+        on_request(w, c);
+        break;
+    case ST_CONNECT:
+        on_connect(w, c);
+        if (c->state == ST_SEND)
+            on_send(w, c);
+        break;
+    case ST_SEND:
+        on_send(w, c);
+        break;
+    case ST_RELAY:
+        if (is_client)
+            relay_write(w, c);
+        else
+            relay_read(w, c);
+        break;
+    case ST_FLUSH:
+        on_flush(w, c);
+        break;
+    case ST_WAIT:
+    case ST_RESOLVE:
+        break; /* nothing is registered while parked */
+    }
+}
+
+static void *worker(void *vargp)
+{
+    worker_t *w = vargp;
+    struct epoll_event events[MAX_EVENTS];
+    time_t now;
+    int n;
+
+    while (1) {
+        n = epoll_wait(w->epfd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno != EINTR)
+                unix_error("epoll_wait error");
+            continue;
+        }
+        /*
+         * Every state waits on exactly one endpoint of its connection, so a
+         * batch never holds two events for the same connection and a
+         * connection freed by one event is not referenced by a later one.
+         */
+        for (int i = 0; i < n; i++) {
+            endpoint_t *ep = events[i].data.ptr;
+            if (ep == &w->listener)
+                on_accept(w);
+            else if (ep == &w->waker)
+                on_wake(w);
+            else
+                dispatch(w, ep);
+        }
+
+        now = time(NULL);
+        if (w->accept_paused && now - w->accept_paused >= ACCEPT_PAUSE) {
+            if (w->reserve < 0)
+                w->reserve = open("/dev/null", O_RDONLY);
+            w->accept_paused = 0;
+            watch(w, &w->listener, EPOLLIN | EPOLLEXCLUSIVE);
+        }
+        while (w->idle_head && now - w->idle_head->idle_since >= CLIENT_IDLE_TIMEOUT)
+            conn_close(w, w->idle_head);
+    }
+    return NULL;
+}
+
+void event_run(int listenfd, int nworkers)
+{
+    worker_t *workers;
+    pthread_t tid;
+    struct epoll_event ev;
+
+    if (set_nonblock(listenfd) < 0)
+        unix_error("fcntl error");
+
+    workers = Calloc(nworkers, sizeof(worker_t));
+    for (int i = 0; i < nworkers; i++) {
+        worker_t *w = &workers[i];
+        if ((w->epfd = epoll_create1(0)) < 0) {
+            unix_error("epoll_create1 error");
+            exit(1);
+        }
+        w->listenfd = listenfd;
+        w->listener.fd = listenfd;
+        /* EPOLLEXCLUSIVE wakes one worker per connection, not all of them */
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &w->listener;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+            unix_error("epoll_ctl error");
+            exit(1);
+        }
+        w->listener.events = ev.events;
+        w->reserve = open("/dev/null", O_RDONLY);
+        if ((w->waker.fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+            unix_error("eventfd error");
+            exit(1);
+        }
+        Sem_init(&w->wake_mutex, 0, 1);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &w->waker;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->waker.fd, &ev) < 0) {
+            unix_error("epoll_ctl error");
+            exit(1);
+        }
+        if (i > 0)
+            Pthread_create(&tid, NULL, worker, w);
+    }
+    worker(&workers[0]);
+}
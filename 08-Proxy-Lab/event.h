@@ -0,0 +1,13 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "csapp.h"
+
+/*
+ * Event-loop mode: nworkers threads, each with its own epoll set, share
+ * the non-blocking listening socket and drive every connection through
+ * a non-blocking request state machine. Does not return.
+ */
+void event_run(int listenfd, int nworkers);
+
+#endif
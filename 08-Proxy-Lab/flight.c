@@ -0,0 +1,73 @@
+#include "flight.h"
+#include "stats.h"
+
+static Flight *flights[FLIGHT_BUCKETS];
+static sem_t mutex;
+
+void flight_init() {
+    Sem_init(&mutex, 0, 1);
+}
+
+static Flight **lookup(char *url) {
+    unsigned int h = 2166136261u;
+
+    for (char *p = url; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+
+    Flight **pp = &flights[h % FLIGHT_BUCKETS];
+    while (*pp && strcmp((*pp)->url, url)) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+/*
+ * Returns 1 if the caller leads the fetch of url and must call
+ * flight_finish(). Otherwise returns 0 and cb(arg) runs, on the leader's
+ * thread, once the leader is done; the caller then retries the cache.
+ */
+int flight_start(char *url, flight_cb *cb, void *arg) {
+    Flight **pp, *f;
+    Waiter *w;
+
+    P(&mutex);
+    if ((f = *(pp = lookup(url))) == NULL) {
+        f = Malloc(sizeof(Flight));
+        f->url = Malloc(strlen(url) + 1);
+        strcpy(f->url, url);
+        f->waiters = NULL;
+        f->next = NULL;
+        *pp = f;
+        V(&mutex);
+        return 1;
+    }
+    w = Malloc(sizeof(Waiter));
+    w->cb = cb;
+    w->arg = arg;
+    w->next = f->waiters;
+    f->waiters = w;
+    V(&mutex);
+    stats_count(CTR_COALESCED, 1);
+    return 0;
+}
+
+/* Called by the leader after cache_add, or as soon as it can't cache */
+void flight_finish(char *url) {
+    Flight **pp, *f;
+    Waiter *w, *next;
+
+    P(&mutex);
+    if ((f = *(pp = lookup(url))) == NULL) {
+        V(&mutex);
+        return;
+    }
+    *pp = f->next;
+    V(&mutex);
+
+    for (w = f->waiters; w; w = next) {
+        next = w->next;
+        w->cb(w->arg);
+        Free(w);
+    }
+    Free(f->url);
+    Free(f);
+}
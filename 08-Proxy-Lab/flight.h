@@ -0,0 +1,33 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include "csapp.h"
+
+#define FLIGHT_BUCKETS 256
+
+/*
+ * In-flight cache misses, keyed by url_key. The first request to miss on
+ * a URI leads the upstream fetch; later ones register a callback and are
+ * woken once the leader has filled the cache or given up on caching.
+ */
+typedef void flight_cb(void *arg);
+
+typedef struct Waiter
+{
+    flight_cb *cb;
+    void *arg;
+    struct Waiter *next;
+} Waiter;
+
+typedef struct Flight
+{
+    char *url;
+    Waiter *waiters;
+    struct Flight *next;
+} Flight;
+
+void flight_init();
+int flight_start(char *url, flight_cb *cb, void *arg);
+void flight_finish(char *url);
+
+#endif
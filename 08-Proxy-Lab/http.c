@@ -0,0 +1,298 @@
+#include "http.h"
+
+enum {
+    RESP_STATUS,     /* status line */
+    RESP_HEADER,     /* header lines up to the blank line */
+    RESP_BODY,       /* Content-Length body */
+    RESP_CHUNK_SIZE, /* chunk-size line */
+    RESP_CHUNK_DATA, /* chunk payload */
+    RESP_CHUNK_END,  /* CRLF after the payload */
+    RESP_TRAILER,    /* trailer lines after the last chunk */
+    RESP_EOF,        /* unframed body, ends when the server closes */
+    RESP_DONE
+};
+
+void http_resp_init(http_resp_t *rp)
+{
+    rp->state = RESP_STATUS;
+    rp->status = 0;
+    rp->minor = 0;
+    rp->keep_alive = 0;
+    rp->framed = 0;
+    rp->chunked = 0;
+    rp->length = -1;
+    rp->remaining = 0;
+    rp->total = 0;
+    rp->hdr_end = -1;
+    rp->done = 0;
+    rp->line_len = 0;
+}
+
+/* Case-insensitive search for token in a header value */
+int http_has_token(char *value, char *token)
+{
+    size_t len = strlen(token);
+
+    for (; *value; value++) {
+        if (!strncasecmp(value, token, len))
+            return 1;
+    }
+    return 0;
+}
+
+static void end_of_headers(http_resp_t *rp)
+{
+    if (rp->status >= 100 && rp->status < 200) {
+        /* Interim response, the real status line follows */
+        rp->state = RESP_STATUS;
+    } else if (rp->status == 204 || rp->status == 304) {
+        rp->framed = 1;
+        rp->state = RESP_DONE;
+    } else if (rp->chunked) {
+        rp->framed = 1;
+        rp->state = RESP_CHUNK_SIZE;
+    } else if (rp->length >= 0) {
+        rp->framed = 1;
+        rp->remaining = rp->length;
+        rp->state = rp->length ? RESP_BODY : RESP_DONE;
+    } else {
+        rp->keep_alive = 0;
+        rp->state = RESP_EOF;
+    }
+}
+
+static void handle_line(http_resp_t *rp)
+{
+    char *line = rp->line;
+    int blank = !strcmp(line, "\r\n") || !strcmp(line, "\n");
+
+    switch (rp->state) {
+    case RESP_STATUS:
+        if (sscanf(line, "HTTP/1.%d %d", &rp->minor, &rp->status) != 2) {
+            rp->status = 0; /* no headers to speak of */
+            rp->keep_alive = 0;
+            rp->state = RESP_EOF;
+            break;
+        }
+        /* HTTP/1.1 is persistent by default, HTTP/1.0 only if announced */
+        rp->keep_alive = rp->minor >= 1;
+        rp->chunked = 0;
+        rp->length = -1;
+        rp->state = RESP_HEADER;
+        break;
+    case RESP_HEADER:
+        if (blank) {
+            end_of_headers(rp);
+        } else if (!strncasecmp(line, "Content-Length:", 15)) {
+            rp->length = atol(line + 15);
+        } else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            rp->chunked = http_has_token(line + 18, "chunked");
+        } else if (!strncasecmp(line, "Connection:", 11)) {
+            if (http_has_token(line + 11, "close"))
+                rp->keep_alive = 0;
+            else if (http_has_token(line + 11, "keep-alive"))
+                rp->keep_alive = 1;
+        }
+        break;
+    case RESP_CHUNK_SIZE:
+        rp->remaining = strtol(line, NULL, 16);
+        rp->state = rp->remaining > 0 ? RESP_CHUNK_DATA : RESP_TRAILER;
+        break;
+    case RESP_CHUNK_END:
+        rp->state = RESP_CHUNK_SIZE;
+        break;
+    case RESP_TRAILER:
+        if (blank)
+            rp->state = RESP_DONE;
+        break;
+    }
+}
+
+/*
+ * http_resp_feed - Consume bytes of the response. Returns how many of
+ *     the n bytes belong to it; fewer than n only once rp->done is set.
+ */
+ssize_t http_resp_feed(http_resp_t *rp, char *buf, size_t n)
+{
+    size_t i = 0, k;
+
+    while (i < n && rp->state != RESP_DONE) {
+        switch (rp->state) {
+        case RESP_BODY:
+        case RESP_CHUNK_DATA:
+            k = n - i;
+            if ((long)k > rp->remaining)
+                k = rp->remaining;
+            rp->remaining -= k;
+            i += k;
+            if (rp->remaining == 0)
+                rp->state = rp->state == RESP_BODY ? RESP_DONE : RESP_CHUNK_END;
+            break;
+        case RESP_EOF:
+            i = n;
+            break;
+        default:
+            /* Overlong lines are truncated; they only matter for reuse */
+            if (rp->line_len < MAXLINE - 1)
+                rp->line[rp->line_len++] = buf[i];
+            else
+                rp->keep_alive = 0;
+            if (buf[i++] == '\n') {
+                rp->line[rp->line_len] = '\0';
+                rp->line_len = 0;
+                handle_line(rp);
+                if (rp->hdr_end < 0 && rp->state != RESP_STATUS && rp->state != RESP_HEADER)
+                    rp->hdr_end = rp->status ? rp->total + (long)i : 0;
+            }
+            break;
+        }
+    }
+
+    rp->done = rp->state == RESP_DONE;
+    rp->total += i;
+    return i;
+}
+
+/*
+ * http_resp_raw - How many of the next response bytes are opaque body
+ *     that can be relayed without passing through http_resp_feed():
+ *     the rest of a Content-Length body, LONG_MAX for a body that runs
+ *     to EOF, and 0 while headers or chunk framing are being parsed.
+ */
+long http_resp_raw(http_resp_t *rp)
+{
+    if (rp->state == RESP_BODY)
+        return rp->remaining;
+    if (rp->state == RESP_EOF)
+        return LONG_MAX;
+    return 0;
+}
+
+/* Account for n opaque body bytes relayed without being fed */
+void http_resp_skip(http_resp_t *rp, size_t n)
+{
+    if (rp->state == RESP_BODY) {
+        rp->remaining -= n;
+        if (rp->remaining == 0)
+            rp->state = RESP_DONE;
+    }
+    rp->done = rp->state == RESP_DONE;
+    rp->total += n;
+}
+
+/* The server closed the connection; returns whether that ended the response */
+int http_resp_eof(http_resp_t *rp)
+{
+    if (rp->state == RESP_EOF)
+        rp->state = RESP_DONE;
+    rp->done = rp->state == RESP_DONE;
+    return rp->done;
+}
+
+/* The server connection may carry another request after this response */
+int http_resp_reusable(http_resp_t *rp)
+{
+    return rp->done && rp->keep_alive;
+}
+
+/* The client connection may carry another request after this response */
+int http_resp_framed(http_resp_t *rp)
+{
+    return rp->done && rp->framed;
+}
+
+/* Headers that only describe the upstream connection */
+static int hop_header(char *line)
+{
+    return !strncasecmp(line, "Connection:", 11) ||
+           !strncasecmp(line, "Keep-Alive:", 11) ||
+           !strncasecmp(line, "Proxy-Connection:", 17);
+}
+
+/*
+ * http_resp_rewrite - Drop the hop-by-hop headers of the response whose
+ *     first n bytes, complete headers included, sit in data, so that what
+ *     is left can be stored and sent to any client; http_conn_iov() adds
+ *     the client's Connection header on the way out. Returns the new
+ *     length.
+ */
+size_t http_resp_rewrite(http_resp_t *rp, char *data, size_t n)
+{
+    size_t end = rp->hdr_end, in = 0, out = 0, len;
+    char *nl;
+
+    if (rp->hdr_end <= 0)
+        return n;
+    while (in < end) {
+        nl = memchr(data + in, '\n', end - in);
+        len = nl ? (size_t)(nl - (data + in)) + 1 : end - in;
+        if (!hop_header(data + in)) {
+            memmove(data + out, data + in, len);
+            out += len;
+        }
+        in += len;
+    }
+    memmove(data + out, data + end, n - end);
+    return n - end + out;
+}
+
+/*
+ * http_conn_iov - Lay out the n response bytes in data for sending, with
+ *     a Connection header for the client (keep-alive or close) right
+ *     after the status line. Fills iov and returns how many entries it
+ *     used: 3, or 1 with data unchanged if there is no status line.
+ */
+int http_conn_iov(struct iovec *iov, char *data, size_t n, int keep_alive)
+{
+    char *nl = memchr(data, '\n', n);
+    size_t at = nl ? (size_t)(nl + 1 - data) : n;
+
+    iov[0].iov_base = data;
+    iov[0].iov_len = at;
+    if (nl == NULL)
+        return 1;
+    iov[1].iov_base = keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    iov[1].iov_len = strlen(iov[1].iov_base);
+    iov[2].iov_base = data + at;
+    iov[2].iov_len = n - at;
+    return 3;
+}
+
+/* Drop the first n bytes, already written, from the cnt entries of iov */
+void http_iov_advance(struct iovec *iov, int *cnt, size_t n)
+{
+    int i = 0;
+
+    while (i < *cnt && n >= iov[i].iov_len)
+        n -= iov[i++].iov_len;
+    if (i < *cnt) {
+        iov[i].iov_base = (char *)iov[i].iov_base + n;
+        iov[i].iov_len -= n;
+    }
+    *cnt -= i;
+    memmove(iov, iov + i, *cnt * sizeof(*iov));
+}
+
+/*
+ * http_status - Status code of a stored response, or 0 if it does not
+ *     start with a status line. data is not NUL-terminated.
+ */
+int http_status(char *data, size_t n)
+{
+    if (n < 12 || strncmp(data, "HTTP/1.", 7) || data[8] != ' ' ||
+        !isdigit(data[9]) || !isdigit(data[10]) || !isdigit(data[11]))
+        return 0;
+    return (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+}
+
+/*
+ * http_object_persistent - Whether a stored response (a cached object)
+ *     frames itself, so the client connection can stay open after it.
+ */
+int http_object_persistent(char *data, size_t n)
+{
+    http_resp_t resp;
+
+    http_resp_init(&resp);
+    return http_resp_feed(&resp, data, n) == n && http_resp_framed(&resp);
+}
@@ -0,0 +1,45 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <limits.h> /* LONG_MAX from http_resp_raw() */
+#include <sys/uio.h>
+#include "csapp.h"
+
+/*
+ * Incremental HTTP response framer. Bytes read from the server are fed
+ * through http_resp_feed(), which reports how many of them belong to the
+ * current response and flags when it is complete, so the connection can
+ * go back to the pool instead of being read until EOF.
+ */
+typedef struct {
+    int state;
+    int status;
+    int minor;          /* HTTP/1.<minor> */
+    int keep_alive;     /* server allows reuse after this response */
+    int framed;         /* ends by Content-Length or chunking, not at EOF */
+    int chunked;
+    long length;        /* Content-Length, -1 if absent */
+    long remaining;     /* bytes left in the body or current chunk */
+    long total;         /* bytes consumed so far */
+    long hdr_end;       /* offset just past the final headers, 0 if there are
+                           none, -1 until they are complete */
+    int done;
+    int line_len;
+    char line[MAXLINE]; /* header or chunk-size line being assembled */
+} http_resp_t;
+
+void http_resp_init(http_resp_t *rp);
+ssize_t http_resp_feed(http_resp_t *rp, char *buf, size_t n);
+long http_resp_raw(http_resp_t *rp);
+void http_resp_skip(http_resp_t *rp, size_t n);
+int http_resp_eof(http_resp_t *rp);
+int http_resp_reusable(http_resp_t *rp);
+int http_resp_framed(http_resp_t *rp);
+size_t http_resp_rewrite(http_resp_t *rp, char *data, size_t n);
+int http_conn_iov(struct iovec *iov, char *data, size_t n, int keep_alive);
+void http_iov_advance(struct iovec *iov, int *cnt, size_t n);
+int http_object_persistent(char *data, size_t n);
+int http_status(char *data, size_t n);
+int http_has_token(char *value, char *token);
+
+#endif
@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# keepalive.sh - Check that the proxy keeps client connections open in
+#     its default configuration (no -k, so every upstream request is
+#     HTTP/1.0 and the origin closes after it), on misses and on hits,
+#     in both the threaded and the event-loop modes. With -k, it also
+#     checks that small misses reuse pooled upstream connections, and
+#     that a chunked reply filled by an HTTP/1.1 client is never served
+#     from the cache to an HTTP/1.0 one.
+#
+#     usage: ./keepalive.sh   (after make)
+#
+
+PROXY_PORT=${PROXY_PORT:-15480}
+ORIGIN_PORT=${ORIGIN_PORT:-15481}
+MIN_PER_CONN=2
+status=0
+
+# run_case <label> <proxy flags> <proxybench flags>
+function run_case {
+    ./proxy $2 ${PROXY_PORT} > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    local each=`./proxybench -p localhost:${PROXY_PORT} -o ${ORIGIN_PORT} -c 2 -d 2 $3 |
+                awk '/^conns/ { print $3 }'`
+    kill ${pid}
+    wait ${pid} 2> /dev/null
+    if [ -z "${each}" ] || awk "BEGIN { exit !(${each} < ${MIN_PER_CONN}) }"; then
+        echo "FAIL ${1}: ${each:-no} requests per connection"
+        status=1
+    else
+        echo "ok   ${1}: ${each} requests per connection"
+    fi
+}
+
+# metric <name> - Read one counter from the running proxy's /metrics
+function metric {
+    exec 3<> /dev/tcp/localhost/${PROXY_PORT} || return
+    printf 'GET /metrics HTTP/1.0\r\n\r\n' >&3
+    awk -v name="$1" '$1 == name { print $2 }' <&3
+    exec 3<&-
+}
+
+# run_pool_case <label> <proxy flags>: most misses must go over a pooled connection
+function run_pool_case {
+    ./proxy $2 ${PROXY_PORT} > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    ./proxybench -p localhost:${PROXY_PORT} -o ${ORIGIN_PORT} -c 2 -d 2 \
+                 -k 1000000 -z 0 -s fixed:2000 > /dev/null
+    local reuses=`metric upstream_pool_reuses`
+    local connects=`metric upstream_connects`
+    kill ${pid}
+    wait ${pid} 2> /dev/null
+    if [ -z "${reuses}" ] || [ -z "${connects}" ] || [ "${reuses}" -le "${connects}" ]; then
+        echo "FAIL ${1}: ${reuses:-no} pool reuses, ${connects:-no} connects"
+        status=1
+    else
+        echo "ok   ${1}: ${reuses} pool reuses, ${connects} connects"
+    fi
+}
+
+# run_version_case <label> <proxy flags>: mixed client versions, chunked origin
+function run_version_case {
+    ./proxy $2 ${PROXY_PORT} > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    local out=`./proxybench -p localhost:${PROXY_PORT} -o ${ORIGIN_PORT} -c 2 -d 2 \
+                            -k 4 -C -m | awk '/^requests/'`
+    local ok=`echo "${out}" | awk '{ print $2 }'`
+    local errors=`echo "${out}" | awk '{ print $4 }'`
+    kill ${pid}
+    wait ${pid} 2> /dev/null
+    if [ -z "${ok}" ] || [ "${ok}" -eq 0 ] || [ "${errors}" -ne 0 ]; then
+        echo "FAIL ${1}: ${ok:-no} requests, ${errors:-no} errors"
+        status=1
+    else
+        echo "ok   ${1}: ${ok} requests, ${errors} errors"
+    fi
+}
+
+run_case "threads, misses" "" "-k 1000000 -z 0"
+run_case "threads, hits" "" "-k 4"
+run_case "events, misses" "-e -w 1" "-k 1000000 -z 0"
+run_case "events, hits" "-e -w 1" "-k 4"
+run_pool_case "threads, pooled misses" "-k 4"
+run_pool_case "events, pooled misses" "-e -w 1 -k 4"
+run_version_case "threads, chunked fill then HTTP/1.0 hit" "-k 4"
+run_version_case "events, chunked fill then HTTP/1.0 hit" "-e -w 1 -k 4"
+exit ${status}
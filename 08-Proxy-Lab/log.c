@@ -0,0 +1,83 @@
+#include "csapp.h"
+#include "log.h"
+#include "stats.h"
+
+static LogSlot *ring; /* NULL while logging is off */
+static unsigned long enqueue_pos, dequeue_pos;
+static FILE *out;
+
+static void *logger(void *vargp);
+
+/* Log to path, or to stdout for "-"; without a path nothing is logged */
+void log_init(char *path) {
+    pthread_t tid;
+
+    if (path == NULL) return;
+    if (!strcmp(path, "-")) {
+        out = stdout;
+    } else if ((out = fopen(path, "a")) == NULL) {
+        unix_error("access log open error");
+        return;
+    }
+    ring = Malloc(LOG_SLOTS * sizeof(LogSlot));
+    for (unsigned long i = 0; i < LOG_SLOTS; i++) {
+        ring[i].seq = i;
+    }
+    Pthread_create(&tid, NULL, logger, NULL);
+}
+
+/*
+ * Claim the next ticket's slot if the logger has emptied it (Vyukov's
+ * bounded queue), fill it, then publish it by bumping its sequence.
+ */
+void log_access(char *url, int status, int hit, long bytes, long usec) {
+    unsigned long pos, seq;
+    struct timespec now;
+    LogSlot *s;
+
+    if (ring == NULL) return;
+
+    pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        s = &ring[pos & (LOG_SLOTS - 1)];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if ((long)(seq - pos) < 0) {
+            stats_count(CTR_LOG_DROPPED, 1);
+            return;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(s->line, LOG_LINE, "%ld.%03ld %d %s %ld %ldus %s\n",
+             (long)now.tv_sec, now.tv_nsec / 1000000, status,
+             hit ? "HIT" : "MISS", bytes, usec, url);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Drain the ring in order, flushing once per batch */
+static void *logger(void *vargp) {
+    LogSlot *s;
+    int n;
+
+    Pthread_detach(pthread_self());
+    while (1) {
+        for (n = 0;; n++) {
+            s = &ring[dequeue_pos & (LOG_SLOTS - 1)];
+            if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1) break;
+            fputs(s->line, out);
+            __atomic_store_n(&s->seq, dequeue_pos + LOG_SLOTS, __ATOMIC_RELEASE);
+            dequeue_pos++;
+        }
+        if (n > 0)
+            fflush(out);
+        else
+            usleep(10000);
+    }
+    return NULL;
+}
@@ -0,0 +1,22 @@
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_SLOTS 4096 /* ring entries; a power of two */
+#define LOG_LINE 256   /* longer lines are truncated */
+
+/*
+ * Asynchronous access log. Serving threads format a line into a slot of
+ * a bounded lock-free ring and move on; one logger thread drains it to
+ * the file in batches. When the ring is full the line is dropped and
+ * counted rather than stalling the request.
+ */
+typedef struct
+{
+    unsigned long seq; /* slot is free for ticket seq, or filled for seq - 1 */
+    char line[LOG_LINE];
+} LogSlot;
+
+void log_init(char *path);
+void log_access(char *url, int status, int hit, long bytes, long usec);
+
+#endif
@@ -0,0 +1,175 @@
+#include "policy.h"
+#include "sketch.h"
+
+/* New blocks go just behind the hand, so they get a full sweep first */
+static void ring_insert(Shard *s, Block *b) {
+    if (!s->hand) {
+        b->ring_prev = b->ring_next = b;
+        s->hand = b;
+        return;
+    }
+    b->ring_next = s->hand;
+    b->ring_prev = s->hand->ring_prev;
+    b->ring_prev->ring_next = b;
+    s->hand->ring_prev = b;
+}
+
+static void ring_remove(Shard *s, Block *b) {
+    if (b->ring_next == b) {
+        s->hand = NULL;
+        return;
+    }
+    if (s->hand == b) {
+        s->hand = b->ring_next;
+    }
+    b->ring_prev->ring_next = b->ring_next;
+    b->ring_next->ring_prev = b->ring_prev;
+}
+
+static void ring_init(Shard *s) {
+    s->hand = NULL;
+}
+
+/* CLOCK */
+
+static void clock_hit(Shard *s, Block *b) {
+    /* Readers race only on setting the same bit, the writer is excluded */
+    __atomic_store_n(&b->referenced, 1, __ATOMIC_RELAXED);
+}
+
+static void clock_insert(Shard *s, Block *b) {
+    b->referenced = 0;
+    ring_insert(s, b);
+}
+
+/*
+ * Second-chance eviction: advance the hand, clearing reference bits,
+ * until it rests on a block nobody has hit since the last sweep.
+ */
+static Block *clock_victim(Shard *s) {
+    while (s->hand->referenced) {
+        s->hand->referenced = 0;
+        s->hand = s->hand->ring_next;
+    }
+    return s->hand;
+}
+
+/* Where the hand would stop; if every bit is set, a full sweep returns to it */
+static Block *clock_peek(Shard *s) {
+    Block *b = s->hand;
+
+    do {
+        if (!b->referenced) return b;
+        b = b->ring_next;
+    } while (b != s->hand);
+    return s->hand;
+}
+
+Policy policy_clock = { "clock", ring_init, clock_hit, clock_insert, ring_remove, clock_victim, clock_peek };
+
+/* LRU: the ring in recency order, with the least recent block at the hand */
+
+static void lru_hit(Shard *s, Block *b) {
+    P(&s->hit_mutex);
+    if (s->hand->ring_prev != b) {
+        ring_remove(s, b);
+        ring_insert(s, b);
+    }
+    V(&s->hit_mutex);
+}
+
+static Block *lru_victim(Shard *s) {
+    return s->hand;
+}
+
+Policy policy_lru = { "lru", ring_init, lru_hit, ring_insert, ring_remove, lru_victim, lru_victim };
+
+/* GDSF: a binary min-heap on prio, sized for max_num blocks */
+
+static void heap_set(Shard *s, int i, Block *b) {
+    s->heap[i] = b;
+    b->heap_pos = i;
+}
+
+static void sift_up(Shard *s, int i) {
+    Block *b = s->heap[i];
+
+    while (i > 0 && s->heap[(i - 1) / 2]->prio > b->prio) {
+        heap_set(s, i, s->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(s, i, b);
+}
+
+static void sift_down(Shard *s, int i, int n) {
+    Block *b = s->heap[i];
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && s->heap[child + 1]->prio < s->heap[child]->prio) {
+            child++;
+        }
+        if (s->heap[child]->prio >= b->prio) break;
+        heap_set(s, i, s->heap[child]);
+        i = child;
+    }
+    heap_set(s, i, b);
+}
+
+static void gdsf_prio(Shard *s, Block *b) {
+    b->prio = s->clock + (double)b->freq / (b->size > 0 ? b->size : 1);
+}
+
+static void gdsf_init(Shard *s) {
+    s->heap = Malloc((s->max_num + 1) * sizeof(Block *));
+    s->clock = 0;
+}
+
+static void gdsf_hit(Shard *s, Block *b) {
+    P(&s->hit_mutex);
+    b->freq++;
+    gdsf_prio(s, b); /* only grows, so the block can only sink */
+    sift_down(s, b->heap_pos, s->num);
+    V(&s->hit_mutex);
+}
+
+/* Called before num counts b, which goes in the last slot */
+static void gdsf_insert(Shard *s, Block *b) {
+    int est = sketch_estimate(b->hash);
+
+    b->freq = est > 0 ? est : 1;
+    gdsf_prio(s, b);
+    heap_set(s, s->num, b);
+    sift_up(s, s->num);
+}
+
+/* Called before num drops: fill b's slot with the last block */
+static void gdsf_remove(Shard *s, Block *b) {
+    int last = s->num - 1;
+    Block *moved = s->heap[last];
+
+    if (moved == b) return;
+    heap_set(s, b->heap_pos, moved);
+    sift_up(s, moved->heap_pos);
+    sift_down(s, moved->heap_pos, last);
+}
+
+static Block *gdsf_victim(Shard *s) {
+    s->clock = s->heap[0]->prio;
+    return s->heap[0];
+}
+
+static Block *gdsf_peek(Shard *s) {
+    return s->heap[0];
+}
+
+Policy policy_gdsf = { "gdsf", gdsf_init, gdsf_hit, gdsf_insert, gdsf_remove, gdsf_victim, gdsf_peek };
+
+Policy *policy_find(char *name) {
+    Policy *all[] = { &policy_clock, &policy_lru, &policy_gdsf };
+
+    for (int i = 0; i < (int)(sizeof(all) / sizeof(all[0])); i++) {
+        if (!strcmp(all[i]->name, name)) return all[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include "cache.h"
+
+/*
+ * Eviction policies for cache shards:
+ *   clock - second chance on a reference bit; hits take no lock
+ *   lru   - exact least recently used list
+ *   gdsf  - Greedy-Dual-Size-Frequency: evicts the lowest freq / size,
+ *           aged by an inflation clock, so small hot objects outlive
+ *           large one-off ones
+ */
+extern Policy policy_clock, policy_lru, policy_gdsf;
+
+Policy *policy_find(char *name);
+
+#endif
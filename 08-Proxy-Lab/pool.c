@@ -0,0 +1,137 @@
+#include "pool.h"
+#include "stats.h"
+
+static Origin *origins[POOL_BUCKETS];
+static int max_per_host = 0; /* 0 disables pooling */
+static int timeout = DEFAULT_POOL_TIMEOUT;
+static time_t last_sweep;
+static sem_t mutex;
+
+void pool_init(int max_idle, int idle_timeout) {
+    max_per_host = max_idle > 0 ? max_idle : 0;
+    if (idle_timeout > 0) timeout = idle_timeout;
+    last_sweep = time(NULL);
+    Sem_init(&mutex, 0, 1);
+}
+
+int pool_enabled() {
+    return max_per_host > 0;
+}
+
+static Origin **lookup(char *hostname, char *port) {
+    unsigned int h = 2166136261u;
+    char *p;
+
+    for (p = hostname; *p; p++) h = (h ^ (unsigned char)tolower(*p)) * 16777619u;
+    for (p = port; *p; p++) h = (h ^ (unsigned char)*p) * 16777619u;
+
+    Origin **pp = &origins[h % POOL_BUCKETS];
+    while (*pp && (strcasecmp((*pp)->host, hostname) || strcmp((*pp)->port, port))) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+/* Close connections idle past the timeout, oldest first */
+static void expire(Origin *o, time_t now) {
+    int keep = 0;
+
+    for (int i = 0; i < o->num; i++) {
+        if (now - o->since[i] >= timeout) {
+            close(o->fds[i]);
+        } else {
+            o->fds[keep] = o->fds[i];
+            o->since[keep] = o->since[i];
+            keep++;
+        }
+    }
+    o->num = keep;
+}
+
+/* At most once a second, so origins nobody asks for still time out */
+static void sweep(time_t now) {
+    if (now == last_sweep) return;
+    last_sweep = now;
+    for (int i = 0; i < POOL_BUCKETS; i++) {
+        for (Origin *o = origins[i]; o; o = o->next) {
+            expire(o, now);
+        }
+    }
+}
+
+/* A usable idle socket has nothing to read: no EOF and no stray bytes */
+static int alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * Return an idle connection to hostname:port, or -1 if there is none.
+ * The socket is in blocking mode, as open_clientfd would return it.
+ */
+int pool_get(char *hostname, char *port) {
+    Origin *o;
+    time_t now = time(NULL);
+    int fd = -1;
+
+    if (!pool_enabled()) return -1;
+
+    P(&mutex);
+    sweep(now);
+    if ((o = *lookup(hostname, port)) != NULL) {
+        expire(o, now);
+        while (o->num > 0) {
+            fd = o->fds[--o->num];
+            if (alive(fd)) break;
+            close(fd);
+            fd = -1;
+        }
+    }
+    V(&mutex);
+
+    if (fd >= 0) stats_count(CTR_POOL_REUSES, 1);
+    return fd;
+}
+
+/* Park a connection whose last response was fully read, or close it */
+void pool_put(char *hostname, char *port, int fd) {
+    Origin **pp, *o;
+    time_t now = time(NULL);
+    int flags;
+
+    if (!pool_enabled()) {
+        close(fd);
+        return;
+    }
+    /* Callers may hand back non-blocking sockets from the event loop */
+    if ((flags = fcntl(fd, F_GETFL, 0)) >= 0) {
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    }
+
+    P(&mutex);
+    sweep(now);
+    if ((o = *(pp = lookup(hostname, port))) == NULL) {
+        o = Malloc(sizeof(Origin));
+        o->host = Malloc(strlen(hostname) + 1);
+        strcpy(o->host, hostname);
+        o->port = Malloc(strlen(port) + 1);
+        strcpy(o->port, port);
+        o->fds = Malloc(max_per_host * sizeof(int));
+        o->since = Malloc(max_per_host * sizeof(time_t));
+        o->num = 0;
+        o->next = NULL;
+        *pp = o;
+    }
+    if (o->num == max_per_host) {
+        /* Per-host limit reached: drop the one idle the longest */
+        close(o->fds[0]);
+        memmove(o->fds, o->fds + 1, (o->num - 1) * sizeof(int));
+        memmove(o->since, o->since + 1, (o->num - 1) * sizeof(time_t));
+        o->num--;
+    }
+    o->fds[o->num] = fd;
+    o->since[o->num] = now;
+    o->num++;
+    V(&mutex);
+}
@@ -0,0 +1,25 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "csapp.h"
+
+#define DEFAULT_POOL_TIMEOUT 30 /* seconds an idle connection is kept */
+#define POOL_BUCKETS 256
+
+/* Idle keep-alive connections to one (host, port) */
+typedef struct Origin
+{
+    char *host;
+    char *port;
+    int *fds;             /* idle sockets, most recently used last */
+    time_t *since;        /* when each one went idle */
+    int num;
+    struct Origin *next;
+} Origin;
+
+void pool_init(int max_idle, int idle_timeout);
+int pool_enabled();
+int pool_get(char *hostname, char *port);
+void pool_put(char *hostname, char *port, int fd);
+
+#endif
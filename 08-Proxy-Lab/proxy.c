@@ -1,37 +1,159 @@
-#include "csapp.h"
+#include <sys/resource.h>
+#include "proxy.h"
 #include "cache.h"
+#include "event.h"
+#include "http.h"
+#include "pool.h"
+#include "flight.h"
+#include "splice.h"
+#include "dns.h"
+#include "disk.h"
+#include "stats.h"
+#include "log.h"
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
 
-void doit(int fd);
-void parse_uri(char *uri, char *hostname, char *path, char *port);
-void build_http_header(char *http_header, char *hostname, char *path, char *port, rio_t *client_rio);
+int doit(int fd, rio_t *rio, long start);
 void *thread(void *vargp);
+static int fetch(int fd, char *hostname, char *port, char *http_header, char *url_key,
+                 int *leading, char *cache_buf, int *obj_size, int keep_alive,
+                 int *persistent, ReqStats *rs);
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-e] [-w <workers>] [-n <entries>] [-m <bytes>] [-p <policy>] [-a] [-k <idle>] [-t <secs>] [-b <bytes>] [-S] [-d <secs>] [-D <file>] [-M <bytes>] [-l <file>] <port>\n", prog);
+    fprintf(stderr, "  -e            serve with epoll event-loop workers instead of a thread per connection\n");
+    fprintf(stderr, "  -w <workers>  number of event-loop workers (implies -e, default: one per core)\n");
+    fprintf(stderr, "  -n <entries>  maximum number of cached objects (default: %d)\n", DEFAULT_CACHE_ENTRIES);
+    fprintf(stderr, "  -m <bytes>    cache byte budget (default: %d)\n", DEFAULT_CACHE_SIZE);
+    fprintf(stderr, "  -p <policy>   cache eviction policy: clock, lru or gdsf (default: clock)\n");
+    fprintf(stderr, "  -a            admit new objects only if requested as often as what they evict\n");
+    fprintf(stderr, "  -k <idle>     keep up to <idle> upstream connections per host alive for reuse (default: off)\n");
+    fprintf(stderr, "  -t <secs>     close pooled upstream connections idle this long (default: %d)\n", DEFAULT_POOL_TIMEOUT);
+    fprintf(stderr, "  -b <bytes>    relay uncacheable responses in chunks of this size (default: %d)\n", DEFAULT_RELAY_BUF);
+    fprintf(stderr, "  -S            copy uncacheable responses through user space instead of splice(2)\n");
+    fprintf(stderr, "  -d <secs>     reuse resolved origin addresses this long (default: %d)\n", DEFAULT_DNS_TTL);
+    fprintf(stderr, "  -D <file>     keep objects evicted from memory in this segment file across restarts\n");
+    fprintf(stderr, "  -M <bytes>    size of the segment file (default: %ld)\n", DEFAULT_DISK_SIZE);
+    fprintf(stderr, "  -l <file>     write an access log line per request to <file>, or - for stdout\n");
+    exit(1);
+}
+
+/*
+ * Lift the soft descriptor limit to the hard one: a client can hold its
+ * socket, an upstream socket and a splice pipe at once, and the common
+ * soft default of 1024 runs out long before the memory does.
+ */
+static void raise_nofile(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
 
 int main(int argc, char **argv)
 {
     int listenfd, *connfdp;
-    char hostname[MAXLINE], port[MAXLINE];
     socklen_t clientlen;
     struct sockaddr_storage clientaddr;
     pthread_t tid;
+    int opt, event_mode = 0, nworkers = 0, ncores, cache_entries = 0;
+    int pool_idle = 0, pool_timeout = 0, relay_buf = 0, use_splice = 1, dns_ttl = 0;
+    long cache_bytes = 0, disk_bytes = 0;
+    char *disk_path = NULL, *policy = "clock", *log_path = NULL;
+    int admit = 0;
 
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
-        exit(1);
+    while ((opt = getopt(argc, argv, "ew:n:m:p:ak:t:b:Sd:D:M:l:")) != -1) {
+        switch (opt) {
+        case 'e':
+            event_mode = 1;
+            break;
+        case 'w':
+            event_mode = 1;
+            nworkers = atoi(optarg);
+            if (nworkers <= 0)
+                usage(argv[0]);
+            break;
+        case 'n':
+            if ((cache_entries = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'm':
+            if ((cache_bytes = atol(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'p':
+            policy = optarg;
+            break;
+        case 'a':
+            admit = 1;
+            break;
+        case 'k':
+            if ((pool_idle = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 't':
+            if ((pool_timeout = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'b':
+            if ((relay_buf = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'S':
+            use_splice = 0;
+            break;
+        case 'd':
+            if ((dns_ttl = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'D':
+            disk_path = optarg;
+            break;
+        case 'M':
+            if ((disk_bytes = atol(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'l':
+            log_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
+    if (optind != argc - 1)
+        usage(argv[0]);
 
     Signal(SIGPIPE, SIG_IGN);
+    raise_nofile();
+    /* Threads beyond the core count don't touch the cache at once */
+    ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncores <= 0)
+        ncores = 1;
+    if (event_mode && nworkers == 0)
+        nworkers = ncores;
+    cache_config(cache_entries, cache_bytes, event_mode && nworkers < ncores ? nworkers : ncores);
+    if (cache_policy(policy, admit) < 0)
+        usage(argv[0]);
     cache_init();
+    disk_init(disk_path, disk_bytes);
+    pool_init(pool_idle, pool_timeout);
+    flight_init();
+    relay_config(relay_buf, use_splice);
+    dns_init(dns_ttl, 0);
+    log_init(log_path);
 
-    listenfd = Open_listenfd(argv[1]);
+    listenfd = Open_listenfd(argv[optind]);
+    if (event_mode)
+        event_run(listenfd, nworkers);
     while (1) {
         clientlen = sizeof(clientaddr);
         connfdp = Malloc(sizeof(int));
         *connfdp = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-        Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-        printf("Accepted connection from (%s, %s)\n", hostname, port);
         Pthread_create(&tid, NULL, thread, connfdp);
     }
     return 0;
@@ -40,155 +162,492 @@ int main(int argc, char **argv)
 void *thread(void *vargp)
 {
     int connfd = *((int *)vargp);
+    struct timeval idle = { CLIENT_IDLE_TIMEOUT, 0 };
+    long start = stats_now(); /* the first request is timed from accept */
+    rio_t rio;
+
     Pthread_detach(pthread_self());
     Free(vargp);
-    doit(connfd);
+
+    /*
+     * One rio_t for the whole connection: bytes of pipelined requests that
+     * were read ahead into rio_buf stay there for the next doit().
+     */
+    setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    Rio_readinitb(&rio, connfd);
+    while (doit(connfd, &rio, start))
+        start = 0;
     Close(connfd);
     return NULL;
 }
 
-void doit(int fd)
+static void flight_wake(void *arg)
+{
+    V((sem_t *)arg);
+}
+
+/*
+ * Look the object up, coalescing with a concurrent miss on the same URI:
+ * wait for that fetch and look again. Returns NULL with *leading set if
+ * the caller has to fetch it and call flight_finish().
+ */
+static Object *cache_find_or_wait(char *url_key, int *leading)
+{
+    Object *obj;
+    sem_t done;
+
+    *leading = 0;
+    if ((obj = cache_find(url_key)) != NULL)
+        return obj;
+
+    Sem_init(&done, 0, 0);
+    if (!flight_start(url_key, flight_wake, &done)) {
+        P(&done);
+        return cache_find(url_key);
+    }
+
+    /* The previous leader may have finished between the two calls */
+    if ((obj = cache_find(url_key)) != NULL) {
+        flight_finish(url_key);
+        return obj;
+    }
+    *leading = 1;
+    return NULL;
+}
+
+/*
+ * send_object - Write the n stored response bytes in data to the client
+ *     with a Connection header saying whether the connection stays open.
+ *     Returns 0, or -1 if the client went away.
+ */
+static int send_object(int fd, char *data, size_t n, int keep_alive, ReqStats *rs)
+{
+    struct iovec iov[3];
+    int cnt = http_conn_iov(iov, data, n, keep_alive);
+    ssize_t m;
+
+    while (cnt > 0) {
+        if ((m = writev(fd, iov, cnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        stats_sent(rs, m);
+        http_iov_advance(iov, &cnt, m);
+    }
+    return 0;
+}
+
+/* Send a fixed error reply; the connection closes after it */
+static void client_error(int fd, char *status, char *body, ReqStats *rs)
+{
+    char resp[MAXLINE];
+    int len = snprintf(resp, sizeof(resp),
+                       "HTTP/1.0 %s\r\n"
+                       "Connection: close\r\n"
+                       "Content-Type: text/plain\r\n"
+                       "Content-Length: %zu\r\n\r\n%s",
+                       status, strlen(body), body);
+
+    if (rio_writen(fd, resp, len) == len)
+        stats_sent(rs, len);
+    rs->status = atoi(status);
+}
+
+/*
+ * doit - Serve one request from the client connection. Returns nonzero
+ *     if the connection stays open for the next request. Latency counts
+ *     from start, or from the request line's arrival if start is 0.
+ */
+int doit(int fd, rio_t *rio, long start)
 {
     char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
     char hostname[MAXLINE], path[MAXLINE], port[MAXLINE];
     char http_header[MAXLINE];
-    rio_t rio;
-    int serverfd;
-    ssize_t n;
-    char *cache_buf = Malloc(MAX_OBJECT_SIZE);
+    char *cache_buf;
+    Object *obj;
     int obj_size = 0; /* accumulate full object size for caching */
+    int keep_alive, persistent, leading, len;
     char url_key[MAXLINE];
+    ReqStats rs;
 
-    Rio_readinitb(&rio, fd);
-    if (rio_readlineb(&rio, buf, MAXLINE) <= 0) {
-        Free(cache_buf);
-        return;
+    if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
+        return 0;
     }
+    stats_begin(&rs, start);
     /* Reject overlong request lines to avoid buffer misuse */
     if (strlen(buf) >= MAXLINE - 1 && buf[MAXLINE - 2] != '\n') {
-        const char *body = "URI too long\n";
-        char resp[MAXLINE];
-        int resp_len = snprintf(resp, sizeof(resp),
-                                "HTTP/1.0 414 Request-URI Too Long\r\n"
-                                "Connection: close\r\n"
-                                "Content-Type: text/plain\r\n"
-                                "Content-Length: %zu\r\n\r\n%s",
-                                strlen(body), body);
-        if (resp_len > 0) {
-            rio_writen(fd, resp, resp_len);
-        }
-        Free(cache_buf);
-        return;
+        client_error(fd, "414 Request-URI Too Long", "URI too long\n", &rs);
+        stats_count(CTR_ERRORS, 1);
+        return 0;
     }
-    printf("Request:\n");
-    printf("%s", buf);
     if (sscanf(buf, "%s %s %s", method, uri, version) != 3) {
-        Free(cache_buf);
-        return;
+        return 0;
     }
     strncpy(url_key, uri, MAXLINE - 1);
     url_key[MAXLINE - 1] = '\0';
 
     if (strcasecmp(method, "GET")) {
-        printf("Proxy does not implement the method");
-        Free(cache_buf);
-        return;
+        stats_count(CTR_ERRORS, 1);
+        return 0;
     }
 
-    if (cache_find(url_key, cache_buf, &obj_size)) {
-        rio_writen(fd, cache_buf, obj_size);
-        printf("Served from cache\n");
-        Free(cache_buf);
-        return;
+    /* Not a proxy request but one for us: report the metrics */
+    if (!strcmp(uri, METRICS_PATH)) {
+        while (rio_readlineb(rio, buf, MAXLINE) > 2)
+            ;
+        len = stats_reply(buf, MAXLINE);
+        if (rio_writen(fd, buf, len) == len)
+            stats_sent(&rs, len);
+        rs.status = 200;
+        stats_done(&rs, url_key);
+        return 0;
     }
 
     parse_uri(uri, hostname, path, port);
 
-    build_http_header(http_header, hostname, path, port, &rio);
+    /* Consume the client headers even on a hit, the next request follows */
+    keep_alive = build_http_header(http_header, hostname, path, port, version, rio);
 
-    serverfd = open_clientfd(hostname, port);
-    if (serverfd < 0) {
-        printf("Connection failed\n");
-        Free(cache_buf);
-        return;
+    if ((obj = cache_find_or_wait(url_key, &leading)) != NULL) {
+        persistent = keep_alive && http_object_persistent(obj->data, obj->size);
+        if (send_object(fd, obj->data, obj->size, persistent, &rs) < 0)
+            persistent = 0;
+        stats_count(CTR_HITS, 1);
+        rs.hit = 1;
+        rs.status = http_status(obj->data, obj->size);
+        stats_done(&rs, url_key);
+        cache_release(obj);
+        return persistent;
     }
 
-    if (rio_writen(serverfd, http_header, strlen(http_header)) != strlen(http_header)) {
-        Close(serverfd);
-        Free(cache_buf);
-        return;
+    stats_count(CTR_MISSES, 1);
+    cache_buf = Malloc(MAX_OBJECT_SIZE);
+
+    if (fetch(fd, hostname, port, http_header, url_key, &leading,
+              cache_buf, &obj_size, keep_alive, &persistent, &rs) < 0) {
+        stats_count(CTR_ERRORS, 1);
+        persistent = 0;
+    } else if (obj_size >= 0) {
+        cache_add(url_key, cache_buf, obj_size);
+    }
+    if (leading) {
+        flight_finish(url_key);
     }
 
-    while ((n = read(serverfd, buf, MAXLINE)) != 0) {
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            if (errno == ECONNRESET) break;
-            break;
+    Free(cache_buf);
+    stats_done(&rs, url_key);
+    return persistent;
+}
+
+/*
+ * fetch - Send the request upstream, over an idle pooled connection when
+ *     there is one, and relay the response to the client while filling
+ *     cache_buf. The headers are held in cache_buf until complete, then
+ *     sent with their hop-by-hop lines replaced by a Connection header
+ *     for this client; headers too long to hold there get a 502 instead.
+ *     Returns 0 if the complete response was relayed, and sets
+ *     *persistent if the client asked to keep_alive and the response's
+ *     framing lets the connection carry on.
+ *     A leader whose object turns out too large to cache releases the
+ *     requests coalesced on url_key right away and clears *leading.
+ */
+static int fetch(int fd, char *hostname, char *port, char *http_header, char *url_key,
+                 int *leading, char *cache_buf, int *obj_size, int keep_alive,
+                 int *persistent, ReqStats *rs)
+{
+    char *dst, *relay = NULL;
+    http_resp_t resp;
+    int serverfd, reused, clean, held, rewritten = 0, refused = 0, pipefd[2] = { -1, -1 };
+    ssize_t n, m, off, used, out;
+    size_t room, len = strlen(http_header);
+    long raw, t;
+
+    while (1) {
+        reused = 1;
+        if ((serverfd = pool_get(hostname, port)) < 0) {
+            reused = 0;
+            t = stats_now();
+            serverfd = dns_open_clientfd(hostname, port);
+            if (serverfd < 0) {
+                break;
+            }
+            stats_record(HIST_CONNECT, stats_now() - t);
+            stats_count(CTR_CONNECTS, 1);
         }
-        
-        if (rio_writen(fd, buf, n) != n) {
-            if (errno == EPIPE) break;
-            break;
+
+        http_resp_init(&resp);
+        clean = 1;
+        held = 0;
+        if (rio_writen(serverfd, http_header, len) != len) {
+            clean = 0;
         }
+        t = stats_now(); /* cleared once the first response byte is in */
+
+        while (clean) {
+            raw = http_resp_raw(&resp);
+
+            /*
+             * While the object may still be cached, read straight into the
+             * cache buffer; give up as soon as it can't fit, either because
+             * the buffer is full or the declared length is too large.
+             */
+            if (*obj_size >= 0) {
+                room = MAX_OBJECT_SIZE - *obj_size;
+                if (room == 0 || (raw != LONG_MAX && raw > (long)room)) {
+                    /* Headers too long to hold can't be rewritten: refuse them */
+                    if (held > 0) {
+                        client_error(fd, "502 Bad Gateway", "Response headers too long\n", rs);
+                        refused = 1;
+                        clean = 0;
+                        break;
+                    }
+                    *obj_size = -1; /* mark as too large to cache */
+                    if (*leading) {
+                        flight_finish(url_key);
+                        *leading = 0;
+                    }
+                }
+            }
 
-        /* accumulate entire object into cache buffer until size limit */
-        if (obj_size >= 0 && obj_size + n <= MAX_OBJECT_SIZE) {
-            memcpy(cache_buf + obj_size, buf, n);
-            obj_size += n;
-        } else {
-            obj_size = -1; /* mark as too large to cache */
+            /* Opaque uncacheable body: move it socket to socket in the kernel */
+            if (*obj_size < 0 && raw > 0 && relay_use_splice &&
+                (pipefd[0] >= 0 || relay_pipe(pipefd) == 0)) {
+                n = relay_splice(serverfd, pipefd[1],
+                                 raw < relay_bufsize ? raw : relay_bufsize, 0);
+                if (n == 0) break;
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    clean = 0;
+                    break;
+                }
+                stats_count(CTR_BYTES_UPSTREAM, n);
+                for (off = 0; off < n; off += m) {
+                    if ((m = relay_splice(pipefd[0], fd, n - off, 0)) <= 0) {
+                        if (m < 0 && errno == EINTR) {
+                            m = 0;
+                            continue;
+                        }
+                        clean = 0;
+                        break;
+                    }
+                    stats_sent(rs, m);
+                }
+                if (!clean) break;
+                http_resp_skip(&resp, n);
+                if (resp.done) break;
+                continue;
+            }
+
+            if (*obj_size >= 0) {
+                dst = cache_buf + *obj_size;
+            } else {
+                if (relay == NULL)
+                    relay = Malloc(relay_bufsize);
+                dst = relay;
+                room = relay_bufsize;
+            }
+            if ((n = read(serverfd, dst, room)) == 0) break;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                clean = 0;
+                break;
+            }
+            if (t) {
+                stats_record(HIST_TTFB, stats_now() - t);
+                t = 0;
+            }
+            stats_count(CTR_BYTES_UPSTREAM, n);
+
+            used = http_resp_feed(&resp, dst, n);
+            if (resp.done)
+                clean = (used == n); /* stray bytes past the response */
+            if (*obj_size == held && !rewritten && resp.hdr_end != 0) {
+                /* Still in cache_buf from its start, rewrite once complete */
+                held += used;
+                *obj_size += used;
+                if (resp.hdr_end < 0)
+                    continue;
+                out = http_resp_rewrite(&resp, cache_buf, held);
+                *obj_size = out;
+                held = 0;
+                rewritten = 1;
+                if (resp.chunked) {
+                    /* Framed for this client's version, not for any other */
+                    *obj_size = -1;
+                    if (*leading) {
+                        flight_finish(url_key);
+                        *leading = 0;
+                    }
+                }
+                if (send_object(fd, cache_buf, out, keep_alive && resp.framed, rs) < 0) {
+                    clean = 0;
+                    break;
+                }
+            } else {
+                if (*obj_size >= 0)
+                    *obj_size += used;
+                if (rio_writen(fd, dst, used) != used) {
+                    clean = 0;
+                    break;
+                }
+                stats_sent(rs, used);
+            }
+
+            if (resp.done)
+                break;
+        }
+        if (clean && !resp.done) {
+            http_resp_eof(&resp);
         }
+
+        /* The origin closed an idle pooled connection before answering */
+        if (reused && resp.total == 0) {
+            Close(serverfd);
+            continue;
+        }
+        break;
     }
 
-    if (obj_size >= 0) {
-        cache_add(url_key, cache_buf, obj_size);
+    if (relay)
+        Free(relay);
+    if (pipefd[0] >= 0) {
+        Close(pipefd[0]);
+        Close(pipefd[1]);
     }
+    if (serverfd < 0)
+        return -1;
 
-    Close(serverfd);
-    Free(cache_buf);
+    if (!refused)
+        rs->status = resp.status;
+    *persistent = rewritten && keep_alive && http_resp_framed(&resp);
+    if (!rewritten && resp.hdr_end != 0)
+        *obj_size = -1; /* the origin's Connection header is in it */
+    if (clean && http_resp_reusable(&resp)) {
+        pool_put(hostname, port, serverfd);
+    } else {
+        Close(serverfd);
+    }
+    return resp.done ? 0 : -1;
 }
 
+/*
+ * Sort one client header line into the Host header or the pass-through
+ * set, noting whether the client asked to keep its connection open
+ */
+static void add_client_header(char *line, char *host_hdr, char *other_hdr, int *keep_alive)
+{
+    if(!strncasecmp(line, "Host", 4)) {
+        strcpy(host_hdr, line);
+        return;
+    }
+
+    if(!strncasecmp(line, "Connection", 10) ||
+       !strncasecmp(line, "Proxy-Connection", 16)) {
+        if (http_has_token(line, "close"))
+            *keep_alive = 0;
+        else if (http_has_token(line, "keep-alive"))
+            *keep_alive = 1;
+        return;
+    }
+
+    if(!strncasecmp(line, "User-Agent", 10)) {
+        return;
+    }
 
+    if(strlen(other_hdr) + strlen(line) < MAXLINE)
+        strcat(other_hdr, line);
+}
 
-void build_http_header(char *http_header, char *hostname, char *path, char *port, rio_t *client_rio)
+/*
+ * With pooling off every upstream request is HTTP/1.0 and closes. With it
+ * on, HTTP/1.1 clients get an HTTP/1.1 request, which is persistent by
+ * default; HTTP/1.0 clients, which may not understand a chunked reply, get
+ * an HTTP/1.0 request that asks for keep-alive explicitly. The cache is
+ * keyed on the URI alone, so a chunked reply is relayed but never cached.
+ */
+static void finish_http_header(char *http_header, char *hostname, char *path,
+                               char *version, char *host_hdr, char *other_hdr)
 {
-    char buf[MAXLINE], request_hdr[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
-    
-    sprintf(request_hdr, "GET %s HTTP/1.0\r\n", path);
-    
+    char request_hdr[MAXLINE];
+    int http11 = pool_enabled() && !strcasecmp(version, "HTTP/1.1");
+
+    snprintf(request_hdr, MAXLINE, "GET %s HTTP/1.%d\r\n", path, http11);
+
+    if(strlen(host_hdr) == 0) {
+        sprintf(host_hdr, "Host: %s\r\n", hostname);
+    }
+
+    if (!pool_enabled()) {
+        sprintf(http_header, "%s%s%s%s%s%s\r\n",
+                request_hdr,
+                host_hdr,
+                "Connection: close\r\n",
+                "Proxy-Connection: close\r\n",
+                user_agent_hdr,
+                other_hdr);
+    } else {
+        sprintf(http_header, "%s%s%s%s%s\r\n",
+                request_hdr,
+                host_hdr,
+                http11 ? "" : "Connection: keep-alive\r\n",
+                user_agent_hdr,
+                other_hdr);
+    }
+}
+
+/*
+ * build_http_header - Read the client headers and build the upstream
+ *     request. Returns nonzero if the client wants a persistent connection
+ *     (the HTTP/1.1 default unless it sent "close").
+ */
+int build_http_header(char *http_header, char *hostname, char *path, char *port, char *version, rio_t *client_rio)
+{
+    char buf[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
+    int keep_alive = !strcasecmp(version, "HTTP/1.1");
+    ssize_t n;
+
     other_hdr[0] = '\0';
     host_hdr[0] = '\0';
 
-    while(rio_readlineb(client_rio, buf, MAXLINE) > 0) {
+    while((n = rio_readlineb(client_rio, buf, MAXLINE)) > 0) {
         if(strcmp(buf, "\r\n") == 0) break;
-        
-        if(!strncasecmp(buf, "Host", 4)) {
-            strcpy(host_hdr, buf);
-            continue;
-        }
-        
-        if(!strncasecmp(buf, "Connection", 10) ||
-           !strncasecmp(buf, "Proxy-Connection", 16) ||
-           !strncasecmp(buf, "User-Agent", 10)) {
-            continue;
-        }
-        
-        strcat(other_hdr, buf);
+        add_client_header(buf, host_hdr, other_hdr, &keep_alive);
     }
-    
-    if(strlen(host_hdr) == 0) {
-        sprintf(host_hdr, "Host: %s\r\n", hostname);
+    if (n <= 0)
+        keep_alive = 0;
+
+    finish_http_header(http_header, hostname, path, version, host_hdr, other_hdr);
+    return keep_alive;
+}
+
+/*
+ * build_http_header_buf - Same as build_http_header, but takes the client
+ *     headers already read into memory (NUL-terminated, CRLF-separated,
+ *     without the final blank line), as the event loop has them.
+ */
+int build_http_header_buf(char *http_header, char *hostname, char *path, char *version, char *headers)
+{
+    char buf[MAXLINE], other_hdr[MAXLINE], host_hdr[MAXLINE];
+    char *line = headers, *eol;
+    int keep_alive = !strcasecmp(version, "HTTP/1.1");
+    size_t len;
+
+    other_hdr[0] = '\0';
+    host_hdr[0] = '\0';
+
+    while (*line && (eol = strstr(line, "\r\n")) != NULL) {
+        len = eol + 2 - line;
+        if (len < MAXLINE) {
+            memcpy(buf, line, len);
+            buf[len] = '\0';
+            add_client_header(buf, host_hdr, other_hdr, &keep_alive);
+        }
+        line = eol + 2;
     }
-    
-    sprintf(http_header, "%s%s%s%s%s%s\r\n",
-            request_hdr,
-            host_hdr,
-            "Connection: close\r\n",
-            "Proxy-Connection: close\r\n",
-            user_agent_hdr,
-            other_hdr);
-    
-    return;
+
+    finish_http_header(http_header, hostname, path, version, host_hdr, other_hdr);
+    return keep_alive;
 }
 
 void parse_uri(char *uri, char *hostname, char *path, char *port)
@@ -0,0 +1,13 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "csapp.h"
+
+#define CLIENT_IDLE_TIMEOUT 15 /* seconds a client connection may sit idle */
+
+/* HTTP helpers shared by the thread-per-connection and event-loop paths */
+void parse_uri(char *uri, char *hostname, char *path, char *port);
+int build_http_header(char *http_header, char *hostname, char *path, char *port, char *version, rio_t *client_rio);
+int build_http_header_buf(char *http_header, char *hostname, char *path, char *version, char *headers);
+
+#endif
@@ -0,0 +1,515 @@
+/*
+ * proxybench - Load generator for the proxy, with its own origin server.
+ *
+ * The built-in origin serves /obj/<key> with a body whose size is a fixed
+ * function of the key, drawn from the configured size distribution. Client
+ * threads each keep one connection to the proxy and request keys whose
+ * popularity follows a Zipf law, either back to back (closed loop) or at a
+ * fixed aggregate rate with exponential gaps (open loop). Open-loop latency
+ * is measured from when a request was due, not when it went out, so a
+ * stalled proxy can't hide its queueing delay.
+ *
+ * The hit ratio is 1 - (requests the origin saw) / (requests completed).
+ *
+ * With -C the origin frames bodies for HTTP/1.1 requests with chunked
+ * encoding, and with -m every other client speaks HTTP/1.0. A chunked
+ * reply reaching an HTTP/1.0 client counts as an error, which catches a
+ * proxy serving one client's framing to another.
+ */
+#include <math.h>
+#include <sys/uio.h>
+#include "csapp.h"
+
+#define DEFAULT_ORIGIN_PORT "15400"
+#define DEFAULT_CONNS 16
+#define DEFAULT_SECS 10
+#define DEFAULT_KEYS 1000
+#define DEFAULT_ZIPF 0.99
+#define MAX_BODY (4 << 20)
+
+typedef enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_PARETO } size_kind;
+
+typedef struct
+{
+    size_kind kind;
+    long a, b;        /* fixed: a; uniform: [a, b]; pareto: min a, cap b */
+    double alpha;     /* pareto shape */
+} size_dist;
+
+typedef struct
+{
+    pthread_t tid;
+    unsigned long rng;
+    long *lat;        /* completed request latencies, us */
+    long nlat, cap;
+    long bytes, errors;
+    long conns;       /* connections opened to the target */
+    int minor;        /* requests are HTTP/1.<minor> */
+} client_t;
+
+static char *proxy_host, *proxy_port; /* NULL: talk to the origin directly */
+static char *origin_port = DEFAULT_ORIGIN_PORT;
+static int nconns = DEFAULT_CONNS, nkeys = DEFAULT_KEYS;
+static double zipf_s = DEFAULT_ZIPF, rate;
+static double *zipf_cdf;
+static int chunked_origin, mixed_versions;
+static size_dist sizes = { SIZE_FIXED, 8192, 8192, 0 };
+static volatile int running = 1;
+static long origin_served;
+static char body[MAX_BODY];
+
+static long now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* splitmix64: a fast, well-mixed generator, also used to hash keys */
+static unsigned long mix(unsigned long x)
+{
+    x += 0x9e3779b97f4a7c15UL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+/* Uniform in (0, 1) */
+static double uniform(unsigned long *state)
+{
+    *state = mix(*state);
+    return ((*state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* The body size of key, the same on every run */
+static long size_of(int key)
+{
+    unsigned long h = key + 1;
+    double u = uniform(&h);
+    long n;
+
+    switch (sizes.kind) {
+    case SIZE_UNIFORM:
+        return sizes.a + (long)(u * (sizes.b - sizes.a + 1));
+    case SIZE_PARETO:
+        n = (long)(sizes.a / pow(u, 1.0 / sizes.alpha));
+        return n < sizes.b ? n : sizes.b;
+    default:
+        return sizes.a;
+    }
+}
+
+static void zipf_init()
+{
+    double sum = 0;
+
+    zipf_cdf = Malloc(nkeys * sizeof(double));
+    for (int i = 0; i < nkeys; i++) {
+        sum += 1.0 / pow(i + 1, zipf_s);
+        zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < nkeys; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+/* Key of popularity rank k has probability proportional to 1 / k^s */
+static int zipf_key(unsigned long *state)
+{
+    double u = uniform(state);
+    int lo = 0, hi = nkeys - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Whether a Connection header line carries the close token */
+static int says_close(char *hdr)
+{
+    for (char *p = hdr + 11; *p; p++) {
+        if (!strncasecmp(p, "close", 5))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Write a header, n bytes of body and a tail (chunk framing, or "") in one
+ * go: separate writes would leave the rest behind Nagle waiting on the
+ * peer's delayed ACK.
+ */
+static int send_all(int fd, char *hdr, size_t len, size_t n, char *tail)
+{
+    struct iovec iov[3] = { { hdr, len }, { body, n }, { tail, strlen(tail) } };
+    ssize_t rc;
+
+    while (iov[0].iov_len + iov[1].iov_len + iov[2].iov_len > 0) {
+        if ((rc = writev(fd, iov, 3)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (int i = 0; i < 3; i++) {
+            size_t k = (size_t)rc < iov[i].iov_len ? (size_t)rc : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + k;
+            iov[i].iov_len -= k;
+            rc -= k;
+        }
+    }
+    return 0;
+}
+
+/* Origin side: one thread per connection, keep-alive unless asked not to */
+static void *origin_conn(void *vargp)
+{
+    int fd = *(int *)vargp, key, close_after, http10;
+    char line[MAXLINE], hdr[MAXLINE];
+    rio_t rio;
+    long n;
+
+    Pthread_detach(pthread_self());
+    Free(vargp);
+    Rio_readinitb(&rio, fd);
+    while (rio_readlineb(&rio, line, MAXLINE) > 0) {
+        close_after = http10 = strstr(line, "HTTP/1.0") != NULL;
+        if (sscanf(line, "GET /obj/%d", &key) != 1 || key < 0)
+            key = -1;
+        while (rio_readlineb(&rio, hdr, MAXLINE) > 2) {
+            if (!strncasecmp(hdr, "Connection:", 11))
+                close_after = says_close(hdr);
+        }
+        if (key < 0) {
+            n = snprintf(hdr, MAXLINE, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n%s\r\n",
+                         close_after ? "Connection: close\r\n" : "");
+            rio_writen(fd, hdr, n);
+        } else {
+            __atomic_add_fetch(&origin_served, 1, __ATOMIC_RELAXED);
+            n = size_of(key);
+            if (chunked_origin && !http10) {
+                /* The whole body as one chunk, if any, then the last chunk */
+                sprintf(hdr, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                             "Transfer-Encoding: chunked\r\n%s\r\n%lx\r\n",
+                        close_after ? "Connection: close\r\n" : "", n);
+                if (send_all(fd, hdr, strlen(hdr), n, n ? "\r\n0\r\n\r\n" : "\r\n") < 0)
+                    break;
+            } else {
+                sprintf(hdr, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                             "Content-Length: %ld\r\n%s\r\n",
+                        n, close_after ? "Connection: close\r\n" : "");
+                if (send_all(fd, hdr, strlen(hdr), n, "") < 0)
+                    break;
+            }
+        }
+        if (close_after)
+            break;
+    }
+    Close(fd);
+    return NULL;
+}
+
+static void *origin(void *vargp)
+{
+    int listenfd = *(int *)vargp, *fdp;
+    pthread_t tid;
+
+    while (1) {
+        fdp = Malloc(sizeof(int));
+        if ((*fdp = accept(listenfd, NULL, NULL)) < 0) {
+            Free(fdp);
+            continue;
+        }
+        Pthread_create(&tid, NULL, origin_conn, fdp);
+    }
+    return NULL;
+}
+
+static int connect_target()
+{
+    if (proxy_host)
+        return open_clientfd(proxy_host, proxy_port);
+    return open_clientfd("localhost", origin_port);
+}
+
+/* Read and drop n body bytes */
+static int skip_body(rio_t *rio, long n)
+{
+    char buf[MAXLINE];
+    long k;
+
+    for (; n > 0; n -= k) {
+        if ((k = rio_readnb(rio, buf, n < MAXLINE ? n : MAXLINE)) <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Read a chunked body through its trailer; returns its length or -1 */
+static long read_chunked(rio_t *rio)
+{
+    char buf[MAXLINE];
+    long len = 0, size, n;
+
+    while (1) {
+        if (rio_readlineb(rio, buf, MAXLINE) <= 0 || (size = strtol(buf, NULL, 16)) < 0)
+            return -1;
+        if (size == 0)
+            break;
+        if (skip_body(rio, size) < 0 || rio_readlineb(rio, buf, MAXLINE) <= 0)
+            return -1;
+        len += size;
+    }
+    while ((n = rio_readlineb(rio, buf, MAXLINE)) > 2)
+        ;
+    return n <= 0 ? -1 : len;
+}
+
+/*
+ * Send one request as HTTP/1.<minor> and read the whole response. Returns
+ * the body length, or -1 on error; *reopen is set when the connection
+ * can't be reused. HTTP/1.0 requests ask for keep-alive explicitly.
+ */
+static long request(int fd, rio_t *rio, int key, int minor, int *reopen)
+{
+    char buf[MAXLINE], *keep = minor ? "" : "Connection: keep-alive\r\n";
+    long len = -1, n;
+    int status = 0, chunked = 0;
+
+    if (proxy_host)
+        n = snprintf(buf, MAXLINE, "GET http://localhost:%s/obj/%d HTTP/1.%d\r\n"
+                                   "Host: localhost:%s\r\n%s\r\n",
+                     origin_port, key, minor, origin_port, keep);
+    else
+        n = snprintf(buf, MAXLINE, "GET /obj/%d HTTP/1.%d\r\nHost: localhost:%s\r\n%s\r\n",
+                     key, minor, origin_port, keep);
+    *reopen = 1;
+    if (rio_writen(fd, buf, n) != n || rio_readlineb(rio, buf, MAXLINE) <= 0)
+        return -1;
+    sscanf(buf, "HTTP/1.%*d %d", &status);
+    *reopen = !minor || strstr(buf, "HTTP/1.0") != NULL;
+    while ((n = rio_readlineb(rio, buf, MAXLINE)) > 2) {
+        if (!strncasecmp(buf, "Content-Length:", 15))
+            len = atol(buf + 15);
+        else if (!strncasecmp(buf, "Transfer-Encoding:", 18))
+            chunked = strstr(buf + 18, "chunked") != NULL;
+        else if (!strncasecmp(buf, "Connection:", 11))
+            *reopen = says_close(buf);
+    }
+    /* An HTTP/1.0 client has no way to read a chunked body */
+    if (n <= 0 || (chunked ? !minor : len < 0)) {
+        *reopen = 1;
+        return -1;
+    }
+    if (chunked)
+        len = read_chunked(rio);
+    else if (skip_body(rio, len) < 0)
+        len = -1;
+    if (len < 0) {
+        *reopen = 1;
+        return -1;
+    }
+    return status == 200 && len == size_of(key) ? len : -1;
+}
+
+static void record(client_t *c, long us)
+{
+    if (c->nlat == c->cap) {
+        c->cap = c->cap ? 2 * c->cap : 4096;
+        c->lat = Realloc(c->lat, c->cap * sizeof(long));
+    }
+    c->lat[c->nlat++] = us;
+}
+
+static void *client(void *vargp)
+{
+    client_t *c = vargp;
+    double per_thread = rate / nconns;
+    long due = now_us(), t, n;
+    int fd = -1, reopen = 0;
+    rio_t rio;
+
+    while (running) {
+        if (rate > 0) {
+            /* Poisson arrivals at this thread's share of the rate */
+            due += (long)(-log(uniform(&c->rng)) * 1e6 / per_thread);
+            if ((t = now_us()) < due)
+                usleep(due - t);
+            if (!running)
+                break;
+        } else {
+            due = now_us();
+        }
+        if (fd < 0) {
+            if ((fd = connect_target()) < 0) {
+                c->errors++;
+                usleep(1000);
+                continue;
+            }
+            Rio_readinitb(&rio, fd);
+            c->conns++;
+        }
+        if ((n = request(fd, &rio, zipf_key(&c->rng), c->minor, &reopen)) < 0) {
+            c->errors++;
+        } else {
+            record(c, now_us() - due);
+            c->bytes += n;
+        }
+        if (reopen) {
+            Close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        Close(fd);
+    return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+static long percentile(long *v, long n, double q)
+{
+    long i = (long)(q * n);
+    return n ? v[i < n ? i : n - 1] : 0;
+}
+
+static int parse_sizes(char *spec)
+{
+    if (sscanf(spec, "fixed:%ld", &sizes.a) == 1) {
+        sizes.kind = SIZE_FIXED;
+        sizes.b = sizes.a;
+    } else if (sscanf(spec, "uniform:%ld:%ld", &sizes.a, &sizes.b) == 2 && sizes.a <= sizes.b) {
+        sizes.kind = SIZE_UNIFORM;
+    } else if (sscanf(spec, "pareto:%ld:%lf:%ld", &sizes.a, &sizes.alpha, &sizes.b) == 3 &&
+               sizes.alpha > 0 && sizes.a <= sizes.b) {
+        sizes.kind = SIZE_PARETO;
+    } else {
+        return -1;
+    }
+    return sizes.a >= 0 && sizes.b <= MAX_BODY ? 0 : -1;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "usage: %s [-p <host:port>] [-o <port>] [-c <conns>] [-d <secs>] [-r <rate>] [-k <keys>] [-z <s>] [-s <sizes>] [-C] [-m]\n", prog);
+    fprintf(stderr, "  -p <host:port> proxy to load (default: request the origin directly)\n");
+    fprintf(stderr, "  -o <port>      port for the built-in origin (default: %s)\n", DEFAULT_ORIGIN_PORT);
+    fprintf(stderr, "  -c <conns>     concurrent client connections (default: %d)\n", DEFAULT_CONNS);
+    fprintf(stderr, "  -d <secs>      run time (default: %d)\n", DEFAULT_SECS);
+    fprintf(stderr, "  -r <rate>      open loop at <rate> requests/s in total (default: closed loop)\n");
+    fprintf(stderr, "  -k <keys>      number of distinct objects (default: %d)\n", DEFAULT_KEYS);
+    fprintf(stderr, "  -z <s>         Zipf exponent of key popularity, 0 for uniform (default: %g)\n", DEFAULT_ZIPF);
+    fprintf(stderr, "  -s <sizes>     fixed:N, uniform:MIN:MAX or pareto:MIN:ALPHA:MAX bytes (default: fixed:8192)\n");
+    fprintf(stderr, "  -C             origin sends chunked bodies to HTTP/1.1 requests\n");
+    fprintf(stderr, "  -m             every other client speaks HTTP/1.0\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, secs = DEFAULT_SECS, listenfd;
+    long total = 0, errors = 0, bytes = 0, conns = 0, *all, t0, elapsed;
+    client_t *clients;
+    pthread_t tid;
+    char *colon;
+
+    while ((opt = getopt(argc, argv, "p:o:c:d:r:k:z:s:Cm")) != -1) {
+        switch (opt) {
+        case 'p':
+            if ((colon = strrchr(optarg, ':')) == NULL)
+                usage(argv[0]);
+            *colon = '\0';
+            proxy_host = optarg;
+            proxy_port = colon + 1;
+            break;
+        case 'o':
+            origin_port = optarg;
+            break;
+        case 'c':
+            if ((nconns = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'd':
+            if ((secs = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'r':
+            if ((rate = atof(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'k':
+            if ((nkeys = atoi(optarg)) <= 0)
+                usage(argv[0]);
+            break;
+        case 'z':
+            if ((zipf_s = atof(optarg)) < 0)
+                usage(argv[0]);
+            break;
+        case 's':
+            if (parse_sizes(optarg) < 0)
+                usage(argv[0]);
+            break;
+        case 'C':
+            chunked_origin = 1;
+            break;
+        case 'm':
+            mixed_versions = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    Signal(SIGPIPE, SIG_IGN);
+    memset(body, 'x', sizeof(body));
+    zipf_init();
+    listenfd = Open_listenfd(origin_port);
+    Pthread_create(&tid, NULL, origin, &listenfd);
+
+    clients = Calloc(nconns, sizeof(client_t));
+    t0 = now_us();
+    for (int i = 0; i < nconns; i++) {
+        clients[i].rng = mix(t0 + i);
+        clients[i].minor = !(mixed_versions && (i & 1));
+        Pthread_create(&clients[i].tid, NULL, client, &clients[i]);
+    }
+    sleep(secs);
+    running = 0;
+    for (int i = 0; i < nconns; i++) {
+        Pthread_join(clients[i].tid, NULL);
+        total += clients[i].nlat;
+        errors += clients[i].errors;
+        bytes += clients[i].bytes;
+        conns += clients[i].conns;
+    }
+    elapsed = now_us() - t0;
+
+    all = Malloc((total ? total : 1) * sizeof(long));
+    for (int i = 0, k = 0; i < nconns; k += clients[i].nlat, i++) {
+        memcpy(all + k, clients[i].lat, clients[i].nlat * sizeof(long));
+    }
+    qsort(all, total, sizeof(long), cmp_long);
+
+    printf("%s, %d conns, %d keys, zipf %g, %ld s\n",
+           rate > 0 ? "open loop" : "closed loop", nconns, nkeys, zipf_s, elapsed / 1000000);
+    printf("requests   %ld ok, %ld errors\n", total, errors);
+    printf("conns      %ld, %.1f requests each\n", conns, conns ? (double)total / conns : 0.0);
+    printf("throughput %.0f req/s, %.1f MB/s\n",
+           total * 1e6 / elapsed, bytes / (double)elapsed);
+    printf("latency us p50 %ld  p99 %ld  p999 %ld  max %ld\n",
+           percentile(all, total, 0.5), percentile(all, total, 0.99),
+           percentile(all, total, 0.999), total ? all[total - 1] : 0);
+    printf("hit ratio  %.3f\n", total ? 1.0 - (double)origin_served / total : 0.0);
+    exit(0);
+}
@@ -0,0 +1,63 @@
+#include "csapp.h"
+#include "sketch.h"
+
+static uint8_t *rows[SKETCH_ROWS];
+static unsigned int mask;
+static unsigned long added, reset_at;
+static __thread unsigned int pending; /* adds not yet counted in added */
+
+/* Size the rows to the number of objects the cache can hold */
+void sketch_init(int entries) {
+    unsigned int width = 64;
+
+    while (width < 4u * entries) width <<= 1;
+    for (int i = 0; i < SKETCH_ROWS; i++) {
+        rows[i] = Calloc(width, 1);
+    }
+    mask = width - 1;
+    added = 0;
+    reset_at = (unsigned long)SKETCH_SAMPLE * width;
+}
+
+/* Row i uses h1 + i * h2, so one 32-bit hash gives every row a slot */
+static unsigned int slot(unsigned int hash, int i) {
+    unsigned int h2 = ((hash * 0x9e3779b1u) >> 16) | 1;
+    return (hash + i * h2) & mask;
+}
+
+/* Age the sketch so yesterday's hot objects don't stay admitted forever */
+static void halve() {
+    for (int i = 0; i < SKETCH_ROWS; i++) {
+        for (unsigned int j = 0; j <= mask; j++) {
+            __atomic_store_n(&rows[i][j], rows[i][j] >> 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void sketch_add(unsigned int hash) {
+    uint8_t *c;
+
+    for (int i = 0; i < SKETCH_ROWS; i++) {
+        c = &rows[i][slot(hash, i)];
+        if (__atomic_load_n(c, __ATOMIC_RELAXED) < SKETCH_MAX) {
+            __atomic_add_fetch(c, 1, __ATOMIC_RELAXED);
+        }
+    }
+    /* Publish in batches so hits don't all bump one shared counter */
+    if (++pending < SKETCH_BATCH) return;
+    pending = 0;
+    if (__atomic_add_fetch(&added, SKETCH_BATCH, __ATOMIC_RELAXED) % reset_at == 0) {
+        halve();
+    }
+}
+
+int sketch_estimate(unsigned int hash) {
+    int min = SKETCH_MAX, v;
+
+    for (int i = 0; i < SKETCH_ROWS; i++) {
+        if ((v = __atomic_load_n(&rows[i][slot(hash, i)], __ATOMIC_RELAXED)) < min) {
+            min = v;
+        }
+    }
+    return min;
+}
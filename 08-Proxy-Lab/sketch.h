@@ -0,0 +1,20 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+
+#define SKETCH_ROWS 4
+#define SKETCH_MAX 15     /* counters saturate like 4-bit ones */
+#define SKETCH_SAMPLE 10  /* halve all counters every SAMPLE * width accesses */
+#define SKETCH_BATCH 64   /* accesses a thread counts before publishing them */
+
+/*
+ * Count-min sketch of recent access frequency per URI hash, shared by all
+ * shards. Updates are lock-free and racy by design: a lost increment or a
+ * counter halved twice only blurs an estimate.
+ */
+void sketch_init(int entries);
+void sketch_add(unsigned int hash);
+int sketch_estimate(unsigned int hash);
+
+#endif
@@ -0,0 +1,33 @@
+#define _GNU_SOURCE /* splice, pipe2, F_SETPIPE_SZ */
+#include <fcntl.h>
+#include <unistd.h>
+#include "splice.h"
+
+int relay_bufsize = DEFAULT_RELAY_BUF;
+int relay_use_splice = 1;
+
+void relay_config(int bufsize, int use_splice) {
+    if (bufsize > 0) relay_bufsize = bufsize;
+    relay_use_splice = use_splice;
+}
+
+/*
+ * Open the pipe a spliced relay goes through, grown to the relay size so
+ * one splice in and one out move a whole chunk. Returns -1 on error.
+ */
+int relay_pipe(int pipefd[2]) {
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+        return -1;
+    /* Best effort: the kernel caps this at /proc/sys/fs/pipe-max-size */
+    fcntl(pipefd[1], F_SETPIPE_SZ, relay_bufsize);
+    return 0;
+}
+
+/* Move up to len bytes between a socket and a pipe without copying */
+ssize_t relay_splice(int from, int to, size_t len, int nonblock) {
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_MORE;
+
+    if (nonblock)
+        flags |= SPLICE_F_NONBLOCK;
+    return splice(from, NULL, to, NULL, len, flags);
+}
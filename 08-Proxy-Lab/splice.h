@@ -0,0 +1,22 @@
+#ifndef SPLICE_H
+#define SPLICE_H
+
+#include <sys/types.h>
+
+#define DEFAULT_RELAY_BUF 65536 /* bytes per relay read or splice */
+
+/*
+ * Relay tuning shared by both serving modes: the size of the buffer an
+ * uncacheable response is copied through, and whether such responses go
+ * socket -> pipe -> socket with splice(2) instead, never entering user
+ * space. Kept apart from csapp.h, whose gai_error() clashes with the
+ * _GNU_SOURCE declarations splice needs.
+ */
+extern int relay_bufsize;
+extern int relay_use_splice;
+
+void relay_config(int bufsize, int use_splice);
+int relay_pipe(int pipefd[2]);
+ssize_t relay_splice(int from, int to, size_t len, int nonblock);
+
+#endif
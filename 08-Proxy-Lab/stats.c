@@ -0,0 +1,161 @@
+#include "stats.h"
+#include "cache.h"
+#include "disk.h"
+#include "log.h"
+
+static StatSlot slots[STATS_SLOTS];
+static unsigned int next_slot;
+static __thread StatSlot *mine;
+
+static char *counter_names[NUM_COUNTERS] = {
+    "requests", "cache_hits", "cache_disk_hits", "cache_misses",
+    "cache_coalesced", "cache_evictions", "cache_rejected",
+    "upstream_connects", "upstream_pool_reuses", "bytes_client",
+    "bytes_upstream", "errors", "log_dropped"
+};
+
+static char *hist_names[NUM_HISTS] = { "first_byte", "connect", "ttfb", "total" };
+
+static StatSlot *slot() {
+    if (mine == NULL) {
+        mine = &slots[__atomic_fetch_add(&next_slot, 1, __ATOMIC_RELAXED) % STATS_SLOTS];
+    }
+    return mine;
+}
+
+/* Monotonic microseconds */
+long stats_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void stats_count(counter_id id, long n) {
+    __atomic_add_fetch(&slot()->counters[id], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Log-linear bucket: values below HIST_SUB get their own bucket, larger
+ * ones HIST_SUB buckets per power of two, as in HdrHistogram.
+ */
+static int bucket_of(long v) {
+    int e;
+
+    if (v < HIST_SUB) return v < 0 ? 0 : v;
+    if (v >= 1L << 40) v = (1L << 40) - 1;
+    e = 63 - __builtin_clzl(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Lowest value in bucket i */
+static long bucket_value(int i) {
+    int e = i / HIST_SUB + HIST_SUB_BITS - 1;
+
+    if (i < HIST_SUB) return i;
+    return (long)(HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+void stats_record(hist_id id, long usec) {
+    StatSlot *s = slot();
+    long max;
+
+    __atomic_add_fetch(&s->buckets[id][bucket_of(usec)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->sum[id], usec, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&s->max[id], __ATOMIC_RELAXED);
+    while (usec > max &&
+           !__atomic_compare_exchange_n(&s->max[id], &max, usec, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void stats_begin(ReqStats *rs, long start) {
+    rs->start = start ? start : stats_now();
+    rs->first_byte = 0;
+    rs->bytes = 0;
+    rs->status = 0;
+    rs->hit = 0;
+}
+
+/* Account for n bytes just written to the client */
+void stats_sent(ReqStats *rs, long n) {
+    if (n <= 0) return;
+    if (rs->first_byte == 0) {
+        rs->first_byte = stats_now();
+        stats_record(HIST_FIRST_BYTE, rs->first_byte - rs->start);
+    }
+    rs->bytes += n;
+    stats_count(CTR_BYTES_CLIENT, n);
+}
+
+/* The response is finished, or abandoned */
+void stats_done(ReqStats *rs, char *url) {
+    long usec = stats_now() - rs->start;
+
+    stats_count(CTR_REQUESTS, 1);
+    stats_record(HIST_TOTAL, usec);
+    log_access(url, rs->status, rs->hit, rs->bytes, usec);
+}
+
+static int render_hist(char *buf, int len, hist_id id) {
+    static double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    long buckets[HIST_BUCKETS] = { 0 }, count = 0, sum = 0, max = 0, seen;
+    int n = 0, i, q;
+
+    for (int j = 0; j < STATS_SLOTS; j++) {
+        for (i = 0; i < HIST_BUCKETS; i++) {
+            buckets[i] += __atomic_load_n(&slots[j].buckets[id][i], __ATOMIC_RELAXED);
+        }
+        sum += __atomic_load_n(&slots[j].sum[id], __ATOMIC_RELAXED);
+        if (slots[j].max[id] > max) max = slots[j].max[id];
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) count += buckets[i];
+
+    for (q = 0, i = 0, seen = 0; q < 4; q++) {
+        while (i < HIST_BUCKETS && seen + buckets[i] < quantiles[q] * count) {
+            seen += buckets[i++];
+        }
+        n += snprintf(buf + n, len - n, "latency_us{stage=\"%s\",quantile=\"%g\"} %ld\n",
+                      hist_names[id], quantiles[q], count ? bucket_value(i) : 0);
+    }
+    n += snprintf(buf + n, len - n, "latency_us_max{stage=\"%s\"} %ld\n", hist_names[id], max);
+    n += snprintf(buf + n, len - n, "latency_us_sum{stage=\"%s\"} %ld\n", hist_names[id], sum);
+    n += snprintf(buf + n, len - n, "latency_us_count{stage=\"%s\"} %ld\n", hist_names[id], count);
+    return n;
+}
+
+/* Write every metric as "name value" lines; returns the length */
+int stats_render(char *buf, int len) {
+    long entries, bytes;
+    int n = 0;
+
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        long v = 0;
+        for (int j = 0; j < STATS_SLOTS; j++) {
+            v += __atomic_load_n(&slots[j].counters[i], __ATOMIC_RELAXED);
+        }
+        n += snprintf(buf + n, len - n, "%s %ld\n", counter_names[i], v);
+    }
+    cache_usage(&entries, &bytes);
+    n += snprintf(buf + n, len - n, "cache_objects %ld\ncache_bytes %ld\n", entries, bytes);
+    disk_usage(&entries, &bytes);
+    n += snprintf(buf + n, len - n, "disk_objects %ld\ndisk_bytes %ld\n", entries, bytes);
+    for (int i = 0; i < NUM_HISTS; i++) {
+        n += render_hist(buf + n, len - n, i);
+    }
+    return n < len ? n : len - 1;
+}
+
+/* A complete HTTP response carrying the metrics, for METRICS_PATH */
+int stats_reply(char *buf, int len) {
+    char body[MAXBUF];
+    int n = stats_render(body, sizeof(body));
+
+    n = snprintf(buf, len,
+                 "HTTP/1.0 200 OK\r\n"
+                 "Connection: close\r\n"
+                 "Content-Type: text/plain\r\n"
+                 "Content-Length: %d\r\n\r\n%s",
+                 n, body);
+    return n < len ? n : len - 1;
+}
@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "csapp.h"
+
+#define METRICS_PATH "/metrics" /* origin-form request the proxy answers itself */
+#define STATS_SLOTS 32
+#define HIST_SUB_BITS 3         /* 8 linear steps per power of two: ~12% error */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS 320        /* covers up to 2^40 us */
+
+typedef enum {
+    CTR_REQUESTS,
+    CTR_HITS,              /* requests served from the cache */
+    CTR_DISK_HITS,         /* lookups the disk tier answered */
+    CTR_MISSES,            /* requests fetched upstream */
+    CTR_COALESCED,         /* misses that waited on another request's fetch */
+    CTR_EVICTIONS,
+    CTR_REJECTED,          /* objects the admission filter kept out */
+    CTR_CONNECTS,          /* new upstream connections */
+    CTR_POOL_REUSES,
+    CTR_BYTES_CLIENT,      /* bytes sent to clients */
+    CTR_BYTES_UPSTREAM,    /* response bytes read from origins */
+    CTR_ERRORS,            /* error replies and failed upstream fetches */
+    CTR_LOG_DROPPED,       /* access log lines lost to a full ring */
+    NUM_COUNTERS
+} counter_id;
+
+typedef enum {
+    HIST_FIRST_BYTE, /* request arrival to the first byte sent back */
+    HIST_CONNECT,    /* upstream name lookup and connect */
+    HIST_TTFB,       /* request sent upstream to first response byte */
+    HIST_TOTAL,      /* request arrival to the last byte sent back */
+    NUM_HISTS
+} hist_id;
+
+/*
+ * Each thread adds into one of STATS_SLOTS cache-line-aligned slots with
+ * relaxed atomics, so counting takes no lock and rarely shares a line;
+ * readers sum the slots.
+ */
+typedef struct
+{
+    long counters[NUM_COUNTERS];
+    long buckets[NUM_HISTS][HIST_BUCKETS];
+    long sum[NUM_HISTS];
+    long max[NUM_HISTS];
+} __attribute__((aligned(64))) StatSlot;
+
+/* One request's accounting, filled in by whichever mode serves it */
+typedef struct
+{
+    long start;      /* us when the request arrived */
+    long first_byte; /* us of the first byte sent, 0 before */
+    long bytes;      /* bytes sent to the client */
+    int status;
+    int hit;
+} ReqStats;
+
+long stats_now();
+void stats_count(counter_id id, long n);
+void stats_record(hist_id id, long usec);
+void stats_begin(ReqStats *rs, long start);
+void stats_sent(ReqStats *rs, long n);
+void stats_done(ReqStats *rs, char *url);
+int stats_render(char *buf, int len);
+int stats_reply(char *buf, int len);
+
+#endif